@@ -0,0 +1,368 @@
+#!/usr/bin/env python3
+"""
+Artwork cache trace replay.
+
+Replays artwork cache accesses recorded by the component (Advanced > Tools >
+Playlist Sync > Record artwork cache accesses, which writes
+foo_nsync_artwork_trace.tsv in the profile folder) against other cache policies
+and sizes, and reports hit ratio, memory and the estimated time spent waiting
+for art.
+
+    python bench/artwork_cache_replay.py foo_nsync_artwork_trace.tsv
+    python bench/artwork_cache_replay.py --synthetic 50000 --write-synthetic synthetic.tsv
+
+Two tiers are simulated:
+  client  every lookup that found or fetched art (H and M lines); policies keyed
+          by URL (one per track, as the component does today) or by folder
+          (one per album, which is what the server actually serves)
+  server  the lookups that missed the client cache (M lines), keyed by folder
+          like the server's cache; the current policy clears half the cache
+          when it is full
+
+Trace lines: time_ms, key hash, folder hash, bytes, result (H hit, M fetched,
+N known missing, F failed), latency_us. Lines starting with # begin a session.
+"""
+
+import argparse
+import bisect
+import json
+import math
+import random
+import zlib
+from collections import OrderedDict
+
+MB = 1024 * 1024
+
+
+# --- Policies --------------------------------------------------------------
+# access(key, size) returns True on a hit and inserts on a miss; `bytes` is
+# the memory held by cached images.
+
+class LRU:
+    def __init__(self, entries=0, max_bytes=0):
+        self.entries = entries
+        self.max_bytes = max_bytes
+        self.items = OrderedDict()
+        self.bytes = 0
+
+    def access(self, key, size):
+        if key in self.items:
+            self.items.move_to_end(key)
+            return True
+        self.items[key] = size
+        self.bytes += size
+        while self.items and ((self.entries and len(self.items) > self.entries) or
+                              (self.max_bytes and self.bytes > self.max_bytes)):
+            _, evicted = self.items.popitem(last=False)
+            self.bytes -= evicted
+        return False
+
+
+class ClearHalf:
+    """The server's cache: insertion order, the older half dropped when full."""
+
+    def __init__(self, entries):
+        self.entries = entries
+        self.items = OrderedDict()
+        self.bytes = 0
+
+    def access(self, key, size):
+        if key in self.items:
+            return True
+        if len(self.items) >= self.entries:
+            for _ in range(len(self.items) // 2):
+                _, evicted = self.items.popitem(last=False)
+                self.bytes -= evicted
+        self.items[key] = size
+        self.bytes += size
+        return False
+
+
+class ARC:
+    """Adaptive Replacement Cache (Megiddo and Modha), sized in entries."""
+
+    def __init__(self, entries):
+        self.c = entries
+        self.p = 0
+        self.t1, self.t2 = OrderedDict(), OrderedDict()
+        self.b1, self.b2 = OrderedDict(), OrderedDict()
+        self.bytes = 0
+
+    def _replace(self, in_b2):
+        if self.t1 and (len(self.t1) > self.p or (in_b2 and len(self.t1) == self.p)):
+            key, size = self.t1.popitem(last=False)
+            self.b1[key] = None
+        else:
+            key, size = self.t2.popitem(last=False)
+            self.b2[key] = None
+        self.bytes -= size
+
+    def access(self, key, size):
+        if key in self.t1:
+            self.t2[key] = self.t1.pop(key)
+            return True
+        if key in self.t2:
+            self.t2.move_to_end(key)
+            return True
+
+        if key in self.b1:
+            self.p = min(self.c, self.p + max(len(self.b2) // max(len(self.b1), 1), 1))
+            self._replace(False)
+            del self.b1[key]
+            self.t2[key] = size
+        elif key in self.b2:
+            self.p = max(0, self.p - max(len(self.b1) // max(len(self.b2), 1), 1))
+            self._replace(True)
+            del self.b2[key]
+            self.t2[key] = size
+        else:
+            if len(self.t1) + len(self.b1) == self.c:
+                if len(self.t1) < self.c:
+                    self.b1.popitem(last=False)
+                    self._replace(False)
+                else:
+                    _, evicted = self.t1.popitem(last=False)
+                    self.bytes -= evicted
+            elif len(self.t1) + len(self.b1) < self.c:
+                total = len(self.t1) + len(self.t2) + len(self.b1) + len(self.b2)
+                if total >= self.c:
+                    if total == 2 * self.c:
+                        self.b2.popitem(last=False)
+                    self._replace(False)
+            self.t1[key] = size
+        self.bytes += size
+        return False
+
+
+class CountMinSketch:
+    """4-bit counters halved periodically, as in TinyLFU."""
+
+    def __init__(self, entries):
+        self.width = 1 << max(6, math.ceil(math.log2(max(1, entries) * 4)))
+        self.rows = [[0] * self.width for _ in range(4)]
+        self.seeds = [0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F]
+        self.additions = 0
+        self.reset_at = max(1, entries) * 10
+
+    def _indexes(self, key):
+        h = zlib.crc32(key.encode())  # Not hash(): str hashes change between runs
+        return [((h ^ seed) * 0x9E3779B97F4A7C15 >> 16) & (self.width - 1) for seed in self.seeds]
+
+    def add(self, key):
+        for row, i in zip(self.rows, self._indexes(key)):
+            if row[i] < 15:
+                row[i] += 1
+        self.additions += 1
+        if self.additions >= self.reset_at:
+            self.additions //= 2
+            for row in self.rows:
+                for i in range(self.width):
+                    row[i] >>= 1
+
+    def estimate(self, key):
+        return min(row[i] for row, i in zip(self.rows, self._indexes(key)))
+
+
+class WTinyLFU:
+    """Window TinyLFU: a 1% LRU window in front of a segmented LRU guarded by a frequency sketch."""
+
+    def __init__(self, entries):
+        self.window_cap = max(1, entries // 100)
+        self.main_cap = max(1, entries - self.window_cap)
+        self.protected_cap = max(1, self.main_cap * 8 // 10)
+        self.window, self.probation, self.protected = OrderedDict(), OrderedDict(), OrderedDict()
+        self.sketch = CountMinSketch(entries)
+        self.bytes = 0
+
+    def access(self, key, size):
+        self.sketch.add(key)
+        if key in self.window:
+            self.window.move_to_end(key)
+            return True
+        if key in self.protected:
+            self.protected.move_to_end(key)
+            return True
+        if key in self.probation:
+            self.protected[key] = self.probation.pop(key)
+            if len(self.protected) > self.protected_cap:
+                demoted, demoted_size = self.protected.popitem(last=False)
+                self.probation[demoted] = demoted_size
+            return True
+
+        self.window[key] = size
+        self.bytes += size
+        if len(self.window) > self.window_cap:
+            candidate, candidate_size = self.window.popitem(last=False)
+            if len(self.probation) + len(self.protected) < self.main_cap:
+                self.probation[candidate] = candidate_size
+            else:
+                victims = self.probation if self.probation else self.protected
+                victim = next(iter(victims))
+                if self.sketch.estimate(candidate) > self.sketch.estimate(victim):
+                    self.bytes -= victims.pop(victim)
+                    self.probation[candidate] = candidate_size
+                else:
+                    self.bytes -= candidate_size
+        return False
+
+
+# --- Traces ----------------------------------------------------------------
+
+def read_trace(path):
+    """Yields (key, folder, bytes, result, latency_us) in order."""
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            if line.startswith("#") or not line.strip():
+                continue
+            fields = line.rstrip("\n").split("\t")
+            if len(fields) != 6:
+                continue
+            yield fields[1], fields[2], int(fields[3]), fields[4], int(fields[5])
+
+
+def synthetic_trace(count, albums=3000, zipf=0.9, seed=1):
+    """Album-at-a-time listening with Zipf album popularity, plus bursts of
+    browsing (a playlist view asking for the art of many tracks at once)."""
+    rng = random.Random(seed)
+    weights = [1.0 / (rank ** zipf) for rank in range(1, albums + 1)]
+    cumulative = []
+    total = 0.0
+    for w in weights:
+        total += w
+        cumulative.append(total)
+
+    def pick_album():
+        return bisect.bisect_left(cumulative, rng.random() * total)
+
+    sizes = [int(min(4 * MB, max(8 * 1024, rng.lognormvariate(math.log(180 * 1024), 0.8))))
+             for _ in range(albums)]
+    current = LRU(entries=100)  # Hits and misses as today's client cache would record them
+    events = []
+    while len(events) < count:
+        album = pick_album()
+        tracks = 12
+        if rng.random() < 0.2:
+            picks = [(album, t) for t in range(tracks)]  # Browsing: the whole album at once
+        else:
+            first = rng.randrange(tracks) if rng.random() < 0.3 else 0
+            picks = [(album, t) for t in range(first, tracks) if rng.random() > 0.05]
+        for album_id, track in picks:
+            key = f"{album_id:08x}{track:08x}"
+            result = "H" if current.access(key, sizes[album_id]) else "M"
+            latency = 40 if result == "H" else int(rng.lognormvariate(math.log(60000), 0.6))
+            events.append((key, f"{album_id:016x}", sizes[album_id], result, latency))
+    return events[:count]
+
+
+def write_trace(path, events):
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("# foo_nsync artwork trace 1: time_ms key dir bytes result(H/M/N/F) latency_us\n")
+        for i, (key, folder, size, result, latency) in enumerate(events):
+            f.write(f"{i * 250}\t{key}\t{folder}\t{size}\t{result}\t{latency}\n")
+
+
+# --- Replay ----------------------------------------------------------------
+
+def replay(cache, accesses, hit_us, miss_us):
+    hits = hit_bytes = total_bytes = peak = 0
+    for key, size in accesses:
+        total_bytes += size
+        if cache.access(key, size):
+            hits += 1
+            hit_bytes += size
+        peak = max(peak, cache.bytes)
+    count = len(accesses)
+    misses = count - hits
+    return {
+        "hit_ratio": round(hits / count, 4) if count else 0.0,
+        "byte_hit_ratio": round(hit_bytes / total_bytes, 4) if total_bytes else 0.0,
+        "misses": misses,
+        "peak_mb": round(peak / MB, 2),
+        # Time callers spent waiting for art, from the trace's mean hit and fetch times
+        "est_wait_s": round((hits * hit_us + misses * miss_us) / 1e6, 2) if miss_us is not None else None,
+    }
+
+
+def parse_list(text, scale=1):
+    return [int(float(v) * scale) for v in text.split(",") if v.strip()]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay artwork cache traces against other cache policies")
+    parser.add_argument("trace", nargs="?", help="foo_nsync_artwork_trace.tsv")
+    parser.add_argument("--synthetic", type=int, help="Generate a synthetic trace of this many lookups instead")
+    parser.add_argument("--write-synthetic", help="Save the synthetic trace here")
+    parser.add_argument("--entries", default="25,50,100,200,400,800", help="Entry capacities to try")
+    parser.add_argument("--megabytes", default="8,16,32,64,128", help="Byte capacities to try (MB)")
+    parser.add_argument("--server-entries", default="100,250,500,1000", help="Server cache capacities to try")
+    parser.add_argument("--out", help="Write the results as JSON")
+    args = parser.parse_args()
+
+    if args.synthetic:
+        events = synthetic_trace(args.synthetic)
+        if args.write_synthetic:
+            write_trace(args.write_synthetic, events)
+    elif args.trace:
+        events = list(read_trace(args.trace))
+    else:
+        parser.error("give a trace file or --synthetic")
+
+    # Only lookups that ended with an image use the image cache
+    images = [e for e in events if e[3] in ("H", "M")]
+    fetched = [e for e in images if e[3] == "M"]
+    hit_latencies = [e[4] for e in images if e[3] == "H"]
+    miss_us = sum(e[4] for e in fetched) / len(fetched) if fetched else 0
+    hit_us = sum(hit_latencies) / len(hit_latencies) if hit_latencies else 0
+
+    summary = {
+        "lookups": len(events),
+        "image_lookups": len(images),
+        "known_missing": sum(1 for e in events if e[3] == "N"),
+        "failed": sum(1 for e in events if e[3] == "F"),
+        "recorded_hit_ratio": round(len(hit_latencies) / len(images), 4) if images else 0.0,
+        "distinct_urls": len({e[0] for e in images}),
+        "distinct_folders": len({e[1] for e in images}),
+        "mean_hit_ms": round(hit_us / 1000, 3),
+        "mean_fetch_ms": round(miss_us / 1000, 3),
+    }
+
+    by_url = [(e[0], e[2]) for e in images]
+    by_folder = [(e[1], e[2]) for e in images]
+    to_server = [(e[1], e[2]) for e in fetched]
+
+    runs = []
+
+    def run(tier, policy, capacity, cache, accesses):
+        result = {"tier": tier, "policy": policy, "capacity": capacity}
+        # A server miss costs a disk read, which the client's trace does not measure
+        result.update(replay(cache, accesses, hit_us, miss_us if tier == "client" else None))
+        runs.append(result)
+
+    for n in parse_list(args.entries):
+        run("client", "lru (url, current)", f"{n}", LRU(entries=n), by_url)
+        run("client", "arc (url)", f"{n}", ARC(n), by_url)
+        run("client", "w-tinylfu (url)", f"{n}", WTinyLFU(n), by_url)
+        run("client", "lru (folder)", f"{n}", LRU(entries=n), by_folder)
+        run("client", "w-tinylfu (folder)", f"{n}", WTinyLFU(n), by_folder)
+    for mb in parse_list(args.megabytes):
+        run("client", "byte-lru (url)", f"{mb} MB", LRU(max_bytes=mb * MB), by_url)
+        run("client", "byte-lru (folder)", f"{mb} MB", LRU(max_bytes=mb * MB), by_folder)
+    for n in parse_list(args.server_entries):
+        run("server", "clear-half (current)", f"{n}", ClearHalf(n), to_server)
+        run("server", "lru", f"{n}", LRU(entries=n), to_server)
+        run("server", "arc", f"{n}", ARC(n), to_server)
+        run("server", "w-tinylfu", f"{n}", WTinyLFU(n), to_server)
+
+    print(json.dumps(summary, indent=2))
+    print(f"\n{'tier':<7} {'policy':<22} {'capacity':>9} {'hit':>7} {'byte hit':>9} {'peak MB':>9} {'wait s':>9}")
+    for r in runs:
+        print(f"{r['tier']:<7} {r['policy']:<22} {r['capacity']:>9} {r['hit_ratio']:>7.2%} "
+              f"{r['byte_hit_ratio']:>9.2%} {r['peak_mb']:>9.1f} "
+              f"{'-' if r['est_wait_s'] is None else format(r['est_wait_s'], '.1f'):>9}")
+    if args.out:
+        with open(args.out, "w", encoding="utf-8") as f:
+            json.dump({"summary": summary, "runs": runs}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Synthetic music library generator for benchmarks.
+
+Builds an Artist/Album/Track tree of stub audio files (a few bytes each - the
+server only looks at names and extensions) with optional cover art and a share
+of non-ASCII names, deterministic for a given seed. --track-size makes the
+tracks sparse files of that size, for streaming benchmarks.
+
+    python gen_library.py /tmp/library --files 20000 --depth 2 --artwork-ratio 0.8
+"""
+
+import argparse
+import os
+import random
+from pathlib import Path
+
+UNICODE_WORDS = ["Björk", "Sigur Rós", "坂本龍一", "Дмитрий", "Ελευθερία", "Dvořák",
+                 "ساز", "Mötley", "Café Tacvba", "東京", "naïve", "Ångström"]
+ASCII_WORDS = ["Night", "Echo", "River", "Signal", "Glass", "Orbit", "Paper", "Winter",
+               "Harbor", "Static", "Velvet", "North", "Ember", "Lantern", "Atlas", "Drift"]
+EXTENSIONS = [".flac", ".mp3", ".m4a", ".ogg", ".opus"]
+TRACKS_PER_ALBUM = 12
+STUB_AUDIO = b"\0" * 64
+STUB_JPEG = b"\xff\xd8\xff\xe0" + b"\0" * 252 + b"\xff\xd9"
+
+
+def _name(rng: random.Random, unicode_ratio: float, words: int = 2) -> str:
+    pool = UNICODE_WORDS if rng.random() < unicode_ratio else ASCII_WORDS
+    return " ".join(rng.choice(pool) for _ in range(words))
+
+
+def generate(root: str, files: int, depth: int = 2, artwork_ratio: float = 0.8,
+             unicode_ratio: float = 0.1, seed: int = 1, track_size: int = 0) -> int:
+    """Create `files` stub tracks under `root`; returns the number written."""
+    rng = random.Random(seed)
+    root_path = Path(root)
+    root_path.mkdir(parents=True, exist_ok=True)
+    depth = max(1, depth)
+
+    written = 0
+    album = 0
+    artist = ""
+    while written < files:
+        if album % 8 == 0:
+            artist = f"{_name(rng, unicode_ratio)} {album // 8:04d}"
+
+        # Nested folders: Artist / Album (/ Disc ...) down to `depth` levels
+        parts = [artist]
+        for level in range(1, depth):
+            parts.append(f"{_name(rng, unicode_ratio, 3)} {album:05d}" if level == 1 else f"Disc {level}")
+        album_dir = root_path.joinpath(*parts)
+        album_dir.mkdir(parents=True, exist_ok=True)
+
+        if rng.random() < artwork_ratio:
+            (album_dir / "cover.jpg").write_bytes(STUB_JPEG)
+
+        ext = rng.choice(EXTENSIONS)
+        for track in range(1, TRACKS_PER_ALBUM + 1):
+            if written >= files:
+                break
+            title = _name(rng, unicode_ratio, 3)
+            with open(album_dir / f"{track:02d} - {title}{ext}", "wb") as f:
+                f.write(STUB_AUDIO)
+                if track_size > len(STUB_AUDIO):
+                    f.truncate(track_size)  # Sparse: no disk space, reads back zeros
+            written += 1
+        album += 1
+
+    return written
+
+
+def add_tracks(root: str, count: int, seed: int = 2) -> int:
+    """Add `count` tracks in a new artist folder (a small delta)."""
+    return generate(os.path.join(root, f"New Arrivals {seed:04d}"), count, depth=2,
+                    artwork_ratio=1.0, unicode_ratio=0.0, seed=seed)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a synthetic music library")
+    parser.add_argument("root", help="Directory to create the library in")
+    parser.add_argument("--files", type=int, default=20000, help="Number of tracks")
+    parser.add_argument("--depth", type=int, default=2, help="Folder levels below the root")
+    parser.add_argument("--artwork-ratio", type=float, default=0.8, help="Share of albums with cover.jpg")
+    parser.add_argument("--unicode-ratio", type=float, default=0.1, help="Share of non-ASCII names")
+    parser.add_argument("--track-size", type=int, default=0, help="Track file size in bytes (sparse)")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    count = generate(args.root, args.files, args.depth, args.artwork_ratio, args.unicode_ratio, args.seed,
+                     args.track_size)
+    print(f"Wrote {count} tracks to {args.root}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+"""
+End-to-end sync benchmark.
+
+Generates a synthetic library, serves it with server/main.py on localhost and
+replays what the client does for each scenario (POST /sync, GET /hash, GET
+/playlist when the hash changed), feeding the downloaded playlist to the
+client's sync core (bench/sync_bench, built with CMake from src/). Prints one
+JSON document with per-scenario latency, bytes, peak memory and CPU time, so
+runs can be compared across versions.
+
+    python bench/run_sync_bench.py --files 20000 --out results.json
+
+Scenarios: initial sync, no change, small delta (new album folder and a few
+deletions), mass rename (one artist folder renamed). --wan runs the client's
+requests through bench/wan_proxy.py with one of its link scenarios.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import http.client
+import urllib.request
+from pathlib import Path
+
+import gen_library
+from wan_proxy import WanProxy, load_phases
+
+BENCH_DIR = Path(__file__).resolve().parent
+SERVER_DIR = BENCH_DIR.parent / "server"
+PLAYLIST_NAME = "bench"
+
+
+def free_port() -> int:
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def build_driver(build_dir: Path) -> Path:
+    exe = build_dir / ("sync_bench.exe" if os.name == "nt" else "sync_bench")
+    if not exe.exists():
+        subprocess.run(["cmake", "-S", str(BENCH_DIR), "-B", str(build_dir), "-DCMAKE_BUILD_TYPE=Release"],
+                       check=True, stdout=subprocess.DEVNULL)
+        subprocess.run(["cmake", "--build", str(build_dir), "--config", "Release"], check=True,
+                       stdout=subprocess.DEVNULL)
+        if not exe.exists():
+            exe = build_dir / "Release" / exe.name
+    return exe
+
+
+def timed_request(url: str, method: str = "GET"):
+    """Returns (status, body, milliseconds); errors are returned, not raised."""
+    started = time.perf_counter()
+    req = urllib.request.Request(url, method=method)
+    try:
+        with urllib.request.urlopen(req, timeout=600) as resp:
+            body = resp.read()
+            status = resp.status
+    except urllib.error.HTTPError as e:
+        body, status = e.read(), e.code
+    except (OSError, http.client.HTTPException):
+        body, status = b"", 0  # Reset or timed out (see --wan)
+    return status, body, (time.perf_counter() - started) * 1000
+
+
+class BenchServer:
+    def __init__(self, library: Path, work: Path):
+        self.port = free_port()
+        self.base_url = f"http://127.0.0.1:{self.port}"
+        config_dir = work / "config"
+        self.playlist_dir = work / "playlists"
+        config_dir.mkdir()
+        self.playlist_dir.mkdir()
+        (config_dir / "config.json").write_text(json.dumps({
+            "playlist_dir": str(self.playlist_dir),
+            "include_artwork": True,
+            "sources": [{"name": PLAYLIST_NAME, "path": str(library), "recursive": True}],
+        }))
+        env = dict(os.environ, PORT=str(self.port), BIND_ADDRESS="127.0.0.1", CONFIG_DIR=str(config_dir),
+                   PLAYLIST_DIR=str(self.playlist_dir), DISCOVERY="0", INDEX_REFRESH_INTERVAL="0",
+                   LOG_LEVEL="WARNING", PYTHONDONTWRITEBYTECODE="1")
+        self.log = open(work / "server.log", "wb")
+        started = time.perf_counter()
+        self.process = subprocess.Popen([sys.executable, "main.py"], cwd=str(SERVER_DIR), env=env,
+                                        stdout=self.log, stderr=subprocess.STDOUT)
+        self.wait_ready()
+        self.startup_ms = (time.perf_counter() - started) * 1000
+
+    def wait_ready(self, timeout: float = 600):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if self.process.poll() is not None:
+                raise RuntimeError("server exited during startup (see server.log)")
+            try:
+                status, _, _ = timed_request(f"{self.base_url}/hash/{PLAYLIST_NAME}")
+                if status == 200:
+                    return
+            except OSError:
+                pass
+            time.sleep(0.2)
+        raise RuntimeError("server did not become ready")
+
+    def stop(self):
+        self.process.terminate()
+        try:
+            self.process.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            self.process.kill()
+        self.log.close()
+
+
+class Client:
+    """Replays sync_manager's request sequence and runs the sync core on the result."""
+
+    def __init__(self, base_url: str, driver: Path, work: Path):
+        self.base_url = base_url
+        self.driver = driver
+        self.work = work
+        self.state = work / "client_state.txt"
+        self.state.write_text("")
+        self.last_hash = ""
+
+    def request(self, result: dict, url: str, method: str = "GET"):
+        """timed_request with retries for dropped connections; the time includes the retries."""
+        total_ms = 0.0
+        for _ in range(3):
+            status, body, ms = timed_request(url, method)
+            total_ms += ms
+            if status != 0:
+                break
+            result["errors"] = result.get("errors", 0) + 1
+        return status, body, total_ms
+
+    def sync(self, scenario: str) -> dict:
+        base = self.base_url
+        result = {"scenario": scenario}
+
+        status, body, ms = self.request(result, f"{base}/sync/{PLAYLIST_NAME}", "POST")
+        result["server_sync_ms"] = round(ms, 2)
+        if status == 200:
+            reply = json.loads(body)
+            result["server_added"] = reply.get("added_count", 0)
+            result["server_removed"] = reply.get("removed_count", 0)
+
+        status, body, ms = self.request(result, f"{base}/hash/{PLAYLIST_NAME}")
+        result["hash_ms"] = round(ms, 2)
+        result["bytes"] = len(body)
+        new_hash = body.decode() if status == 200 else self.last_hash
+
+        if new_hash == self.last_hash:
+            result["changed"] = False
+            result["total_ms"] = round(result["server_sync_ms"] + result["hash_ms"], 2)
+            return result
+
+        status, body, ms = self.request(result, f"{base}/playlist/{PLAYLIST_NAME}")
+        result["changed"] = True
+        result["download_ms"] = round(ms, 2)
+        if status != 200:
+            result["total_ms"] = round(result["server_sync_ms"] + result["hash_ms"] + ms, 2)
+            return result  # Failed; the hash is retried on the next scenario
+        result["bytes"] += len(body)
+        playlist_file = self.work / "playlist.m3u8"
+        playlist_file.write_bytes(body)
+
+        next_state = self.work / "client_state.next"
+        started = time.perf_counter()
+        out = subprocess.run([str(self.driver), "--playlist", str(playlist_file), "--base-url", base,
+                              "--state", str(self.state), "--write-state", str(next_state)],
+                             check=True, capture_output=True)
+        driver_wall_ms = (time.perf_counter() - started) * 1000
+        next_state.replace(self.state)
+        self.last_hash = new_hash
+
+        client = json.loads(out.stdout)
+        result["client"] = client
+        result["total_ms"] = round(result["server_sync_ms"] + result["hash_ms"] + result["download_ms"] +
+                                   client["snapshot_ms"] + client["parse_diff_ms"] + client["apply_ms"], 2)
+        result["client_process_ms"] = round(driver_wall_ms, 2)
+        return result
+
+
+def run(args) -> dict:
+    driver = build_driver(Path(args.build_dir).resolve())
+    work = Path(tempfile.mkdtemp(prefix="nsync_bench_"))
+    library = work / "library"
+    results = {
+        "files": args.files, "depth": args.depth, "artwork_ratio": args.artwork_ratio,
+        "unicode_ratio": args.unicode_ratio, "scenarios": [],
+    }
+    server = None
+    proxy = None
+    try:
+        started = time.perf_counter()
+        gen_library.generate(str(library), args.files, args.depth, args.artwork_ratio, args.unicode_ratio, args.seed)
+        results["generate_ms"] = round((time.perf_counter() - started) * 1000, 2)
+
+        server = BenchServer(library, work)
+        results["server_startup_ms"] = round(server.startup_ms, 2)
+        base_url = server.base_url
+        if args.wan or args.wan_file:
+            proxy = WanProxy("127.0.0.1", server.port, load_phases(args.wan, args.wan_file)).start()
+            base_url = f"http://127.0.0.1:{proxy.port}"
+            results["wan"] = args.wan_file or args.wan
+        client = Client(base_url, driver, work)
+
+        results["scenarios"].append(client.sync("initial"))
+        results["scenarios"].append(client.sync("no_change"))
+
+        # Small delta: a new album folder plus a few deleted tracks
+        delta = max(1, args.files // 100)
+        gen_library.add_tracks(str(library), delta, seed=args.seed + 1)
+        for victim in sorted(library.rglob("*.flac"))[: max(1, delta // 2)]:
+            victim.unlink()
+        results["scenarios"].append(client.sync("small_delta"))
+
+        # Mass rename: the largest artist folder gets a new name
+        artists = [d for d in library.iterdir() if d.is_dir()]
+        biggest = max(artists, key=lambda d: sum(1 for _ in d.rglob("*")))
+        biggest.rename(biggest.with_name(biggest.name + " (Remastered)"))
+        results["scenarios"].append(client.sync("mass_rename"))
+    finally:
+        if proxy:
+            proxy.stop()
+            results["wan_stats"] = proxy.stats
+        if server:
+            server.stop()
+        if not args.keep:
+            shutil.rmtree(work, ignore_errors=True)
+        else:
+            results["work_dir"] = str(work)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End-to-end playlist sync benchmark")
+    parser.add_argument("--files", type=int, default=20000)
+    parser.add_argument("--depth", type=int, default=2)
+    parser.add_argument("--artwork-ratio", type=float, default=0.8)
+    parser.add_argument("--unicode-ratio", type=float, default=0.1)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--build-dir", default=str(BENCH_DIR / "_build"), help="CMake build directory for sync_bench")
+    parser.add_argument("--out", help="Write the JSON report here as well as to stdout")
+    parser.add_argument("--keep", action="store_true", help="Keep the generated library and server files")
+    parser.add_argument("--wan", help="Emulate a WAN link between client and server (see wan_proxy.py --list)")
+    parser.add_argument("--wan-file", help="WAN scenario from a JSON file (see wan_proxy.py)")
+    args = parser.parse_args()
+
+    results = run(args)
+    report = json.dumps(results, indent=2, ensure_ascii=False)
+    print(report)
+    if args.out:
+        Path(args.out).write_text(report, encoding="utf-8")
+
+
+if __name__ == "__main__":
+    main()
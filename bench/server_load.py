@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+"""
+Server load test.
+
+Simulates N foo_nsync clients against server/main.py and reports latency
+percentiles, throughput and error rate per route for each concurrency level,
+so server changes can be compared on one machine.
+
+    python bench/server_load.py --clients 1,8,32,128 --duration 20 --out load.json
+
+Each simulated client keeps one keep-alive connection, as the component does
+(--no-keepalive opens one per request instead, for comparison),
+and loops over what a listening user causes:
+  - polls GET /hash/<playlist> every --poll-interval seconds and downloads
+    GET /playlist/<playlist> every --playlist-every polls
+  - plays tracks album by album, fetching GET /artwork/... on each album change
+    (the component caches art per album) and skipping to a random album with
+    --skip-ratio
+  - streams each track in Range requests of --chunk bytes paced at --bitrate
+    (--no-pace to saturate), seeking to a random offset with --seek-ratio
+
+By default a synthetic library of sparse --track-size files is generated and
+served on localhost; --url tests an already running server instead. --wan puts
+a bench/wan_proxy.py link scenario between the clients and the server.
+"""
+
+import argparse
+import http.client
+import json
+import random
+import shutil
+import tempfile
+import threading
+import time
+import urllib.parse
+from pathlib import Path
+
+import gen_library
+from run_sync_bench import PLAYLIST_NAME, BenchServer
+from wan_proxy import WanProxy, load_phases
+
+ROUTES = ["hash", "playlist", "artwork", "stream_start", "stream_next", "stream_seek"]
+
+
+def percentile(sorted_values, pct: float) -> float:
+    if not sorted_values:
+        return 0.0
+    rank = max(0, min(len(sorted_values) - 1, int(round(pct / 100.0 * len(sorted_values) + 0.5)) - 1))
+    return sorted_values[rank]
+
+
+class RouteStats:
+    def __init__(self):
+        self.latencies_ms = []
+        self.bytes = 0
+        self.errors = 0
+
+
+class Recorder:
+    """Per-route samples shared by all clients of one concurrency level."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.routes = {route: RouteStats() for route in ROUTES}
+
+    def add(self, route: str, ms: float, size: int, ok: bool):
+        with self.lock:
+            stats = self.routes[route]
+            if ok:
+                stats.latencies_ms.append(ms)
+                stats.bytes += size
+            else:
+                stats.errors += 1
+
+    def summary(self, elapsed: float) -> dict:
+        result = {}
+        total_requests = total_errors = total_bytes = 0
+        for route, stats in self.routes.items():
+            count = len(stats.latencies_ms)
+            if count == 0 and stats.errors == 0:
+                continue
+            values = sorted(stats.latencies_ms)
+            result[route] = {
+                "requests": count + stats.errors,
+                "errors": stats.errors,
+                "error_rate": round(stats.errors / (count + stats.errors), 4),
+                "p50_ms": round(percentile(values, 50), 2),
+                "p99_ms": round(percentile(values, 99), 2),
+                "max_ms": round(values[-1], 2) if values else 0.0,
+                "req_per_s": round((count + stats.errors) / elapsed, 2),
+                "mb_per_s": round(stats.bytes / elapsed / 1e6, 3),
+            }
+            total_requests += count + stats.errors
+            total_errors += stats.errors
+            total_bytes += stats.bytes
+        result["total"] = {
+            "requests": total_requests,
+            "errors": total_errors,
+            "error_rate": round(total_errors / total_requests, 4) if total_requests else 0.0,
+            "req_per_s": round(total_requests / elapsed, 2),
+            "mb_per_s": round(total_bytes / elapsed / 1e6, 3),
+        }
+        return result
+
+
+class SimulatedClient(threading.Thread):
+    def __init__(self, index: int, args, host: str, port: int, albums, recorder: Recorder, deadline: float):
+        super().__init__(daemon=True)
+        self.args = args
+        self.host = host
+        self.port = port
+        self.albums = albums
+        self.recorder = recorder
+        self.deadline = deadline
+        self.rng = random.Random(args.seed * 1000 + index)
+        self.conn = None
+        self.polls = 0
+
+    def request(self, route: str, path: str, headers=None):
+        """One request on the client's connection; returns (status, response, size) or None on error."""
+        started = time.perf_counter()
+        try:
+            if self.conn is None:
+                self.conn = http.client.HTTPConnection(self.host, self.port, timeout=self.args.timeout)
+            self.conn.request("GET", path, headers=headers or {})
+            resp = self.conn.getresponse()
+            size = 0
+            while True:
+                block = resp.read(256 * 1024)
+                if not block:
+                    break
+                size += len(block)
+            # Albums without art are normal; the component remembers them as missing
+            ok = resp.status < 400 or (route == "artwork" and resp.status == 404)
+            if resp.will_close or not self.args.keepalive:
+                self.reset()
+            self.recorder.add(route, (time.perf_counter() - started) * 1000, size, ok)
+            return (resp.status, resp, size) if ok else None
+        except (OSError, http.client.HTTPException):
+            self.reset()
+            self.recorder.add(route, 0, 0, False)
+            return None
+
+    def reset(self):
+        if self.conn is not None:
+            self.conn.close()
+            self.conn = None
+
+    def poll(self):
+        self.request("hash", f"/hash/{self.args.playlist}")
+        self.polls += 1
+        if self.args.playlist_every and self.polls % self.args.playlist_every == 0:
+            self.request("playlist", f"/playlist/{self.args.playlist}")
+
+    def sleep_until(self, when: float, next_poll: float) -> float:
+        """Sleeps until `when`, polling on schedule meanwhile; returns the next poll time."""
+        while True:
+            now = time.time()
+            if now >= self.deadline:
+                return next_poll
+            if now >= next_poll:
+                self.poll()
+                next_poll = now + self.args.poll_interval
+                continue
+            if now >= when:
+                return next_poll
+            time.sleep(min(when, next_poll, self.deadline) - now)
+
+    def play_track(self, path: str, next_poll: float) -> float:
+        args = self.args
+        chunk_seconds = args.chunk * 8 / (args.bitrate * 1000) if args.pace else 0
+        offset = 0
+        route = "stream_start"
+        listened = 0
+        while time.time() < self.deadline and listened < args.listen_bytes:
+            result = self.request(route, path, {"Range": f"bytes={offset}-{offset + args.chunk - 1}"})
+            if result is None or result[2] == 0:
+                return next_poll  # Error or end of file: next track
+            status, resp, size = result
+            listened += size
+            total = resp.getheader("Content-Range", "").rpartition("/")[2]
+            if total.isdigit() and offset + size >= int(total):
+                return next_poll
+
+            next_poll = self.sleep_until(time.time() + chunk_seconds, next_poll)
+            if self.rng.random() < args.seek_ratio and total.isdigit():
+                offset = self.rng.randrange(0, int(total))
+                route = "stream_seek"
+            else:
+                offset += size
+                route = "stream_next"
+        return next_poll
+
+    def run(self):
+        # Clients start spread over one poll interval rather than in lockstep
+        next_poll = time.time() + self.rng.uniform(0, self.args.poll_interval)
+        album = None
+        track = 0
+        while time.time() < self.deadline:
+            if album is None or track >= len(album) or self.rng.random() < self.args.skip_ratio:
+                album = self.rng.choice(self.albums)
+                track = 0
+                self.request("artwork", "/artwork/" + album[0][len("/stream/"):])
+            next_poll = self.play_track(album[track], next_poll)
+            track += 1
+        self.reset()
+
+
+def load_albums(host: str, port: int, playlist: str):
+    """Stream paths from the playlist, grouped by folder in playlist order."""
+    conn = http.client.HTTPConnection(host, port, timeout=60)
+    conn.request("GET", f"/playlist/{playlist}")
+    resp = conn.getresponse()
+    body = resp.read().decode("utf-8", "replace")
+    conn.close()
+    if resp.status != 200:
+        raise RuntimeError(f"GET /playlist/{playlist} returned {resp.status}")
+
+    albums = {}
+    for line in body.splitlines():
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        if "://" in line:
+            line = urllib.parse.urlsplit(line).path
+        albums.setdefault(line.rpartition("/")[0], []).append(line)
+    if not albums:
+        raise RuntimeError("playlist is empty")
+    return list(albums.values())
+
+
+def run_level(args, host: str, port: int, albums, clients: int) -> dict:
+    recorder = Recorder()
+    started = time.time()
+    deadline = started + args.duration
+    threads = [SimulatedClient(i, args, host, port, albums, recorder, deadline) for i in range(clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join(args.duration + args.timeout + 5)
+    return {"clients": clients, "routes": recorder.summary(time.time() - started)}
+
+
+def print_table(levels):
+    print(f"{'clients':>7} {'route':<13} {'req/s':>9} {'p50 ms':>9} {'p99 ms':>9} {'MB/s':>9} {'errors':>8}")
+    for level in levels:
+        for route, stats in level["routes"].items():
+            p50 = f"{stats['p50_ms']:.2f}" if "p50_ms" in stats else "-"
+            p99 = f"{stats['p99_ms']:.2f}" if "p99_ms" in stats else "-"
+            print(f"{level['clients']:>7} {route:<13} {stats['req_per_s']:>9.1f} {p50:>9} {p99:>9} "
+                  f"{stats['mb_per_s']:>9.2f} {stats['error_rate']:>8.2%}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Load test for the sync server")
+    parser.add_argument("--clients", default="1,8,32,128", help="Comma-separated concurrency levels")
+    parser.add_argument("--duration", type=float, default=20, help="Seconds per concurrency level")
+    parser.add_argument("--url", help="Test a running server (its playlist must be named by --playlist)")
+    parser.add_argument("--playlist", default=PLAYLIST_NAME, help="Playlist to poll with --url")
+    parser.add_argument("--files", type=int, default=2000, help="Tracks in the generated library")
+    parser.add_argument("--track-size", type=int, default=8 * 1024 * 1024, help="Generated track size in bytes")
+    parser.add_argument("--artwork-ratio", type=float, default=0.8)
+    parser.add_argument("--poll-interval", type=float, default=5, help="Seconds between hash polls")
+    parser.add_argument("--playlist-every", type=int, default=12, help="Download the playlist every N polls")
+    parser.add_argument("--chunk", type=int, default=256 * 1024, help="Bytes per Range request")
+    parser.add_argument("--bitrate", type=int, default=1000, help="Playback pacing in kbit/s")
+    parser.add_argument("--no-pace", dest="pace", action="store_false", help="Stream as fast as possible")
+    parser.add_argument("--listen-bytes", type=int, default=2 * 1024 * 1024, help="Bytes played per track")
+    parser.add_argument("--seek-ratio", type=float, default=0.1, help="Chance of a seek after each chunk")
+    parser.add_argument("--skip-ratio", type=float, default=0.2, help="Chance of jumping to another album per track")
+    parser.add_argument("--no-keepalive", dest="keepalive", action="store_false",
+                        help="New connection per request, to measure what keep-alive saves")
+    parser.add_argument("--timeout", type=float, default=30)
+    parser.add_argument("--wan", help="Emulate a WAN link between clients and server (see wan_proxy.py --list)")
+    parser.add_argument("--wan-file", help="WAN scenario from a JSON file (see wan_proxy.py)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--out", help="Write the JSON report here")
+    args = parser.parse_args()
+
+    levels = [int(c) for c in args.clients.split(",") if c.strip()]
+
+    server = None
+    proxy = None
+    work = None
+    try:
+        if args.url:
+            parts = urllib.parse.urlsplit(args.url)
+            host, port = parts.hostname, parts.port or 80
+        else:
+            work = Path(tempfile.mkdtemp(prefix="nsync_load_"))
+            gen_library.generate(str(work / "library"), args.files, artwork_ratio=args.artwork_ratio,
+                                 track_size=args.track_size, seed=args.seed)
+            server = BenchServer(work / "library", work)
+            args.playlist = PLAYLIST_NAME
+            host, port = "127.0.0.1", server.port
+
+        if args.wan or args.wan_file:
+            proxy = WanProxy(host, port, load_phases(args.wan, args.wan_file)).start()
+            host, port = "127.0.0.1", proxy.port
+
+        albums = load_albums(host, port, args.playlist)
+        results = {"albums": len(albums), "duration_s": args.duration, "paced": args.pace,
+                   "keepalive": args.keepalive,
+                   "wan": args.wan_file or args.wan, "levels": []}
+        for clients in levels:
+            results["levels"].append(run_level(args, host, port, albums, clients))
+    finally:
+        if proxy:
+            proxy.stop()
+        if server:
+            server.stop()
+        if work:
+            shutil.rmtree(work, ignore_errors=True)
+
+    print_table(results["levels"])
+    if args.out:
+        Path(args.out).write_text(json.dumps(results, indent=2), encoding="utf-8")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,170 @@
+// Headless driver for the client's sync core: runs one playlist download
+// through m3u8_stream_parser and sync_plan exactly as sync_manager does
+// (snapshot, streamed parse + diff, single apply pass) and prints timings,
+// peak memory and CPU time as JSON.
+//
+//   sync_bench --playlist <m3u8> --base-url <url> [--state <file>]
+//              [--write-state <file>] [--chunk <bytes>]
+//
+// --state holds the local playlist (one location per line) before the sync,
+// --write-state receives it afterwards, so scenarios can be chained.
+
+#include "m3u8_parser.h"
+#include "sync_plan.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    double elapsed_ms(clock_type::time_point since) {
+        return std::chrono::duration<double, std::milli>(clock_type::now() - since).count();
+    }
+
+    // Peak resident memory in KB and user+system CPU time in ms
+    void process_usage(long& peak_kb, double& cpu_ms) {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters = {};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        peak_kb = (long)(counters.PeakWorkingSetSize / 1024);
+        FILETIME created, exited, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+        auto to_ms = [](const FILETIME& t) {
+            return (double)(((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime) / 10000.0;
+        };
+        cpu_ms = to_ms(kernel) + to_ms(user);
+#else
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        peak_kb = usage.ru_maxrss;
+        cpu_ms = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 +
+                 usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+#endif
+    }
+
+    bool read_file(const char* path, std::string& out) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::ostringstream buffer;
+        buffer << in.rdbuf();
+        out = buffer.str();
+        return true;
+    }
+
+    void usage() {
+        std::cerr << "usage: sync_bench --playlist <m3u8> --base-url <url> [--state <file>] "
+                     "[--write-state <file>] [--chunk <bytes>]\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* playlist_path = nullptr;
+    const char* base_url = nullptr;
+    const char* state_path = nullptr;
+    const char* write_state_path = nullptr;
+    size_t chunk_size = 64 * 1024;  // One WinHttpReadData buffer
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--playlist") == 0) playlist_path = argv[i + 1];
+        else if (strcmp(argv[i], "--base-url") == 0) base_url = argv[i + 1];
+        else if (strcmp(argv[i], "--state") == 0) state_path = argv[i + 1];
+        else if (strcmp(argv[i], "--write-state") == 0) write_state_path = argv[i + 1];
+        else if (strcmp(argv[i], "--chunk") == 0) chunk_size = (size_t)std::stoul(argv[i + 1]);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (!playlist_path || !base_url || chunk_size == 0) {
+        usage();
+        return 2;
+    }
+
+    std::string body;
+    if (!read_file(playlist_path, body)) {
+        std::cerr << "cannot read " << playlist_path << "\n";
+        return 1;
+    }
+
+    // The local playlist, as playlist_manager would return it
+    std::vector<std::string> local;
+    if (state_path) {
+        std::ifstream in(state_path, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty()) local.push_back(line);
+        }
+    }
+
+    // Snapshot (main thread, before the download)
+    auto started = clock_type::now();
+    sync_plan plan(base_url);
+    for (const auto& location : local) {
+        plan.add_existing(location.c_str());
+    }
+    double snapshot_ms = elapsed_ms(started);
+
+    // Streamed parse + diff (request thread, one call per received chunk)
+    started = clock_type::now();
+    m3u8_stream_parser parser([&plan](const char* path, size_t length) { plan.add_entry(path, length); });
+    for (size_t offset = 0; offset < body.size(); offset += chunk_size) {
+        parser.feed(body.data() + offset, std::min(chunk_size, body.size() - offset));
+    }
+    parser.finish();
+    double parse_diff_ms = elapsed_ms(started);
+
+    // Apply pass (main thread): removals, then additions not already present
+    started = clock_type::now();
+    location_set current;
+    std::vector<std::string> kept;
+    size_t removed = 0;
+    for (auto& location : local) {
+        if (plan.keeps(location)) {
+            current.insert(location);
+            kept.push_back(std::move(location));
+        } else {
+            removed++;
+        }
+    }
+    size_t added = 0;
+    for (const auto& location : plan.added()) {
+        if (current.find(location) == current.end()) {
+            kept.push_back(location);
+            added++;
+        }
+    }
+    double apply_ms = elapsed_ms(started);
+
+    if (write_state_path) {
+        std::ofstream out(write_state_path, std::ios::binary);
+        for (const auto& location : kept) {
+            out << location << "\n";
+        }
+    }
+
+    long peak_kb = 0;
+    double cpu_ms = 0;
+    process_usage(peak_kb, cpu_ms);
+
+    std::printf("{\"bytes\": %zu, \"entries\": %zu, \"local_before\": %zu, \"added\": %zu, \"removed\": %zu, "
+                "\"snapshot_ms\": %.3f, \"parse_diff_ms\": %.3f, \"apply_ms\": %.3f, "
+                "\"plan_bytes\": %zu, \"peak_rss_kb\": %ld, \"cpu_ms\": %.3f}\n",
+                body.size(), plan.entry_count(), local.size(), added, removed,
+                snapshot_ms, parse_diff_ms, apply_ms, plan.memory_bytes(), peak_kb, cpu_ms);
+    return 0;
+}
@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""
+WAN emulation proxy.
+
+A TCP proxy that puts a simulated wide-area link between a client and the
+server: round-trip latency with jitter, a bandwidth cap shared by all
+connections (like a real access link), random stalls that look like loss and
+retransmission to the application, connection resets, and blackouts. Conditions
+come from a scenario, which may change them over time.
+
+    python bench/wan_proxy.py --target 127.0.0.1:8090 --listen 8091 --scenario mobile
+
+Point foobar2000 (or bench/server_load.py --url, or run_sync_bench.py --wan)
+at the listen port. --list shows the built-in scenarios; --scenario-file loads
+one from JSON: [{"at": 0, "rtt_ms": 80, ...}, {"at": 30, "blackout": true}, ...]
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import socket
+import struct
+import threading
+import time
+
+# Link conditions; a phase only lists what it changes from the defaults
+DEFAULTS = {
+    "rtt_ms": 0,          # Round trip added to every exchange (half each way) and to connection setup
+    "jitter_ms": 0,       # Random extra one-way delay, 0..jitter_ms, order preserved
+    "down_kbps": 0,       # Server to client cap in kbit/s, shared by all connections, 0 = unlimited
+    "up_kbps": 0,         # Client to server cap
+    "stall_prob": 0.0,    # Chance per 16 KB segment of a stall (a lost packet's retransmission wait)
+    "stall_ms": 0,
+    "reset_prob": 0.0,    # Chance per connection of being reset partway through
+    "blackout": False,    # Nothing gets through until the phase ends; connects hang
+}
+
+SCENARIOS = {
+    "lan": [{"at": 0, "rtt_ms": 1}],
+    "broadband": [{"at": 0, "rtt_ms": 30, "jitter_ms": 5, "down_kbps": 50000, "up_kbps": 10000}],
+    "transatlantic": [{"at": 0, "rtt_ms": 150, "jitter_ms": 10, "down_kbps": 20000, "up_kbps": 5000}],
+    "mobile": [{"at": 0, "rtt_ms": 120, "jitter_ms": 40, "down_kbps": 4000, "up_kbps": 1000,
+                "stall_prob": 0.01, "stall_ms": 800}],
+    "satellite": [{"at": 0, "rtt_ms": 650, "jitter_ms": 50, "down_kbps": 10000, "up_kbps": 1000}],
+    "lossy": [{"at": 0, "rtt_ms": 80, "jitter_ms": 30, "down_kbps": 8000, "up_kbps": 2000,
+               "stall_prob": 0.03, "stall_ms": 2000, "reset_prob": 0.05}],
+    # Scripted: good link, a handover blackout, then a degraded cell
+    "handover": [
+        {"at": 0, "rtt_ms": 60, "jitter_ms": 10, "down_kbps": 20000, "up_kbps": 5000},
+        {"at": 20, "blackout": True},
+        {"at": 25, "rtt_ms": 200, "jitter_ms": 80, "down_kbps": 1500, "up_kbps": 500,
+         "stall_prob": 0.02, "stall_ms": 1500},
+    ],
+    # Scripted: bandwidth collapses for a while (someone else saturates the link)
+    "congestion": [
+        {"at": 0, "rtt_ms": 40, "down_kbps": 30000, "up_kbps": 5000},
+        {"at": 15, "rtt_ms": 300, "jitter_ms": 100, "down_kbps": 800, "up_kbps": 200},
+        {"at": 45, "rtt_ms": 40, "down_kbps": 30000, "up_kbps": 5000},
+    ],
+}
+
+SEGMENT = 16 * 1024
+
+
+class Scenario:
+    """Conditions as a function of time since the proxy started."""
+
+    def __init__(self, phases):
+        self.started = time.monotonic()
+        self.phases = []
+        for phase in sorted(phases, key=lambda p: p.get("at", 0)):
+            conditions = dict(DEFAULTS)
+            conditions.update({k: v for k, v in phase.items() if k != "at"})
+            self.phases.append((phase.get("at", 0), conditions))
+
+    def now(self) -> dict:
+        elapsed = time.monotonic() - self.started
+        current = self.phases[0][1]
+        for at, conditions in self.phases:
+            if elapsed >= at:
+                current = conditions
+        return current
+
+    async def wait_for_link(self):
+        while self.now()["blackout"]:
+            await asyncio.sleep(0.05)
+
+
+class LinkDirection:
+    """Serializes one direction of the shared link at the current cap."""
+
+    def __init__(self, key: str):
+        self.key = key
+        self.free_at = 0.0
+
+    async def transmit(self, size: int, conditions: dict):
+        kbps = conditions[self.key]
+        if kbps <= 0:
+            return
+        now = time.monotonic()
+        self.free_at = max(self.free_at, now) + size * 8 / (kbps * 1000.0)
+        await asyncio.sleep(self.free_at - now)
+
+
+class WanProxy:
+    def __init__(self, target_host: str, target_port: int, phases, listen_host: str = "127.0.0.1",
+                 listen_port: int = 0, seed: int = 1):
+        self.target = (target_host, target_port)
+        self.listen = (listen_host, listen_port)
+        self.scenario = Scenario(phases)
+        self.rng = random.Random(seed)
+        self.down = LinkDirection("down_kbps")
+        self.up = LinkDirection("up_kbps")
+        self.port = None
+        self.stats = {"connections": 0, "resets": 0, "stalls": 0, "bytes_down": 0, "bytes_up": 0}
+        self._loop = None
+        self._thread = None
+        self._server = None
+
+    async def _handle(self, client_reader, client_writer):
+        self.stats["connections"] += 1
+        conditions = self.scenario.now()
+
+        # Connection setup costs a round trip (SYN/SYN-ACK) on top of the proxy's own
+        await self.scenario.wait_for_link()
+        await asyncio.sleep(conditions["rtt_ms"] / 1000.0)
+        try:
+            server_reader, server_writer = await asyncio.open_connection(*self.target)
+        except OSError:
+            client_writer.close()
+            return
+
+        # A reset connection dies after a random amount of server-to-client data
+        reset_after = None
+        if self.rng.random() < conditions["reset_prob"]:
+            reset_after = self.rng.randint(0, 256 * 1024)
+
+        writers = (client_writer, server_writer)
+        await asyncio.gather(
+            self._pipe(client_reader, server_writer, self.up, "bytes_up", None, writers),
+            self._pipe(server_reader, client_writer, self.down, "bytes_down", reset_after, writers),
+        )
+
+    async def _pipe(self, reader, writer, direction: LinkDirection, counter: str, reset_after, writers):
+        # Segments are read as they arrive and delivered in order after the one-way delay
+        queue = asyncio.Queue()
+
+        async def deliver():
+            sent = 0
+            while True:
+                due, data = await queue.get()
+                if data is None:
+                    break
+                delay = due - time.monotonic()
+                if delay > 0:
+                    await asyncio.sleep(delay)
+                await self.scenario.wait_for_link()
+                await direction.transmit(len(data), self.scenario.now())
+                if reset_after is not None and sent + len(data) > reset_after:
+                    self.stats["resets"] += 1
+                    self._reset(writers)
+                    return
+                try:
+                    writer.write(data)
+                    await writer.drain()
+                except (ConnectionError, OSError):
+                    break
+                sent += len(data)
+                self.stats[counter] += len(data)
+            try:
+                writer.close()
+            except OSError:
+                pass
+
+        delivery = asyncio.ensure_future(deliver())
+        last_due = 0.0
+        try:
+            while not delivery.done():
+                data = await reader.read(SEGMENT)
+                if not data:
+                    break
+                conditions = self.scenario.now()
+                due = time.monotonic() + conditions["rtt_ms"] / 2000.0
+                if conditions["jitter_ms"]:
+                    due += self.rng.uniform(0, conditions["jitter_ms"]) / 1000.0
+                if self.rng.random() < conditions["stall_prob"]:
+                    self.stats["stalls"] += 1
+                    due += conditions["stall_ms"] / 1000.0
+                last_due = max(last_due, due)  # TCP delivers in order
+                queue.put_nowait((last_due, data))
+        except (ConnectionError, OSError):
+            pass
+        queue.put_nowait((0, None))
+        await delivery
+
+    @staticmethod
+    def _reset(writers):
+        # SO_LINGER 0 makes close() send RST instead of FIN
+        for w in writers:
+            sock = w.get_extra_info("socket")
+            if sock is not None:
+                try:
+                    sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack("ii", 1, 0))
+                except OSError:
+                    pass
+            w.transport.abort()
+
+    async def _serve(self, ready: threading.Event):
+        self._server = await asyncio.start_server(self._handle, *self.listen)
+        self.port = self._server.sockets[0].getsockname()[1]
+        ready.set()
+        async with self._server:
+            await self._server.serve_forever()
+
+    def start(self):
+        """Runs the proxy on a background thread; `port` is set on return."""
+        ready = threading.Event()
+        self._loop = asyncio.new_event_loop()
+
+        def run():
+            asyncio.set_event_loop(self._loop)
+            try:
+                self._loop.run_until_complete(self._serve(ready))
+            except asyncio.CancelledError:
+                pass
+
+        self._thread = threading.Thread(target=run, daemon=True)
+        self._thread.start()
+        ready.wait()
+        return self
+
+    def stop(self):
+        if self._loop and self._server:
+            self._loop.call_soon_threadsafe(self._shutdown)
+            self._thread.join(5)
+
+    def _shutdown(self):
+        self._server.close()
+        for task in asyncio.all_tasks(self._loop):
+            task.cancel()
+
+
+def load_phases(name: str = None, path: str = None):
+    if path:
+        with open(path, encoding="utf-8") as f:
+            return json.load(f)
+    if name not in SCENARIOS:
+        raise SystemExit(f"Unknown scenario '{name}' (try --list)")
+    return SCENARIOS[name]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="TCP proxy that emulates a WAN link")
+    parser.add_argument("--target", default="127.0.0.1:8090", help="Server host:port")
+    parser.add_argument("--listen", type=int, default=8091, help="Port to listen on")
+    parser.add_argument("--bind", default="127.0.0.1", help="Address to listen on (0.0.0.0 for other machines)")
+    parser.add_argument("--scenario", default="mobile", help="Built-in scenario name")
+    parser.add_argument("--scenario-file", help="JSON list of phases instead of a built-in scenario")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--list", action="store_true", help="Show the built-in scenarios and exit")
+    args = parser.parse_args()
+
+    if args.list:
+        for name, phases in SCENARIOS.items():
+            print(f"{name}: {json.dumps(phases)}")
+        return
+
+    host, _, port = args.target.rpartition(":")
+    proxy = WanProxy(host, int(port), load_phases(args.scenario, args.scenario_file), args.bind, args.listen,
+                     args.seed).start()
+    print(f"Proxying {args.bind}:{proxy.port} -> {args.target} ({args.scenario_file or args.scenario})")
+    try:
+        while True:
+            time.sleep(10)
+            print(json.dumps(proxy.stats), flush=True)
+    except KeyboardInterrupt:
+        proxy.stop()
+
+
+if __name__ == "__main__":
+    main()
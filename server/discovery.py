@@ -0,0 +1,350 @@
+#!/usr/bin/env python3
+"""
+Local network discovery for NSync Server (mDNS / DNS-SD)
+Advertises the server as `<name>._nsync._tcp.local` with its port and a
+stable server ID, so clients can find its LAN address without typing it.
+
+Usage:
+  python discovery.py --browse                        # List servers on the LAN
+  python discovery.py --browse --host 127.0.0.1 --port 15353
+                                                      # Query one responder directly
+                                                      # (e.g. one started with MDNS_PORT=15353)
+"""
+
+import argparse
+import logging
+import os
+import select
+import socket
+import struct
+import threading
+import time
+import uuid
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+logger = logging.getLogger(__name__)
+
+MDNS_GROUP = "224.0.0.251"
+MDNS_PORT = int(os.environ.get("MDNS_PORT", 5353))
+SERVICE_TYPE = "_nsync._tcp.local"
+SERVICES_META = "_services._dns-sd._udp.local"
+RECORD_TTL = 120
+
+TYPE_A, TYPE_PTR, TYPE_TXT, TYPE_SRV, TYPE_ANY = 1, 12, 16, 33, 255
+CLASS_IN = 1
+CLASS_FLUSH = 0x8000   # Cache-flush bit on unique records
+CLASS_QU = 0x8000      # "Unicast response requested" bit on questions
+
+
+def load_server_id(config_dir: str, port: int) -> str:
+    """Stable server ID: SERVER_ID env, else persisted in CONFIG_DIR/server_id."""
+    if os.environ.get("SERVER_ID"):
+        return os.environ["SERVER_ID"]
+    id_file = Path(config_dir) / "server_id"
+    try:
+        server_id = id_file.read_text().strip()
+        if server_id:
+            return server_id
+    except OSError:
+        pass
+    server_id = uuid.uuid4().hex
+    try:
+        id_file.write_text(server_id + "\n")
+    except OSError:
+        # Read-only config: derive an ID that at least survives restarts
+        server_id = uuid.uuid5(uuid.NAMESPACE_DNS, f"{socket.gethostname()}:{port}").hex
+    return server_id
+
+
+def detect_lan_address(bind_address: str) -> str:
+    """Address other hosts can reach us at (no packets are sent)."""
+    if os.environ.get("ADVERTISE_ADDRESS"):
+        return os.environ["ADVERTISE_ADDRESS"]
+    if bind_address and bind_address != "0.0.0.0":
+        return bind_address
+    probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        probe.connect(("10.255.255.255", 1))
+        return probe.getsockname()[0]
+    except OSError:
+        return "127.0.0.1"
+    finally:
+        probe.close()
+
+
+# -- DNS wire format ---------------------------------------------------------
+
+def encode_name(name: str) -> bytes:
+    out = b""
+    for label in name.rstrip('.').split('.'):
+        raw = label.encode('utf-8')[:63]
+        out += bytes([len(raw)]) + raw
+    return out + b"\x00"
+
+
+def decode_name(data: bytes, offset: int) -> Tuple[str, int]:
+    """Returns (name, offset after the name), following compression pointers."""
+    labels = []
+    end = None
+    jumps = 0
+    while True:
+        if offset >= len(data):
+            raise ValueError("truncated name")
+        length = data[offset]
+        if length & 0xC0 == 0xC0:
+            if jumps > 20:
+                raise ValueError("compression loop")
+            pointer = ((length & 0x3F) << 8) | data[offset + 1]
+            if end is None:
+                end = offset + 2
+            offset = pointer
+            jumps += 1
+            continue
+        offset += 1
+        if length == 0:
+            break
+        labels.append(data[offset:offset + length].decode('utf-8', 'replace'))
+        offset += length
+    return '.'.join(labels), (end if end is not None else offset)
+
+
+def encode_record(name: str, rtype: int, rclass: int, ttl: int, rdata: bytes) -> bytes:
+    return encode_name(name) + struct.pack("!HHIH", rtype, rclass, ttl, len(rdata)) + rdata
+
+
+def parse_message(data: bytes) -> Dict:
+    """Parse a DNS message into questions and resource records."""
+    msg_id, flags, qd, an, ns, ar = struct.unpack("!HHHHHH", data[:12])
+    offset = 12
+    questions = []
+    for _ in range(qd):
+        name, offset = decode_name(data, offset)
+        qtype, qclass = struct.unpack("!HH", data[offset:offset + 4])
+        offset += 4
+        questions.append((name, qtype, qclass))
+
+    records = []
+    for _ in range(an + ns + ar):
+        name, offset = decode_name(data, offset)
+        rtype, rclass, ttl, rdlen = struct.unpack("!HHIH", data[offset:offset + 10])
+        offset += 10
+        rdata_offset = offset
+        offset += rdlen
+        record = {"name": name, "type": rtype, "ttl": ttl}
+        if rtype == TYPE_PTR:
+            record["target"] = decode_name(data, rdata_offset)[0]
+        elif rtype == TYPE_SRV:
+            _, _, port = struct.unpack("!HHH", data[rdata_offset:rdata_offset + 6])
+            record["port"] = port
+            record["target"] = decode_name(data, rdata_offset + 6)[0]
+        elif rtype == TYPE_A and rdlen == 4:
+            record["address"] = socket.inet_ntoa(data[rdata_offset:rdata_offset + 4])
+        elif rtype == TYPE_TXT:
+            txt, pos = {}, rdata_offset
+            while pos < offset:
+                length = data[pos]
+                entry = data[pos + 1:pos + 1 + length].decode('utf-8', 'replace')
+                key, _, value = entry.partition('=')
+                txt[key] = value
+                pos += 1 + length
+            record["txt"] = txt
+        records.append(record)
+
+    return {"id": msg_id, "flags": flags, "questions": questions, "records": records}
+
+
+def build_query(service: str = SERVICE_TYPE, unicast: bool = True) -> bytes:
+    header = struct.pack("!HHHHHH", 0, 0, 1, 0, 0, 0)
+    qclass = CLASS_IN | (CLASS_QU if unicast else 0)
+    return header + encode_name(service) + struct.pack("!HH", TYPE_PTR, qclass)
+
+
+# -- Responder ---------------------------------------------------------------
+
+class ServiceAdvertiser:
+    """Answers DNS-SD queries for this server and announces it at startup."""
+
+    def __init__(self, instance: str, port: int, address: str, server_id: str, version: str):
+        self.instance_name = f"{instance}.{SERVICE_TYPE}"
+        self.host_name = f"{socket.gethostname().split('.')[0]}.local"
+        self.port = port
+        self.address = address
+        self.txt = {"id": server_id, "ver": version, "path": "/"}
+        self._sock = None
+
+    def _records(self) -> Dict[str, bytes]:
+        txt_rdata = b"".join(bytes([len(e)]) + e for e in
+                             (f"{k}={v}".encode('utf-8') for k, v in self.txt.items()))
+        return {
+            "ptr": encode_record(SERVICE_TYPE, TYPE_PTR, CLASS_IN, RECORD_TTL, encode_name(self.instance_name)),
+            "srv": encode_record(self.instance_name, TYPE_SRV, CLASS_IN | CLASS_FLUSH, RECORD_TTL,
+                                 struct.pack("!HHH", 0, 0, self.port) + encode_name(self.host_name)),
+            "txt": encode_record(self.instance_name, TYPE_TXT, CLASS_IN | CLASS_FLUSH, RECORD_TTL, txt_rdata),
+            "a": encode_record(self.host_name, TYPE_A, CLASS_IN | CLASS_FLUSH, RECORD_TTL,
+                               socket.inet_aton(self.address)),
+            "meta": encode_record(SERVICES_META, TYPE_PTR, CLASS_IN, RECORD_TTL, encode_name(SERVICE_TYPE)),
+        }
+
+    def build_response(self, msg_id: int = 0, questions: List = None) -> Optional[bytes]:
+        """Response for the given questions (all records when None). None if nothing matches."""
+        records = self._records()
+        answers = []
+        if questions is None:
+            answers = [records["ptr"], records["srv"], records["txt"], records["a"]]
+        else:
+            for name, qtype, _ in questions:
+                lname = name.lower()
+                if lname == SERVICE_TYPE and qtype in (TYPE_PTR, TYPE_ANY):
+                    answers += [records["ptr"], records["srv"], records["txt"], records["a"]]
+                elif lname == SERVICES_META and qtype in (TYPE_PTR, TYPE_ANY):
+                    answers.append(records["meta"])
+                elif lname == self.instance_name.lower() and qtype in (TYPE_SRV, TYPE_TXT, TYPE_ANY):
+                    answers += [records["srv"], records["txt"], records["a"]]
+                elif lname == self.host_name.lower() and qtype in (TYPE_A, TYPE_ANY):
+                    answers.append(records["a"])
+        if not answers:
+            return None
+
+        # De-duplicate while keeping order
+        unique = list(dict.fromkeys(answers))
+        question_section = b""
+        qd = 0
+        if msg_id and questions:
+            # Legacy unicast replies echo the question (RFC 6762 section 6.7)
+            for name, qtype, qclass in questions:
+                question_section += encode_name(name) + struct.pack("!HH", qtype, qclass & 0x7FFF)
+                qd += 1
+        header = struct.pack("!HHHHHH", msg_id, 0x8400, qd, len(unique), 0, 0)
+        return header + question_section + b"".join(unique)
+
+    def _open_socket(self) -> socket.socket:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        if hasattr(socket, "SO_REUSEPORT"):
+            try:
+                sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+            except OSError:
+                pass
+        sock.bind(("", MDNS_PORT))
+        membership = socket.inet_aton(MDNS_GROUP) + socket.inet_aton("0.0.0.0")
+        try:
+            sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+        except OSError as e:
+            logger.warning(f"mDNS: could not join multicast group ({e}); only direct queries will be answered")
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+        return sock
+
+    def announce(self):
+        response = self.build_response()
+        for _ in range(2):
+            try:
+                self._sock.sendto(response, (MDNS_GROUP, MDNS_PORT))
+            except OSError:
+                pass
+            time.sleep(1)
+
+    def serve_forever(self):
+        self._sock = self._open_socket()
+        logger.info(f"mDNS: advertising {self.instance_name} at {self.address}:{self.port} (id {self.txt['id']})")
+        threading.Thread(target=self.announce, daemon=True).start()
+
+        while True:
+            try:
+                data, sender = self._sock.recvfrom(9000)
+                message = parse_message(data)
+            except (OSError, ValueError, struct.error, IndexError):
+                continue
+            if message["flags"] & 0x8000 or not message["questions"]:
+                continue  # Responses from other hosts
+
+            legacy = sender[1] != MDNS_PORT
+            unicast = legacy or any(q[2] & CLASS_QU for q in message["questions"])
+            response = self.build_response(message["id"] if legacy else 0, message["questions"])
+            if response is None:
+                continue
+            try:
+                self._sock.sendto(response, sender if unicast else (MDNS_GROUP, MDNS_PORT))
+            except OSError:
+                pass
+
+
+def start_advertiser(config_dir: str, port: int, bind_address: str, version: str) -> Optional[ServiceAdvertiser]:
+    """Advertise this server in a background thread. Returns None if disabled."""
+    if os.environ.get("DISCOVERY", "1") == "0":
+        return None
+    instance = os.environ.get("SERVER_NAME") or socket.gethostname().split('.')[0]
+    advertiser = ServiceAdvertiser(instance, port, detect_lan_address(bind_address),
+                                   load_server_id(config_dir, port), version)
+
+    def run():
+        try:
+            advertiser.serve_forever()
+        except OSError as e:
+            logger.warning(f"mDNS: advertising disabled ({e})")
+
+    threading.Thread(target=run, name="mdns-responder", daemon=True).start()
+    return advertiser
+
+
+# -- Browser -----------------------------------------------------------------
+
+def browse(timeout: float = 1.5, host: str = MDNS_GROUP, port: int = 5353) -> List[Dict]:
+    """Send a PTR query and collect {id, name, url} for every server that answers."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+    sock.bind(("", 0))
+    sock.sendto(build_query(), (host, port))
+
+    records = []
+    deadline = time.time() + timeout
+    while True:
+        remaining = deadline - time.time()
+        if remaining <= 0:
+            break
+        ready, _, _ = select.select([sock], [], [], remaining)
+        if not ready:
+            break
+        data, sender = sock.recvfrom(9000)
+        try:
+            for record in parse_message(data)["records"]:
+                record["sender"] = sender[0]
+                records.append(record)
+        except (ValueError, struct.error, IndexError):
+            continue
+    sock.close()
+
+    servers = {}
+    for ptr in (r for r in records if r["type"] == TYPE_PTR and r["name"].lower() == SERVICE_TYPE):
+        instance = ptr["target"]
+        srv = next((r for r in records if r["type"] == TYPE_SRV and r["name"] == instance), None)
+        if srv is None:
+            continue
+        txt = next((r["txt"] for r in records if r["type"] == TYPE_TXT and r["name"] == instance), {})
+        a = next((r for r in records if r["type"] == TYPE_A and r["name"] == srv["target"]), None)
+        address = a["address"] if a else ptr["sender"]
+        servers[instance] = {
+            "id": txt.get("id", ""),
+            "name": instance[:-len(SERVICE_TYPE) - 1],
+            "url": f"http://{address}:{srv['port']}",
+        }
+    return list(servers.values())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="NSync server discovery (mDNS/DNS-SD)")
+    parser.add_argument("--browse", action="store_true", help="List NSync servers that answer")
+    parser.add_argument("--host", default=MDNS_GROUP, help="Responder to query (default: mDNS multicast group)")
+    parser.add_argument("--port", type=int, default=5353, help="Responder port (default: 5353)")
+    parser.add_argument("--timeout", type=float, default=1.5, help="Seconds to wait for answers")
+    args = parser.parse_args()
+
+    if not args.browse:
+        parser.print_help()
+        return
+    for server in browse(args.timeout, args.host, args.port):
+        print(f"{server['name']}\t{server['url']}\tid={server['id']}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,523 @@
+"""
+Edge Proxy for NSync Server
+Runs in front of a remote origin server (ORIGIN_URL) and serves playlists,
+hashes, artwork and audio ranges from a local disk cache, so several clients
+behind one slow uplink fetch each byte from the origin only once.
+
+- Small objects (/hash, /playlist, /artwork) are revalidated with
+  If-None-Match once their freshness window has passed.
+- Audio (/stream) is cached in fixed-size chunks; range requests are served
+  from cached chunks and only missing chunks are fetched from the origin.
+- Concurrent misses for the same object or chunk share one origin request.
+"""
+
+import hashlib
+import http.client
+import json
+import logging
+import os
+import threading
+import time
+import urllib.parse
+from pathlib import Path
+from typing import Dict, List, Optional, Tuple
+
+logger = logging.getLogger(__name__)
+
+EDGE_CACHE_MAX_BYTES = int(os.environ.get("EDGE_CACHE_MAX_MB", 10240)) * 1024 * 1024
+EDGE_REVALIDATE_SECONDS = int(os.environ.get("EDGE_REVALIDATE_SECONDS", 15))
+EDGE_ARTWORK_TTL = 24 * 60 * 60
+EDGE_STREAM_TTL = 5 * 60
+STREAM_CHUNK_SIZE = 1024 * 1024
+ORIGIN_TIMEOUT = 30
+
+# Origin response headers kept in the cache and passed on to clients
+FORWARDED_HEADERS = ('Content-Type', 'ETag', 'Cache-Control', 'Content-Disposition', 'Last-Modified')
+
+# Responses that are forwarded without caching
+PASSTHROUGH_PREFIXES = ('/list', '/search', '/changes', '/status')
+
+
+class SingleFlight:
+    """Collapses concurrent calls with the same key into one execution."""
+
+    def __init__(self):
+        self._lock = threading.Lock()
+        self._calls = {}
+
+    def do(self, key, fn):
+        with self._lock:
+            call = self._calls.get(key)
+            leader = call is None
+            if leader:
+                call = self._calls[key] = {"event": threading.Event(), "result": None, "error": None}
+
+        if not leader:
+            call["event"].wait()
+            if call["error"] is not None:
+                raise call["error"]
+            return call["result"]
+
+        try:
+            call["result"] = fn()
+            return call["result"]
+        except Exception as e:
+            call["error"] = e
+            raise
+        finally:
+            with self._lock:
+                del self._calls[key]
+            call["event"].set()
+
+
+class OriginClient:
+    """Keep-alive HTTP client for the origin, one connection per worker thread."""
+
+    def __init__(self, origin_url: str):
+        parsed = urllib.parse.urlparse(origin_url)
+        self.scheme = parsed.scheme or "http"
+        self.host = parsed.hostname
+        self.port = parsed.port or (443 if self.scheme == "https" else 80)
+        self._local = threading.local()
+
+    def _connection(self):
+        conn = getattr(self._local, "conn", None)
+        if conn is None:
+            cls = http.client.HTTPSConnection if self.scheme == "https" else http.client.HTTPConnection
+            conn = self._local.conn = cls(self.host, self.port, timeout=ORIGIN_TIMEOUT)
+        return conn
+
+    def request(self, method: str, path: str, headers: Dict = None) -> Tuple[int, Dict, bytes]:
+        """Returns (status, lower-cased headers, body). Retries once on a stale keep-alive connection."""
+        for attempt in range(2):
+            conn = self._connection()
+            try:
+                conn.request(method, path, headers=headers or {})
+                resp = conn.getresponse()
+                body = resp.read()
+                return resp.status, {k.lower(): v for k, v in resp.getheaders()}, body
+            except (http.client.HTTPException, ConnectionError, OSError):
+                conn.close()
+                self._local.conn = None
+                if attempt == 1:
+                    raise
+
+
+class EdgeCache:
+    """Disk cache with byte-bounded LRU eviction across objects and stream chunk files."""
+
+    def __init__(self, root: str, max_bytes: int):
+        self.root = Path(root)
+        self.root.mkdir(parents=True, exist_ok=True)
+        self.max_bytes = max_bytes
+        self._lock = threading.Lock()
+        self._entry_locks = {}  # key -> RLock (eviction may run while an entry is locked)
+        self._usage = {}  # entry key -> (bytes, last access)
+        self._pinned = {}  # entry key -> streams reading it; not evicted meanwhile
+        for meta_file in self.root.glob("*/meta.json"):
+            key = meta_file.parent.name
+            size = sum(f.stat().st_size for f in meta_file.parent.iterdir() if f.is_file())
+            self._usage[key] = (size, meta_file.stat().st_mtime)
+
+    @staticmethod
+    def key_for(path: str) -> str:
+        return hashlib.sha1(path.encode('utf-8')).hexdigest()
+
+    def entry_dir(self, key: str) -> Path:
+        return self.root / key
+
+    def entry_lock(self, key: str) -> threading.RLock:
+        with self._lock:
+            lock = self._entry_locks.get(key)
+            if lock is None:
+                lock = self._entry_locks[key] = threading.RLock()
+            return lock
+
+    def read_meta(self, key: str) -> Optional[Dict]:
+        try:
+            with open(self.entry_dir(key) / "meta.json", 'r') as f:
+                return json.load(f)
+        except (OSError, ValueError):
+            return None
+
+    def write_meta(self, key: str, meta: Dict):
+        entry = self.entry_dir(key)
+        entry.mkdir(parents=True, exist_ok=True)
+        tmp = entry / "meta.json.tmp"
+        with open(tmp, 'w') as f:
+            json.dump(meta, f)
+        os.replace(tmp, entry / "meta.json")
+
+    def write_body(self, key: str, body: bytes):
+        """Replace an object's body atomically, so readers never see a partial one."""
+        entry = self.entry_dir(key)
+        entry.mkdir(parents=True, exist_ok=True)
+        tmp = entry / "body.tmp"
+        with open(tmp, 'wb') as f:
+            f.write(body)
+        os.replace(tmp, entry / "body")
+
+    def touch(self, key: str, size_delta: int = 0):
+        with self._lock:
+            size, _ = self._usage.get(key, (0, 0))
+            self._usage[key] = (max(0, size + size_delta), time.time())
+        if size_delta > 0:
+            self.evict()
+
+    def pin(self, key: str):
+        with self._lock:
+            self._pinned[key] = self._pinned.get(key, 0) + 1
+
+    def unpin(self, key: str):
+        with self._lock:
+            count = self._pinned.pop(key, 0) - 1
+            if count > 0:
+                self._pinned[key] = count
+
+    def drop(self, key: str):
+        entry = self.entry_dir(key)
+        for f in entry.glob("*"):
+            try:
+                f.unlink()
+            except OSError:
+                pass
+        with self._lock:
+            self._usage.pop(key, None)
+
+    def evict(self):
+        with self._lock:
+            total = sum(size for size, _ in self._usage.values())
+            if total <= self.max_bytes:
+                return
+            victims = []
+            for key, (size, _) in sorted(self._usage.items(), key=lambda kv: kv[1][1]):
+                if total <= self.max_bytes * 0.9:
+                    break
+                if key in self._pinned:
+                    continue
+                victims.append(key)
+                total -= size
+        for key in victims:
+            with self.entry_lock(key):
+                self.drop(key)
+        if victims:
+            logger.info(f"Edge cache evicted {len(victims)} entries")
+
+
+_origin = None
+_cache = None
+_flights = SingleFlight()
+
+
+def _ttl_for(path: str) -> int:
+    if path.startswith('/artwork/') or ('?' in path and path.startswith('/stream/')):
+        return EDGE_ARTWORK_TTL
+    return EDGE_REVALIDATE_SECONDS
+
+
+def fetch_object(path: str) -> Tuple[int, Dict, bytes]:
+    """Cached GET of a small object with validator-based revalidation."""
+    key = EdgeCache.key_for(path)
+    meta = _cache.read_meta(key)
+    now = time.time()
+
+    if meta and now - meta["validated_at"] < _ttl_for(path):
+        try:
+            with open(_cache.entry_dir(key) / "body", 'rb') as f:
+                _cache.touch(key)
+                return meta["status"], meta["headers"], f.read()
+        except OSError:
+            meta = None
+
+    def revalidate():
+        current = _cache.read_meta(key)
+        if current and not (_cache.entry_dir(key) / "body").exists():
+            current = None  # Body lost: fetch it again rather than revalidate
+        if current and time.time() - current["validated_at"] < _ttl_for(path):
+            with open(_cache.entry_dir(key) / "body", 'rb') as f:
+                return current["status"], current["headers"], f.read()
+
+        headers = {}
+        if current and current["headers"].get("etag"):
+            headers["If-None-Match"] = current["headers"]["etag"]
+        status, resp_headers, body = _origin.request("GET", path, headers)
+
+        with _cache.entry_lock(key):
+            if status == 304 and current:
+                current["validated_at"] = time.time()
+                _cache.write_meta(key, current)
+                with open(_cache.entry_dir(key) / "body", 'rb') as f:
+                    return current["status"], current["headers"], f.read()
+
+            if status != 200:
+                # Negative answers are not cached; drop any stale copy
+                if status == 404 and current:
+                    _cache.drop(key)
+                return status, resp_headers, body
+
+            kept = {k: v for k, v in resp_headers.items()
+                    if k in [h.lower() for h in FORWARDED_HEADERS]}
+            try:
+                old_size = (_cache.entry_dir(key) / "body").stat().st_size
+            except OSError:
+                old_size = 0
+            _cache.write_body(key, body)
+            _cache.write_meta(key, {"path": path, "status": 200, "headers": kept,
+                                    "validated_at": time.time()})
+            _cache.touch(key, len(body) - old_size)
+            return 200, kept, body
+
+    return _flights.do(("obj", key), revalidate)
+
+
+def invalidate_playlist(name: str):
+    """Force the next /hash or /playlist request for `name` to revalidate."""
+    for path in (f"/hash/{name}", f"/playlist/{name}"):
+        key = EdgeCache.key_for(path)
+        with _cache.entry_lock(key):
+            meta = _cache.read_meta(key)
+            if meta:
+                meta["validated_at"] = 0
+                _cache.write_meta(key, meta)
+
+
+def stream_meta(path: str) -> Optional[Dict]:
+    """Size/type/validator of an audio file, revalidated with HEAD every EDGE_STREAM_TTL."""
+    key = EdgeCache.key_for(path)
+    meta = _cache.read_meta(key)
+    if meta and time.time() - meta["validated_at"] < EDGE_STREAM_TTL:
+        return meta
+
+    def revalidate():
+        current = _cache.read_meta(key)
+        if current and time.time() - current["validated_at"] < EDGE_STREAM_TTL:
+            return current
+
+        headers = {"If-None-Match": current["etag"]} if current and current.get("etag") else {}
+        status, resp_headers, _ = _origin.request("HEAD", path, headers)
+
+        with _cache.entry_lock(key):
+            if status == 304 and current:
+                current["validated_at"] = time.time()
+                _cache.write_meta(key, current)
+                return current
+            if status != 200:
+                if current:
+                    _cache.drop(key)
+                return None
+
+            etag = resp_headers.get("etag", "")
+            if current and current.get("etag") != etag:
+                # File changed on the origin - cached chunks are invalid
+                logger.info(f"Edge cache: {path} changed on origin, dropping cached chunks")
+                _cache.drop(key)
+                current = None
+
+            meta = current or {"path": path, "chunks": []}
+            meta.update({
+                "etag": etag,
+                "size": int(resp_headers.get("content-length", 0)),
+                "content_type": resp_headers.get("content-type", "application/octet-stream"),
+                "last_modified": resp_headers.get("last-modified", ""),
+                "validated_at": time.time(),
+            })
+            _cache.write_meta(key, meta)
+            return meta
+
+    return _flights.do(("meta", key), revalidate)
+
+
+def _chunks_on_disk(key: str) -> List[int]:
+    """Cached chunk indexes of an entry; [] once it (or its data file) was dropped. Call locked."""
+    meta = _cache.read_meta(key)
+    if meta is None or not (_cache.entry_dir(key) / "data").exists():
+        return []
+    return list(meta["chunks"])
+
+
+def ensure_chunk(path: str, meta: Dict, index: int):
+    """Make sure chunk `index` of `path` is on disk, fetching it once if missing."""
+    key = EdgeCache.key_for(path)
+    if index in meta["chunks"] and (_cache.entry_dir(key) / "data").exists():
+        return
+
+    def fetch():
+        with _cache.entry_lock(key):
+            meta["chunks"] = _chunks_on_disk(key)
+            if index in meta["chunks"]:
+                return
+
+        start = index * STREAM_CHUNK_SIZE
+        end = min(start + STREAM_CHUNK_SIZE, meta["size"]) - 1
+        headers = {"Range": f"bytes={start}-{end}"}
+        if meta.get("etag"):
+            headers["If-Range"] = meta["etag"]
+        status, _, body = _origin.request("GET", path, headers)
+        if status not in (200, 206):
+            raise IOError(f"Origin returned HTTP {status} for {path}")
+        if status == 200:
+            body = body[start:end + 1]
+
+        with _cache.entry_lock(key):
+            # The entry may have been evicted or dropped during the fetch; a new
+            # data file then starts with no chunks, not the old list
+            chunks = _chunks_on_disk(key)
+            data_file = _cache.entry_dir(key) / "data"
+            _cache.entry_dir(key).mkdir(parents=True, exist_ok=True)
+            with open(data_file, 'r+b' if data_file.exists() else 'wb') as f:
+                f.seek(start)
+                f.write(body)
+            current = _cache.read_meta(key) or dict(meta)
+            if index not in chunks:
+                chunks.append(index)
+            current["chunks"] = chunks
+            _cache.write_meta(key, current)
+            meta["chunks"] = list(chunks)
+        _cache.touch(key, len(body))
+
+    _flights.do(("chunk", key, index), fetch)
+
+
+def init_edge_proxy(origin_url: str, cache_dir: str):
+    global _origin, _cache
+    _origin = OriginClient(origin_url)
+    _cache = EdgeCache(cache_dir, EDGE_CACHE_MAX_BYTES)
+    logger.info(f"Edge proxy mode: origin {origin_url}, cache {cache_dir} "
+                f"({EDGE_CACHE_MAX_BYTES // (1024 * 1024)} MB)")
+
+
+def handle_edge_request(handler, send_body: bool = True):
+    """Serve a GET/HEAD request for SyncHandler from the edge cache."""
+    path = handler.path
+
+    try:
+        if path.startswith('/stream/') and '?' not in path:
+            serve_stream(handler, path, send_body)
+            return
+
+        if path.startswith(PASSTHROUGH_PREFIXES):
+            status, headers, body = _origin.request("GET", path)
+        else:
+            status, headers, body = fetch_object(path)
+    except Exception as e:
+        logger.error(f"Edge proxy error for {path}: {e}")
+        handler.send_error(502, "Origin unavailable")
+        return
+
+    etag = headers.get("etag")
+    if status == 200 and etag and handler.check_not_modified(etag):
+        return
+
+    handler.send_response(status)
+    for name in FORWARDED_HEADERS:
+        if headers.get(name.lower()):
+            handler.send_header(name, headers[name.lower()])
+    handler.send_header('Content-Length', str(len(body)))
+    handler.end_headers()
+    if send_body:
+        handler.wfile.write(body)
+
+
+def handle_edge_post(handler):
+    """Forward POST /sync/{name} (or /sync-batch) to the origin and mark the playlists stale."""
+    try:
+        status, headers, body = _origin.request("POST", handler.path)
+    except Exception as e:
+        logger.error(f"Edge proxy error for POST {handler.path}: {e}")
+        handler.send_error(502, "Origin unavailable")
+        return
+
+    if handler.path.startswith('/sync/'):
+        invalidate_playlist(handler.path[6:])
+    elif handler.path.startswith('/sync-batch?'):
+        for name in urllib.parse.parse_qs(urllib.parse.urlsplit(handler.path).query).get('name', []):
+            invalidate_playlist(name)
+
+    handler.send_response(status)
+    handler.send_header('Content-type', headers.get('content-type', 'application/json'))
+    handler.send_header('Content-Length', str(len(body)))
+    handler.end_headers()
+    handler.wfile.write(body)
+
+
+def serve_stream(handler, path: str, send_body: bool):
+    meta = stream_meta(path)
+    if meta is None:
+        handler.send_error(404, "File not found")
+        return
+    if handler.check_not_modified(meta["etag"]):
+        return
+
+    file_len = meta["size"]
+    start, end = 0, file_len - 1
+    range_header = handler.headers.get('Range')
+    if range_header:
+        try:
+            _, r = range_header.split('=')
+            r_start, r_end = r.split('-')
+            if r_start:
+                start = int(r_start)
+                end = min(int(r_end), file_len - 1) if r_end else file_len - 1
+            else:
+                start = max(0, file_len - int(r_end))
+        except ValueError:
+            range_header = None
+        if range_header and start >= file_len:
+            handler.send_response(416)
+            handler.send_header("Content-Range", f"bytes */{file_len}")
+            handler.send_header("Content-Length", "0")
+            handler.end_headers()
+            return
+
+    if range_header:
+        handler.send_response(206)
+        handler.send_header("Content-Range", f"bytes {start}-{end}/{file_len}")
+    else:
+        handler.send_response(200)
+    handler.send_header("Accept-Ranges", "bytes")
+    handler.send_header("Content-type", meta["content_type"])
+    handler.send_header("Content-Length", str(end - start + 1))
+    if meta.get("last_modified"):
+        handler.send_header("Last-Modified", meta["last_modified"])
+    handler.send_header("ETag", meta["etag"])
+    handler.end_headers()
+
+    if not send_body or file_len == 0:
+        return
+
+    key = EdgeCache.key_for(path)
+    data_file = _cache.entry_dir(key) / "data"
+    pos = start
+    _cache.pin(key)  # Not evicted while this response reads it
+    try:
+        while pos <= end:
+            index = pos // STREAM_CHUNK_SIZE
+            chunk_end = min((index + 1) * STREAM_CHUNK_SIZE, end + 1)
+            data = None
+            for _ in range(3):
+                ensure_chunk(path, meta, index)
+                # Read under the entry lock: stream_meta drops the entry when the
+                # file changes on the origin, and that must not happen mid-read
+                with _cache.entry_lock(key):
+                    current = _cache.read_meta(key)
+                    if current is None or current.get("etag") != meta["etag"]:
+                        raise IOError(f"{path} changed on origin during the response")
+                    chunks = _chunks_on_disk(key)
+                    if index in chunks:
+                        with open(data_file, 'rb') as f:
+                            f.seek(pos)
+                            data = f.read(chunk_end - pos)
+                        break
+                    meta["chunks"] = chunks  # Lost since ensure_chunk: fetch it again
+            if data is None:
+                raise IOError(f"Chunk {index} of {path} could not be kept in the cache")
+            handler.wfile.write(data)
+            _cache.touch(key)
+            pos = chunk_end
+    except (ConnectionResetError, BrokenPipeError):
+        handler.close_connection = True
+    except Exception as e:
+        handler.log_error(f"Edge stream error: {e}")
+        handler.close_connection = True
+    finally:
+        _cache.unpin(key)
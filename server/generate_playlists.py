@@ -384,6 +384,9 @@ def process_sources(config: Dict) -> int:
         name = source.get("name")
         path = source.get("path")
         recursive = source.get("recursive", True)
+
+        if source.get("query"):
+            continue  # Smart playlists are maintained by the server's library index
         
         if not name or not path:
             logger.warning(f"Invalid source config: {source}")
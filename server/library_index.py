@@ -0,0 +1,356 @@
+"""
+Library Index for NSync Server
+Keeps an in-memory inverted index over audio file paths and tags so the
+library can be searched without syncing whole playlists.
+
+Tags are read with mutagen when it is installed; otherwise they are derived
+from the directory layout (Artist/Album (Year)/NN - Title.ext).
+"""
+
+import bisect
+import logging
+import re
+import threading
+import time
+import unicodedata
+from pathlib import Path
+from typing import Dict, Iterable, List, Optional, Tuple
+
+from generate_playlists import AUDIO_EXTENSIONS
+
+logger = logging.getLogger(__name__)
+
+try:
+    import mutagen
+except ImportError:
+    mutagen = None
+
+# Relative weight of a token match per field (title hits rank above path hits)
+FIELD_WEIGHTS = {
+    'title': 3.0,
+    'artist': 2.5,
+    'album': 2.0,
+    'genre': 1.5,
+    'year': 1.0,
+    'path': 1.0,
+}
+
+SEARCH_DEFAULT_LIMIT = 50
+SEARCH_MAX_LIMIT = 1000
+
+_TOKEN_RE = re.compile(r"\w+", re.UNICODE)
+_YEAR_RE = re.compile(r"(?:^|[\s\(\[])((?:19|20)\d\d)(?:[\s\)\]]|$)")
+_TRACK_PREFIX_RE = re.compile(r"^\d{1,3}[\s.\-_]+")
+
+
+def tokenize(text: str) -> List[str]:
+    """Lower-case, accent-folded word tokens."""
+    if not text:
+        return []
+    folded = unicodedata.normalize('NFKD', text)
+    folded = ''.join(c for c in folded if not unicodedata.combining(c))
+    return _TOKEN_RE.findall(folded.lower())
+
+
+def _first_tag(tags, key: str) -> str:
+    try:
+        value = tags.get(key)
+    except Exception:
+        return ""
+    if not value:
+        return ""
+    if isinstance(value, (list, tuple)):
+        value = value[0] if value else ""
+    return str(value).strip()
+
+
+def read_tags(file_path: Path) -> Dict[str, str]:
+    """Read title/artist/album/genre/year for a file.
+
+    Falls back to the Artist/Album/Track directory convention when mutagen is
+    unavailable or the file has no usable tags.
+    """
+    album_dir = file_path.parent
+    tags = {
+        'title': _TRACK_PREFIX_RE.sub('', file_path.stem) or file_path.stem,
+        'artist': album_dir.parent.name,
+        'album': album_dir.name,
+        'genre': "",
+        'year': "",
+    }
+    year_match = _YEAR_RE.search(album_dir.name)
+    if year_match:
+        tags['year'] = year_match.group(1)
+
+    if mutagen is not None:
+        try:
+            audio = mutagen.File(str(file_path), easy=True)
+            if audio is not None and audio.tags:
+                for field, key in (('title', 'title'), ('artist', 'artist'), ('album', 'album'),
+                                   ('genre', 'genre'), ('year', 'date')):
+                    value = _first_tag(audio.tags, key)
+                    if value:
+                        tags[field] = value[:4] if field == 'year' else value
+        except Exception as e:
+            logger.debug(f"Could not read tags from {file_path}: {e}")
+
+    return tags
+
+
+def build_document(path: str, stat_result=None) -> Optional[Dict]:
+    """Build an index document for an audio file. Returns None if unreadable."""
+    file_path = Path(path)
+    try:
+        st = stat_result or file_path.stat()
+    except OSError:
+        return None
+
+    doc = read_tags(file_path)
+    doc['path'] = path
+    doc['format'] = file_path.suffix.lower().lstrip('.')
+    doc['mtime'] = st.st_mtime
+    doc['size'] = st.st_size
+    return doc
+
+
+def scan_audio_files(roots: Iterable[str]) -> Dict[str, float]:
+    """Walk source roots and return {path: mtime} for every audio file."""
+    found = {}
+    for root in roots:
+        root_path = Path(root)
+        if not root_path.exists():
+            logger.warning(f"Index root does not exist: {root}")
+            continue
+        for file_path in root_path.glob('**/*'):
+            if file_path.suffix.lower() not in AUDIO_EXTENSIONS:
+                continue
+            try:
+                if file_path.is_file():
+                    found[str(file_path)] = file_path.stat().st_mtime
+            except OSError:
+                continue
+    return found
+
+
+def source_roots(sources: List[Dict]) -> List[str]:
+    """Unique source paths, dropping roots nested inside another root.
+
+    A smart playlist's query "path" (one or a list) is indexed too, so a query
+    over a directory that no other source covers still finds its files.
+    """
+    paths = set()
+    for s in sources:
+        if s.get("path"):
+            paths.add(str(Path(s["path"])))
+        query = s.get("query")
+        if isinstance(query, dict) and query.get("path"):
+            for p in query["path"] if isinstance(query["path"], list) else [query["path"]]:
+                paths.add(str(Path(p)))
+    paths = sorted(paths)
+    roots = []
+    for p in paths:
+        if not any(p == r or p.startswith(r.rstrip('/') + '/') for r in roots):
+            roots.append(p)
+    return roots
+
+
+class LibraryIndex:
+    """Inverted index over paths and tags of every audio file in the sources."""
+
+    def __init__(self):
+        self._lock = threading.RLock()
+        self._docs = {}           # doc id -> document dict
+        self._ids = {}            # path -> doc id
+        self._postings = {}       # token -> {doc id: weight}
+        self._tokens = []         # sorted token list for prefix lookups
+        self._tokens_dirty = False
+        self._next_id = 1
+        self._listeners = []
+        self.ready = False
+        self.last_refresh = 0.0
+
+    # -- Maintenance -------------------------------------------------------
+
+    def add_listener(self, callback):
+        """Register callback(added_docs, removed_docs) invoked after each index update."""
+        with self._lock:
+            self._listeners.append(callback)
+
+    def _notify(self, added: List[Dict], removed: List[Dict]):
+        if not added and not removed:
+            return
+        for callback in list(self._listeners):
+            try:
+                callback(added, removed)
+            except Exception as e:
+                logger.error(f"Index listener failed: {e}")
+
+    def _index_doc(self, doc_id: int, doc: Dict):
+        weights = {}
+        for field, weight in FIELD_WEIGHTS.items():
+            for token in tokenize(str(doc.get(field, ""))):
+                if weights.get(token, 0.0) < weight:
+                    weights[token] = weight
+        for token, weight in weights.items():
+            posting = self._postings.get(token)
+            if posting is None:
+                posting = self._postings[token] = {}
+                self._tokens_dirty = True
+            posting[doc_id] = weight
+
+    def _unindex_doc(self, doc_id: int, doc: Dict):
+        for field in FIELD_WEIGHTS:
+            for token in tokenize(str(doc.get(field, ""))):
+                posting = self._postings.get(token)
+                if posting is None:
+                    continue
+                posting.pop(doc_id, None)
+                if not posting:
+                    del self._postings[token]
+                    self._tokens_dirty = True
+
+    def apply_changes(self, added_paths: Iterable[str], removed_paths: Iterable[str]) -> Tuple[List[Dict], List[Dict]]:
+        """Add/remove individual files and notify listeners. Returns (added, removed) docs."""
+        added_docs = [d for d in (build_document(p) for p in added_paths) if d]
+        removed_docs = []
+
+        with self._lock:
+            for path in removed_paths:
+                doc_id = self._ids.pop(path, None)
+                if doc_id is None:
+                    continue
+                doc = self._docs.pop(doc_id)
+                self._unindex_doc(doc_id, doc)
+                removed_docs.append(doc)
+
+            for doc in added_docs:
+                # A re-added path (retagged or replaced) is reported as removed
+                # and added, so listeners drop the old version
+                old_id = self._ids.get(doc['path'])
+                if old_id is not None:
+                    old_doc = self._docs.pop(old_id)
+                    self._unindex_doc(old_id, old_doc)
+                    removed_docs.append(old_doc)
+                doc_id = self._next_id
+                self._next_id += 1
+                self._ids[doc['path']] = doc_id
+                self._docs[doc_id] = doc
+                self._index_doc(doc_id, doc)
+
+        self._notify(added_docs, removed_docs)
+        return added_docs, removed_docs
+
+    def refresh(self, sources: List[Dict]) -> Tuple[int, int]:
+        """Rescan source roots and apply only the difference to the index."""
+        started = time.time()
+        on_disk = scan_audio_files(source_roots(sources))
+
+        with self._lock:
+            indexed = {path: self._docs[doc_id]['mtime'] for path, doc_id in self._ids.items()}
+
+        removed = [p for p in indexed if p not in on_disk]
+        # New files, plus files whose mtime changed (retagged/replaced)
+        added = [p for p, mtime in on_disk.items() if indexed.get(p) != mtime]
+
+        self.apply_changes(added, removed)
+        self.ready = True
+        self.last_refresh = time.time()
+
+        if added or removed:
+            logger.info(f"Index refreshed: +{len(added)} -{len(removed)} "
+                        f"({len(on_disk)} files, {time.time() - started:.1f}s)")
+        return len(added), len(removed)
+
+    # -- Queries -----------------------------------------------------------
+
+    def __len__(self):
+        with self._lock:
+            return len(self._docs)
+
+    def documents(self) -> List[Dict]:
+        with self._lock:
+            return list(self._docs.values())
+
+    def _prefix_postings(self, prefix: str) -> Dict[int, float]:
+        if self._tokens_dirty:
+            self._tokens = sorted(self._postings)
+            self._tokens_dirty = False
+        merged = {}
+        i = bisect.bisect_left(self._tokens, prefix)
+        while i < len(self._tokens) and self._tokens[i].startswith(prefix):
+            for doc_id, weight in self._postings[self._tokens[i]].items():
+                # Prefix matches rank slightly below exact token matches
+                weight *= 0.8
+                if merged.get(doc_id, 0.0) < weight:
+                    merged[doc_id] = weight
+            i += 1
+        return merged
+
+    def search(self, query: str, offset: int = 0,
+               limit: Optional[int] = SEARCH_DEFAULT_LIMIT) -> Tuple[int, List[Dict]]:
+        """Ranked AND-search. The last query token also matches as a prefix.
+
+        Returns (total_matches, page_of_results); limit=None pages to the end.
+        """
+        tokens = tokenize(query)
+        if not tokens:
+            return 0, []
+
+        with self._lock:
+            doc_count = max(len(self._docs), 1)
+            scores = None
+            for i, token in enumerate(tokens):
+                is_last = (i == len(tokens) - 1)
+                posting = self._prefix_postings(token) if is_last else self._postings.get(token, {})
+                if not posting:
+                    return 0, []
+                # Rare tokens contribute more to the score
+                idf = 1.0 + (doc_count / (1.0 + len(posting))) ** 0.5
+                if scores is None:
+                    scores = {doc_id: w * idf for doc_id, w in posting.items()}
+                else:
+                    scores = {doc_id: s + posting[doc_id] * idf
+                              for doc_id, s in scores.items() if doc_id in posting}
+                if not scores:
+                    return 0, []
+
+            ranked = sorted(scores.items(), key=lambda kv: (-kv[1], self._docs[kv[0]]['path']))
+            page = ranked[offset:] if limit is None else ranked[offset:offset + limit]
+            results = []
+            for doc_id, score in page:
+                doc = dict(self._docs[doc_id])
+                doc['score'] = round(score, 3)
+                results.append(doc)
+            return len(ranked), results
+
+
+_index = None
+_index_lock = threading.Lock()
+
+
+def get_index() -> LibraryIndex:
+    """Process-wide index instance."""
+    global _index
+    with _index_lock:
+        if _index is None:
+            _index = LibraryIndex()
+        return _index
+
+
+def start_background_indexer(load_sources, interval: int):
+    """Build the index in the background, then rescan every `interval` seconds."""
+    index = get_index()
+
+    def run():
+        while True:
+            try:
+                index.refresh(load_sources())
+            except Exception as e:
+                logger.error(f"Index refresh failed: {e}")
+            if interval <= 0:
+                return
+            time.sleep(interval)
+
+    thread = threading.Thread(target=run, name="library-indexer", daemon=True)
+    thread.start()
+    return thread
@@ -15,6 +15,8 @@ BIND_ADDRESS = os.environ.get("BIND_ADDRESS", "0.0.0.0")
 PLAYLIST_DIR = os.environ.get("PLAYLIST_DIR", "/data")
 CONFIG_DIR = os.environ.get("CONFIG_DIR", "/config")
 LOG_LEVEL = os.environ.get("LOG_LEVEL", "INFO").upper()
+INDEX_REFRESH_INTERVAL = int(os.environ.get("INDEX_REFRESH_INTERVAL", 300))  # 0 = build once
+KEEPALIVE_TIMEOUT = int(os.environ.get("KEEPALIVE_TIMEOUT", 120))  # Seconds an idle connection is kept open
 
 # Setup logging
 logging.basicConfig(
@@ -53,6 +55,14 @@ def load_config():
 file_config = load_config()
 PLAYLIST_DIR = os.environ.get("PLAYLIST_DIR") or file_config.get("playlist_dir", PLAYLIST_DIR)
 
+# Edge proxy mode: serve from a local cache in front of a remote origin server
+ORIGIN_URL = os.environ.get("ORIGIN_URL") or file_config.get("origin_url", "")
+EDGE_CACHE_DIR = os.environ.get("EDGE_CACHE_DIR") or file_config.get("edge_cache_dir", "/cache")
+SHARD_URLS = os.environ.get("SHARD_URLS") or file_config.get("shards", [])
+
+SERVER_VERSION = "1.0.3"
+SERVER_ID = ""  # Set at startup; lets clients recognise this server behind different addresses
+
 # Explicit MIME type registration
 import mimetypes
 if not mimetypes.inited:
@@ -131,11 +141,55 @@ def find_artwork_in_directory(directory: Path):
 
     return None
 
+
+def render_search_playlist(results) -> bytes:
+    """Render search results as an m3u8 playlist in the generator's format."""
+    import urllib.parse
+    lines = ["#EXTM3U"]
+    for doc in results:
+        title = doc.get('title') or Path(doc['path']).stem
+        if doc.get('artist'):
+            title = f"{doc['artist']} - {title}"
+        lines.append(f"#EXTINF:-1,{title}")
+        lines.append(f"/stream{urllib.parse.quote(doc['path'])}")
+    return ('\n'.join(lines) + '\n').encode('utf-8')
+
 class SyncHandler(http.server.SimpleHTTPRequestHandler):
+    # Persistent connections: the client's art, hash and playlist requests reuse
+    # one socket instead of paying a TCP (and TLS) handshake each. Every response
+    # must therefore carry Content-Length, or close the connection.
+    protocol_version = "HTTP/1.1"
+    timeout = KEEPALIVE_TIMEOUT  # Idle keep-alive connections are dropped after this
+    # Headers and body go out as separate writes; with Nagle on, a kept-alive
+    # connection waits for the client's delayed ACK (~40 ms) before the body
+    disable_nagle_algorithm = True
+
     def address_string(self):
         # Skip reverse DNS lookup (causes 1-2 min delays)
         return self.client_address[0]
 
+    def check_not_modified(self, etag: str) -> bool:
+        """Send 304 if If-None-Match matches `etag`. Returns True when the request is answered."""
+        if_none_match = self.headers.get('If-None-Match')
+        if not if_none_match:
+            return False
+        tags = [t.strip() for t in if_none_match.split(',')]
+        if etag not in tags and '*' not in tags:
+            return False
+        self.send_response(304)
+        self.send_header('ETag', etag)
+        self.end_headers()
+        return True
+
+    def send_json(self, status: int, data, send_body: bool = True):
+        content = json.dumps(data).encode()
+        self.send_response(status)
+        self.send_header('Content-type', 'application/json')
+        self.send_header('Content-Length', str(len(content)))
+        self.end_headers()
+        if send_body:
+            self.wfile.write(content)
+
     def do_GET(self):
         self.handle_request(send_body=True)
 
@@ -144,80 +198,256 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
 
     def do_POST(self):
         """Handle POST requests for on-demand sync operations."""
+        if ORIGIN_URL:
+            from edge_proxy import handle_edge_post
+            handle_edge_post(self)
+            return
+        if SHARD_URLS:
+            from shard_aggregator import handle_shard_post
+            handle_shard_post(self)
+            return
+
         if self.path.startswith('/sync/'):
             playlist_name = self.path[6:]  # Remove '/sync/'
+            status, response_data = self.sync_playlist(playlist_name)
+            self.send_json(status, response_data)
+            return
 
-            try:
-                # Load config to find the source for this playlist
-                from generate_playlists import load_config as load_generator_config, incremental_update_playlist
-                generator_config = load_generator_config()
-
-                # Find the source configuration for this playlist
-                source = None
-                for s in generator_config.get("sources", []):
-                    if s.get("name") == playlist_name:
-                        source = s
-                        break
-
-                if not source:
-                    self.send_response(404)
-                    self.send_header('Content-type', 'application/json')
-                    self.end_headers()
-                    self.wfile.write(json.dumps({
-                        "error": f"No source configured for playlist '{playlist_name}'"
-                    }).encode())
-                    return
-
-                # Perform incremental update
-                output_dir = generator_config.get("playlist_dir", PLAYLIST_DIR)
-                include_artwork = generator_config.get("include_artwork", True)
+        elif self.path == '/sync-batch' or self.path.startswith('/sync-batch?'):
+            self.handle_sync_batch()
+            return
 
-                result = incremental_update_playlist(
-                    name=playlist_name,
-                    source_path=source.get("path"),
-                    output_dir=output_dir,
-                    recursive=source.get("recursive", True),
-                    include_artwork=include_artwork,
-                    recently_added_days=source.get("recently_added_days")
-                )
+        else:
+            self.send_error(404, "POST endpoint not found")
 
-                response_data = {
+    def sync_playlist(self, playlist_name: str):
+        """Incremental rescan of one playlist's source. Returns (status, response dict)."""
+        try:
+            # Load config to find the source for this playlist
+            from generate_playlists import load_config as load_generator_config, incremental_update_playlist
+            generator_config = load_generator_config()
+
+            # Find the source configuration for this playlist
+            source = None
+            for s in generator_config.get("sources", []):
+                if s.get("name") == playlist_name:
+                    source = s
+                    break
+
+            if source and isinstance(source.get("query"), dict):
+                # Smart playlists are maintained from index updates - nothing to rescan
+                from smart_playlists import get_smart_playlist
+                smart = get_smart_playlist(playlist_name)
+                # An empty playlist is falsy (len 0) - only a missing one is unavailable
+                return (200 if smart is not None else 503), {
                     "playlist": playlist_name,
-                    "updated": result["updated"],
-                    "added_count": len(result["added"]),
-                    "removed_count": len(result.get("removed", [])),
-                    "total": result["total"],
-                    "existing_count": result.get("existing_count", 0),
-                    "scanned_count": result.get("scanned_count", 0),
-                    "added_files": [Path(f).name for f in result["added"][:20]],
-                    "removed_files": [Path(f).name for f in result.get("removed", [])[:20]],
-                    "recently_added_days": source.get("recently_added_days")
+                    "updated": False,
+                    "smart": True,
+                    "added_count": 0,
+                    "removed_count": 0,
+                    "total": len(smart) if smart is not None else 0
                 }
 
-                # Include sample paths if no changes found (helps debug path mismatches)
-                if len(result["added"]) == 0 and len(result.get("removed", [])) == 0:
-                    response_data["sample_existing"] = result.get("sample_existing")
-                    response_data["sample_scanned"] = result.get("sample_scanned")
+            if not source:
+                return 404, {
+                    "error": f"No source configured for playlist '{playlist_name}'"
+                }
 
-                self.send_response(200)
-                self.send_header('Content-type', 'application/json')
-                self.end_headers()
-                self.wfile.write(json.dumps(response_data).encode())
+            # Perform incremental update
+            output_dir = generator_config.get("playlist_dir", PLAYLIST_DIR)
+            include_artwork = generator_config.get("include_artwork", True)
+
+            result = incremental_update_playlist(
+                name=playlist_name,
+                source_path=source.get("path"),
+                output_dir=output_dir,
+                recursive=source.get("recursive", True),
+                include_artwork=include_artwork,
+                recently_added_days=source.get("recently_added_days")
+            )
+
+            # Keep the search index in step with what the scan just found
+            # (files that merely aged out of a recently_added window still exist)
+            if result["added"] or result.get("removed"):
+                from library_index import get_index
+                deleted = [f for f in result.get("removed", []) if not os.path.exists(f)]
+                get_index().apply_changes(result["added"], deleted)
+
+            if result["updated"]:
+                from smart_playlists import get_change_feed
+                get_change_feed().publish(playlist_name, result["added"], result.get("removed", []), result["total"])
+
+            response_data = {
+                "playlist": playlist_name,
+                "updated": result["updated"],
+                "added_count": len(result["added"]),
+                "removed_count": len(result.get("removed", [])),
+                "total": result["total"],
+                "existing_count": result.get("existing_count", 0),
+                "scanned_count": result.get("scanned_count", 0),
+                "added_files": [Path(f).name for f in result["added"][:20]],
+                "removed_files": [Path(f).name for f in result.get("removed", [])[:20]],
+                "recently_added_days": source.get("recently_added_days")
+            }
+
+            # Include sample paths if no changes found (helps debug path mismatches)
+            if len(result["added"]) == 0 and len(result.get("removed", [])) == 0:
+                response_data["sample_existing"] = result.get("sample_existing")
+                response_data["sample_scanned"] = result.get("sample_scanned")
+
+            return 200, response_data
 
-            except Exception as e:
-                logger.error(f"Sync error for '{playlist_name}': {e}")
-                self.send_response(500)
-                self.send_header('Content-type', 'application/json')
-                self.end_headers()
-                self.wfile.write(json.dumps({"error": str(e)}).encode())
+        except Exception as e:
+            logger.error(f"Sync error for '{playlist_name}': {e}")
+            return 500, {"error": str(e)}
+
+    def handle_sync_batch(self):
+        """POST /sync-batch?name=a&name=b - /sync for several playlists, answered with their hashes.
+
+        One line per playlist, "name<TAB>hash<TAB>error", in request order. Each
+        line is sent (as an HTTP chunk) as soon as that playlist's rescan is
+        done, so clients start on the first result while the rest still scan.
+        The hash is empty when the playlist file does not exist; a failed
+        rescan of an existing playlist still reports its current hash, as the
+        client's /sync then /hash sequence would.
+        """
+        import urllib.parse
+        params = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+        names = params.get('name', [])
+        if not names:
+            self.send_error(400, "No playlists named")
+            return
+
+        self.send_response(200)
+        self.send_header('Content-type', 'text/plain; charset=utf-8')
+        self.send_header('Transfer-Encoding', 'chunked')
+        self.end_headers()
+
+        try:
+            for name in names:
+                status, result = self.sync_playlist(name)
+                error = "" if status == 200 else str(result.get("error", f"HTTP {status}"))
+                try:
+                    with open(Path(PLAYLIST_DIR) / f"{name}.m3u8", 'rb') as f:
+                        file_hash = hashlib.md5(f.read()).hexdigest()
+                except FileNotFoundError:
+                    file_hash = ""
+                    error = error or f"Playlist '{name}' not found"
+                line = f"{name}\t{file_hash}\t{error.replace(chr(9), ' ').replace(chr(10), ' ')}\n".encode()
+                self.wfile.write(f"{len(line):x}\r\n".encode() + line + b"\r\n")
+                self.wfile.flush()
+            self.wfile.write(b"0\r\n\r\n")
+        except (ConnectionResetError, BrokenPipeError):
+            self.close_connection = True
+
+    def handle_search(self, send_body=True):
+        """GET /search?q=...&offset=&limit=&format=json|m3u8|hash
+
+        A playlist (m3u8/hash) without a limit holds every match, so a search
+        playlist is never silently cut short.
+        """
+        import urllib.parse
+        from library_index import get_index, SEARCH_DEFAULT_LIMIT, SEARCH_MAX_LIMIT
+
+        params = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+        query = params.get('q', [''])[0].strip()
+        fmt = params.get('format', ['json'])[0]
+        try:
+            offset = max(0, int(params.get('offset', ['0'])[0]))
+            if fmt != 'json' and 'limit' not in params:
+                limit = None
+            else:
+                limit = min(SEARCH_MAX_LIMIT, max(1, int(params.get('limit', [str(SEARCH_DEFAULT_LIMIT)])[0])))
+        except ValueError:
+            self.send_error(400, "Invalid offset or limit")
             return
 
+        if not query:
+            self.send_error(400, "Missing query parameter 'q'")
+            return
+
+        index = get_index()
+        total, results = index.search(query, offset, limit)
+
+        if fmt in ('m3u8', 'hash'):
+            content = render_search_playlist(results)
+            if fmt == 'hash':
+                content = hashlib.md5(content).hexdigest().encode()
+                content_type = 'text/plain'
+            else:
+                content_type = 'application/x-mpegurl'
         else:
-            self.send_error(404, "POST endpoint not found")
+            content = json.dumps({
+                "query": query,
+                "total": total,
+                "offset": offset,
+                "limit": limit,
+                "indexing": not index.ready,
+                "results": [{
+                    "path": doc['path'],
+                    "stream": f"/stream{urllib.parse.quote(doc['path'])}",
+                    "title": doc.get('title', ""),
+                    "artist": doc.get('artist', ""),
+                    "album": doc.get('album', ""),
+                    "genre": doc.get('genre', ""),
+                    "year": doc.get('year', ""),
+                    "format": doc.get('format', ""),
+                    "score": doc['score'],
+                } for doc in results]
+            }).encode()
+            content_type = 'application/json'
+
+        self.send_response(200)
+        self.send_header('Content-type', content_type)
+        self.send_header('Content-Length', str(len(content)))
+        self.end_headers()
+        if send_body:
+            self.wfile.write(content)
+
+    def handle_changes(self, send_body=True):
+        """GET /changes?since=N&wait=S - playlist change feed (long-poll up to 60s)"""
+        import urllib.parse
+        from smart_playlists import get_change_feed
+
+        params = urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query)
+        try:
+            since = int(params.get('since', ['0'])[0])
+            wait = min(60.0, max(0.0, float(params.get('wait', ['0'])[0])))
+        except ValueError:
+            self.send_error(400, "Invalid since or wait")
+            return
+
+        content = json.dumps(get_change_feed().since(since, wait)).encode()
+        self.send_response(200)
+        self.send_header('Content-type', 'application/json')
+        self.send_header('Content-Length', str(len(content)))
+        self.end_headers()
+        if send_body:
+            self.wfile.write(content)
 
     def handle_request(self, send_body=True):
-        if self.path == '/status':
+        if ORIGIN_URL and self.path != '/status':
+            from edge_proxy import handle_edge_request
+            handle_edge_request(self, send_body)
+            return
+        if SHARD_URLS and self.path != '/status':
+            from shard_aggregator import handle_shard_request
+            handle_shard_request(self, send_body)
+            return
+
+        if self.path == '/search' or self.path.startswith('/search?'):
+            self.handle_search(send_body)
+            return
+
+        elif self.path == '/changes' or self.path.startswith('/changes?'):
+            self.handle_changes(send_body)
+            return
+
+        elif self.path == '/status':
             self.send_response(200)
+            if SERVER_ID:
+                self.send_header('X-NSync-Server-Id', SERVER_ID)
+            self.send_header('Content-Length', '2')
             self.end_headers()
             if send_body:
                 self.wfile.write(b"OK")
@@ -231,11 +461,7 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                 for f in playlist_path.glob("*.m3u8"):
                     playlists.append(f.stem)
                 
-                self.send_response(200)
-                self.send_header('Content-type', 'application/json')
-                self.end_headers()
-                if send_body:
-                    self.wfile.write(json.dumps(playlists).encode())
+                self.send_json(200, playlists, send_body)
             except Exception as e:
                 self.send_error(500, str(e))
             return
@@ -248,7 +474,11 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
             try:
                 with open(playlist_file, 'rb') as f:
                     file_hash = hashlib.md5(f.read()).hexdigest()
+                if self.check_not_modified(f'"{file_hash}"'):
+                    return
                 self.send_response(200)
+                self.send_header('ETag', f'"{file_hash}"')
+                self.send_header('Content-Length', str(len(file_hash)))
                 self.end_headers()
                 if send_body:
                     self.wfile.write(file_hash.encode())
@@ -264,9 +494,14 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
             try:
                 with open(playlist_file, 'rb') as f:
                     content = f.read()
+                etag = f'"{hashlib.md5(content).hexdigest()}"'
+                if self.check_not_modified(etag):
+                    return
                 self.send_response(200)
                 self.send_header('Content-type', 'application/x-mpegurl')
                 self.send_header('Content-Disposition', f'attachment; filename="{playlist_name}.m3u8"')
+                self.send_header('Content-Length', str(len(content)))
+                self.send_header('ETag', etag)
                 self.end_headers()
                 if send_body:
                     self.wfile.write(content)
@@ -281,6 +516,7 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                 with open(playlist_file, 'rb') as f:
                     file_hash = hashlib.md5(f.read()).hexdigest()
                 self.send_response(200)
+                self.send_header('Content-Length', str(len(file_hash)))
                 self.end_headers()
                 if send_body:
                     self.wfile.write(file_hash.encode())
@@ -296,6 +532,7 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                 self.send_response(200)
                 self.send_header('Content-type', 'application/x-mpegurl')
                 self.send_header('Content-Disposition', 'attachment; filename="playlist.m3u8"')
+                self.send_header('Content-Length', str(len(content)))
                 self.end_headers()
                 if send_body:
                     self.wfile.write(content)
@@ -321,10 +558,14 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                     # Use cached artwork lookup
                     content, mime_type = get_cached_artwork(audio_file.parent)
                     if content:
+                        etag = f'"{hashlib.md5(content).hexdigest()}"'
+                        if self.check_not_modified(etag):
+                            return
                         self.send_response(200)
                         self.send_header('Content-type', mime_type)
                         self.send_header('Content-Length', str(len(content)))
                         self.send_header('Cache-Control', 'public, max-age=86400')
+                        self.send_header('ETag', etag)
                         self.end_headers()
 
                         if send_body:
@@ -378,6 +619,9 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                 f = open(path, 'rb')
                 fs = os.fstat(f.fileno())
                 file_len = fs.st_size
+                etag = f'"{fs.st_mtime_ns:x}-{file_len:x}"'
+                if self.check_not_modified(etag):
+                    return
                 
                 # Parse Range header
                 range_header = self.headers.get('Range')
@@ -388,13 +632,14 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                         _, r = range_header.split('=')
                         r_start, r_end = r.split('-')
                         start = int(r_start) if r_start else 0
-                        end = int(r_end) if r_end else file_len - 1
+                        end = min(int(r_end), file_len - 1) if r_end else file_len - 1
                     except ValueError:
                         pass # Ignore invalid range
                         
                     if start >= file_len:
-                        self.send_error(416, "Requested Range Not Satisfiable")
+                        self.send_response(416)
                         self.send_header("Content-Range", f"bytes */{file_len}")
+                        self.send_header("Content-Length", "0")
                         self.end_headers()
                         return
                         
@@ -407,6 +652,7 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                 self.send_header("Content-type", mimetypes.guess_type(path)[0] or 'application/octet-stream')
                 self.send_header("Content-Length", str(end - start + 1))
                 self.send_header("Last-Modified", self.date_time_string(fs.st_mtime))
+                self.send_header("ETag", etag)
                 self.end_headers()
                 
                 if not send_body:
@@ -426,9 +672,14 @@ class SyncHandler(http.server.SimpleHTTPRequestHandler):
                     except (ConnectionResetError, BrokenPipeError):
                         break
                     left -= len(block)
-                    
+
+                # A short body would desync the next request on this connection
+                if left > 0:
+                    self.close_connection = True
+
             except Exception as e:
                 self.log_error(f"Stream error: {e}")
+                self.close_connection = True
             finally:
                 if f:
                     f.close()
@@ -477,47 +728,77 @@ class ThreadingHTTPServer(ThreadingMixIn, socketserver.TCPServer):
 
 
 if __name__ == "__main__":
-    logger.info("foo_nsync Server v1.0.3")
+    logger.info(f"foo_nsync Server v{SERVER_VERSION}")
     logger.info(f"Config directory: {CONFIG_DIR}")
     logger.info(f"Playlist directory: {PLAYLIST_DIR}")
     logger.info(f"Bind address: {BIND_ADDRESS}:{PORT}")
-    logger.info("Endpoints: /status, /list, /hash/{name}, /playlist/{name}, /artwork/{path}, POST /sync/{name}")
+    logger.info("Endpoints: /status, /list, /hash/{name}, /playlist/{name}, /artwork/{path}, /search?q=, /changes?since=, POST /sync/{name}")
     
-    # Check playlists on startup - only create if missing, never full regenerate
+    if ORIGIN_URL:
+        # Edge proxy mode - playlists live on the origin, nothing to generate or index here
+        from edge_proxy import init_edge_proxy
+        init_edge_proxy(ORIGIN_URL, EDGE_CACHE_DIR)
+    elif SHARD_URLS:
+        # Aggregator mode - every shard scans and indexes its own directories
+        from shard_aggregator import init_shard_aggregator
+        init_shard_aggregator(SHARD_URLS)
+    else:
+        # Check playlists on startup - only create if missing, never full regenerate
+        try:
+            from generate_playlists import load_config as load_generator_config, generate_playlist, scan_directory
+            generator_config = load_generator_config()
+            sources = generator_config.get("sources", [])
+            output_dir = generator_config.get("playlist_dir", PLAYLIST_DIR)
+            include_artwork = generator_config.get("include_artwork", True)
+
+            if sources:
+                for source in sources:
+                    name = source.get("name")
+                    path = source.get("path")
+                    recursive = source.get("recursive", True)
+
+                    if not name or not path:
+                        continue
+
+                    playlist_file = Path(output_dir) / f"{name}.m3u8"
+                    recently_added_days = source.get("recently_added_days")
+
+                    if not playlist_file.exists():
+                        # Only generate if playlist doesn't exist
+                        logger.info(f"Creating missing playlist '{name}'...")
+                        files = scan_directory(path, recursive, recently_added_days)
+                        if files:
+                            generate_playlist(name, files, output_dir, include_artwork)
+                    else:
+                        logger.info(f"Playlist '{name}' exists, skipping startup generation")
+            else:
+                logger.info("No playlist sources configured")
+        except ImportError:
+            logger.warning("generate_playlists.py not found, skipping startup check")
+        except Exception as e:
+            logger.error(f"Error during startup playlist check: {e}")
+
+        # Build the search index in the background so startup is not delayed.
+        # Smart playlists attach first so the initial build populates them.
+        try:
+            from generate_playlists import load_config as load_generator_config
+            from library_index import get_index, start_background_indexer
+            from smart_playlists import start_smart_playlists
+            generator_config = load_generator_config()
+            start_smart_playlists(get_index(), generator_config, PLAYLIST_DIR)
+            # Sources are re-read on every refresh, so added or edited ones are picked up
+            start_background_indexer(lambda: load_generator_config().get("sources", []), INDEX_REFRESH_INTERVAL)
+        except ImportError:
+            logger.warning("library_index.py not found, search and smart playlists disabled")
+
+    # Advertise on the LAN via mDNS/DNS-SD so clients can find the direct address
     try:
-        from generate_playlists import load_config as load_generator_config, generate_playlist, scan_directory
-        generator_config = load_generator_config()
-        sources = generator_config.get("sources", [])
-        output_dir = generator_config.get("playlist_dir", PLAYLIST_DIR)
-        include_artwork = generator_config.get("include_artwork", True)
-
-        if sources:
-            for source in sources:
-                name = source.get("name")
-                path = source.get("path")
-                recursive = source.get("recursive", True)
-
-                if not name or not path:
-                    continue
-
-                playlist_file = Path(output_dir) / f"{name}.m3u8"
-                recently_added_days = source.get("recently_added_days")
-
-                if not playlist_file.exists():
-                    # Only generate if playlist doesn't exist
-                    logger.info(f"Creating missing playlist '{name}'...")
-                    files = scan_directory(path, recursive, recently_added_days)
-                    if files:
-                        generate_playlist(name, files, output_dir, include_artwork)
-                else:
-                    logger.info(f"Playlist '{name}' exists, skipping startup generation")
-        else:
-            logger.info("No playlist sources configured")
+        from discovery import load_server_id, start_advertiser
+        SERVER_ID = load_server_id(CONFIG_DIR, PORT)
+        start_advertiser(CONFIG_DIR, PORT, BIND_ADDRESS, SERVER_VERSION)
     except ImportError:
-        logger.warning("generate_playlists.py not found, skipping startup check")
-    except Exception as e:
-        logger.error(f"Error during startup playlist check: {e}")
-    
+        logger.warning("discovery.py not found, LAN discovery disabled")
+
     with ThreadingHTTPServer((BIND_ADDRESS, PORT), SyncHandler) as httpd:
         logger.info("Server is multi-threaded - can handle concurrent requests")
         httpd.serve_forever()
@@ -0,0 +1,275 @@
+"""
+Shard Aggregator for NSync Server
+Presents several server instances (shards), each scanning its own music
+directories, as one logical library. Clients point at the aggregator only.
+
+- /hash/{name} and /playlist/{name} are fetched from every shard in parallel;
+  playlists are merged in shard order and each entry is rewritten to an
+  absolute URL on its owning shard, so audio and artwork are served directly
+  by the machine that holds the file.
+- POST /sync/{name} and /search fan out to all shards and merge the results.
+- A shard without the playlist is skipped; a shard that cannot be reached
+  fails the request, so clients keep their current playlist instead of
+  dropping that shard's tracks.
+"""
+
+import hashlib
+import json
+import logging
+import urllib.parse
+from concurrent.futures import ThreadPoolExecutor
+from typing import Dict, List, Optional, Tuple
+
+from edge_proxy import OriginClient
+
+logger = logging.getLogger(__name__)
+
+SHARD_MAX_WORKERS = 16
+
+_shards: List[Dict] = []
+_executor: Optional[ThreadPoolExecutor] = None
+
+
+class ShardUnavailable(Exception):
+    pass
+
+
+def parse_shards(value) -> List[Dict]:
+    """Accept "url;url" strings or config lists of urls / {"url", "public_url"} objects."""
+    if isinstance(value, str):
+        value = value.replace(',', ';').split(';')
+    shards = []
+    for entry in value or []:
+        if isinstance(entry, dict):
+            url = (entry.get("url") or "").strip().rstrip('/')
+            public_url = (entry.get("public_url") or url).strip().rstrip('/')
+        else:
+            url = public_url = str(entry).strip().rstrip('/')
+        if url:
+            shards.append({"url": url, "public_url": public_url, "client": OriginClient(url)})
+    return shards
+
+
+def init_shard_aggregator(shards):
+    global _shards, _executor
+    _shards = parse_shards(shards)
+    _executor = ThreadPoolExecutor(max_workers=min(SHARD_MAX_WORKERS, max(4, len(_shards) * 4)),
+                                   thread_name_prefix="shard")
+    logger.info(f"Shard aggregator mode: {', '.join(s['url'] for s in _shards)}")
+
+
+def fan_out(method: str, path: str) -> List[Tuple[Dict, int, bytes]]:
+    """Run the request on every shard in parallel. Returns (shard, status, body) in shard order."""
+    def call(shard):
+        try:
+            status, _, body = shard["client"].request(method, path)
+            return shard, status, body
+        except Exception as e:
+            logger.warning(f"Shard {shard['url']} unavailable for {path}: {e}")
+            return shard, 0, b""
+
+    return list(_executor.map(call, _shards))
+
+
+def _collect(method: str, path: str) -> List[Tuple[Dict, bytes]]:
+    """Successful shard responses; shards answering 404 are skipped, any other failure raises."""
+    found = []
+    for shard, status, body in fan_out(method, path):
+        if status == 200:
+            found.append((shard, body))
+        elif status != 404:
+            raise ShardUnavailable(f"{shard['url']} returned {status or 'no response'}")
+    return found
+
+
+def merge_playlists(parts: List[Tuple[Dict, bytes]]) -> bytes:
+    """Concatenate shard playlists, pointing relative entries at the owning shard."""
+    lines = ["#EXTM3U"]
+    for shard, body in parts:
+        for line in body.decode('utf-8', errors='replace').splitlines():
+            line = line.strip()
+            if not line or line == "#EXTM3U":
+                continue
+            if line.startswith('/'):
+                line = shard["public_url"] + line
+            elif line.startswith('#EXTIMG:/'):
+                # Artwork lives on the same shard as the track
+                line = "#EXTIMG:" + shard["public_url"] + line[len("#EXTIMG:"):]
+            lines.append(line)
+    return ('\n'.join(lines) + '\n').encode('utf-8')
+
+
+def combined_hash(parts: List[Tuple[Dict, bytes]]) -> str:
+    """Changes whenever any shard's playlist (or the set of shards holding it) changes."""
+    digest = hashlib.md5()
+    for shard, body in parts:
+        digest.update(f"{shard['public_url']}\t{body.decode('ascii', errors='replace').strip()}\n".encode())
+    return digest.hexdigest()
+
+
+def merged_playlist_hash(name: str) -> Optional[str]:
+    parts = _collect("GET", f"/hash/{name}")
+    return combined_hash(parts) if parts else None
+
+
+def _search_shard(shard: Dict, query: str, count: Optional[int]) -> Tuple[int, bool, List[Dict]]:
+    """A shard's top `count` results (all of them for None), fetched in pages of
+    SEARCH_MAX_LIMIT. Returns (total, indexing, results); a shard answering 404 has none."""
+    from library_index import SEARCH_MAX_LIMIT
+
+    total, indexing, results = 0, False, []
+    while count is None or len(results) < count:
+        limit = SEARCH_MAX_LIMIT if count is None else min(SEARCH_MAX_LIMIT, count - len(results))
+        path = "/search?" + urllib.parse.urlencode({
+            "q": query, "format": "json", "offset": len(results), "limit": limit})
+        try:
+            status, _, body = shard["client"].request("GET", path)
+        except Exception as e:
+            logger.warning(f"Shard {shard['url']} unavailable for {path}: {e}")
+            status, body = 0, b""
+        if status == 404:
+            break
+        if status != 200:
+            raise ShardUnavailable(f"{shard['url']} returned {status or 'no response'}")
+
+        data = json.loads(body)
+        total = data.get("total", 0)
+        indexing = indexing or data.get("indexing", False)
+        page = data.get("results", [])
+        for doc in page:
+            doc["stream"] = shard["public_url"] + doc["stream"]
+        results.extend(page)
+        if not page or len(results) >= total:
+            break
+    return total, indexing, results
+
+
+def merged_search(path: str) -> Tuple[str, bytes]:
+    """Fan /search out as JSON and merge by score. Returns (content type, body).
+
+    As on a single server, a playlist (m3u8/hash) without a limit holds every match.
+    """
+    from library_index import SEARCH_DEFAULT_LIMIT, SEARCH_MAX_LIMIT
+
+    params = urllib.parse.parse_qs(urllib.parse.urlparse(path).query)
+    query = params.get('q', [''])[0]
+    fmt = params.get('format', ['json'])[0]
+    offset = max(0, int(params.get('offset', ['0'])[0]))
+    if fmt != 'json' and 'limit' not in params:
+        limit = None
+    else:
+        limit = min(SEARCH_MAX_LIMIT, max(1, int(params.get('limit', [str(SEARCH_DEFAULT_LIMIT)])[0])))
+
+    # Every shard ranks its own top (offset + limit); the merged page is cut from those
+    count = None if limit is None else offset + limit
+    total, indexing, results = 0, False, []
+    for shard_total, shard_indexing, shard_results in _executor.map(
+            lambda shard: _search_shard(shard, query, count), _shards):
+        total += shard_total
+        indexing = indexing or shard_indexing
+        results.extend(shard_results)
+
+    results.sort(key=lambda doc: doc.get("score", 0), reverse=True)
+    page = results[offset:] if limit is None else results[offset:offset + limit]
+
+    if fmt in ('m3u8', 'hash'):
+        # Same layout as render_search_playlist, with entries on the owning shard
+        lines = ["#EXTM3U"]
+        for doc in page:
+            title = doc.get('title') or doc['path'].rsplit('/', 1)[-1].rsplit('.', 1)[0]
+            if doc.get('artist'):
+                title = f"{doc['artist']} - {title}"
+            lines.append(f"#EXTINF:-1,{title}")
+            lines.append(doc["stream"])
+        content = ('\n'.join(lines) + '\n').encode('utf-8')
+        if fmt == 'hash':
+            return 'text/plain', hashlib.md5(content).hexdigest().encode()
+        return 'application/x-mpegurl', content
+
+    return 'application/json', json.dumps({
+        "query": query, "total": total, "offset": offset, "limit": limit,
+        "indexing": indexing, "results": page}).encode()
+
+
+def _send(handler, status: int, content_type: str, body: bytes, send_body: bool, etag: str = None):
+    handler.send_response(status)
+    handler.send_header('Content-type', content_type)
+    handler.send_header('Content-Length', str(len(body)))
+    if etag:
+        handler.send_header('ETag', etag)
+    handler.end_headers()
+    if send_body:
+        handler.wfile.write(body)
+
+
+def handle_shard_request(handler, send_body: bool = True):
+    """Serve a GET/HEAD request for SyncHandler by merging shard responses."""
+    path = handler.path
+
+    try:
+        if path.startswith('/hash/'):
+            file_hash = merged_playlist_hash(path[6:])
+            if file_hash is None:
+                handler.send_error(404, f"Playlist '{path[6:]}' not found")
+                return
+            if handler.check_not_modified(f'"{file_hash}"'):
+                return
+            _send(handler, 200, 'text/plain', file_hash.encode(), send_body, f'"{file_hash}"')
+
+        elif path.startswith('/playlist/'):
+            name = path[10:]
+            parts = _collect("GET", f"/playlist/{name}")
+            if not parts:
+                handler.send_error(404, f"Playlist '{name}' not found")
+                return
+            # Shard hashes are the md5 of their playlists, so this matches /hash/{name}
+            etag = f'"{combined_hash([(shard, hashlib.md5(body).hexdigest().encode()) for shard, body in parts])}"'
+            if handler.check_not_modified(etag):
+                return
+            _send(handler, 200, 'application/x-mpegurl', merge_playlists(parts), send_body, etag)
+
+        elif path == '/list':
+            names = set()
+            for _, body in _collect("GET", "/list"):
+                names.update(json.loads(body))
+            _send(handler, 200, 'application/json', json.dumps(sorted(names)).encode(), send_body)
+
+        elif path == '/search' or path.startswith('/search?'):
+            content_type, body = merged_search(path)
+            _send(handler, 200, content_type, body, send_body)
+
+        else:
+            # Streams and artwork are addressed to shards directly; /changes sequences are per shard
+            handler.send_error(404, "Not available in shard aggregator mode")
+
+    except ShardUnavailable as e:
+        logger.error(f"Shard aggregator error for {path}: {e}")
+        handler.send_error(502, "Shard unavailable")
+    except ValueError as e:
+        handler.send_error(400, str(e))
+
+
+def handle_shard_post(handler):
+    """Fan POST /sync/{name} out to every shard and sum the results."""
+    if not handler.path.startswith('/sync/'):
+        handler.send_error(404, "POST endpoint not found")
+        return
+    name = handler.path[6:]
+
+    merged = {"playlist": name, "updated": False, "added_count": 0, "removed_count": 0,
+              "total": 0, "shards": {}}
+    found = False
+    for shard, status, body in fan_out("POST", handler.path):
+        if status == 200:
+            found = True
+            result = json.loads(body)
+            merged["updated"] = merged["updated"] or result.get("updated", False)
+            for key in ("added_count", "removed_count", "total"):
+                merged[key] += result.get(key, 0)
+            merged["shards"][shard["url"]] = "ok"
+        else:
+            merged["shards"][shard["url"]] = status or "unavailable"
+
+    if not found:
+        merged["error"] = f"No shard has a source for playlist '{name}'"
+    _send(handler, 200 if found else 404, 'application/json', json.dumps(merged).encode(), True)
@@ -0,0 +1,266 @@
+"""
+Smart Playlists for NSync Server
+Playlists defined as queries over the library index. Membership is kept up to
+date from index updates instead of rescanning, and every membership change is
+published on the change feed.
+
+Example source:
+  {"name": "new_jazz", "query": {"genre": "jazz", "year": ">=2000", "format": ["flac"], "added_days": 90}}
+"""
+
+import logging
+import threading
+import time
+from collections import deque
+from datetime import datetime
+from pathlib import Path
+from typing import Callable, Dict, List, Optional
+
+from generate_playlists import generate_playlist
+
+logger = logging.getLogger(__name__)
+
+CHANGE_FEED_MAX_EVENTS = 1000
+SMART_EXPIRE_INTERVAL = 60  # Seconds between checks for members aging out of added_days windows
+
+TEXT_FIELDS = ('title', 'artist', 'album', 'genre')
+
+
+class ChangeFeed:
+    """Bounded, sequence-numbered log of playlist changes with long-poll support."""
+
+    def __init__(self, max_events: int = CHANGE_FEED_MAX_EVENTS):
+        self._events = deque(maxlen=max_events)
+        self._seq = 0
+        self._cond = threading.Condition()
+
+    @property
+    def seq(self) -> int:
+        with self._cond:
+            return self._seq
+
+    def publish(self, playlist: str, added: List[str], removed: List[str], total: int) -> int:
+        with self._cond:
+            self._seq += 1
+            self._events.append({
+                "seq": self._seq,
+                "time": time.time(),
+                "playlist": playlist,
+                "added": added,
+                "removed": removed,
+                "total": total,
+            })
+            self._cond.notify_all()
+            return self._seq
+
+    def since(self, seq: int, wait: float = 0.0) -> Dict:
+        """Events after `seq`. Blocks up to `wait` seconds when there are none yet.
+
+        `truncated` is set when older events were dropped and the caller should
+        fall back to a full hash check.
+        """
+        with self._cond:
+            if wait > 0 and self._seq <= seq:
+                self._cond.wait_for(lambda: self._seq > seq, timeout=wait)
+            events = [e for e in self._events if e["seq"] > seq]
+            oldest = self._events[0]["seq"] if self._events else self._seq + 1
+            return {
+                "seq": self._seq,
+                "truncated": seq + 1 < oldest and seq < self._seq,
+                "events": events,
+            }
+
+
+_change_feed = ChangeFeed()
+
+
+def get_change_feed() -> ChangeFeed:
+    return _change_feed
+
+
+def _as_list(value) -> List[str]:
+    if value is None:
+        return []
+    if isinstance(value, (list, tuple)):
+        return [str(v).lower() for v in value]
+    return [str(value).lower()]
+
+
+def _parse_year_filter(spec) -> Optional[Callable[[int], bool]]:
+    """Accepts 1997, "1990-1999", ">=2000", "<1980" or a list of years."""
+    if spec is None:
+        return None
+    if isinstance(spec, (list, tuple)):
+        years = {int(y) for y in spec}
+        return lambda y: y in years
+    text = str(spec).strip()
+    for op, fn in (('>=', lambda a, b: a >= b), ('<=', lambda a, b: a <= b),
+                   ('>', lambda a, b: a > b), ('<', lambda a, b: a < b)):
+        if text.startswith(op):
+            bound = int(text[len(op):])
+            return lambda y, fn=fn, bound=bound: fn(y, bound)
+    if '-' in text:
+        lo, hi = text.split('-', 1)
+        return lambda y: int(lo) <= y <= int(hi)
+    exact = int(text)
+    return lambda y: y == exact
+
+
+class SmartQuery:
+    """Predicate over index documents built from a source's "query" object."""
+
+    def __init__(self, spec: Dict):
+        self.text = {f: _as_list(spec.get(f)) for f in TEXT_FIELDS if spec.get(f) is not None}
+        self.formats = set(f.lstrip('.') for f in _as_list(spec.get('format')))
+        self.paths = [str(p) for p in (spec.get('path') if isinstance(spec.get('path'), list)
+                                       else [spec['path']] if spec.get('path') else [])]
+        self.year = _parse_year_filter(spec.get('year'))
+        self.added_days = spec.get('added_days')
+        self.added_since = None
+        if spec.get('added_since'):
+            self.added_since = datetime.fromisoformat(str(spec['added_since'])).timestamp()
+
+    @property
+    def is_time_windowed(self) -> bool:
+        return bool(self.added_days)
+
+    def cutoff(self, now: float = None) -> Optional[float]:
+        cutoffs = []
+        if self.added_days:
+            cutoffs.append((now or time.time()) - float(self.added_days) * 24 * 60 * 60)
+        if self.added_since is not None:
+            cutoffs.append(self.added_since)
+        return max(cutoffs) if cutoffs else None
+
+    def matches(self, doc: Dict, now: float = None) -> bool:
+        for field, wanted in self.text.items():
+            value = str(doc.get(field, "")).lower()
+            if not any(w in value for w in wanted):
+                return False
+        if self.formats and doc.get('format', "") not in self.formats:
+            return False
+        if self.paths and not any(doc['path'].startswith(p) for p in self.paths):
+            return False
+        if self.year is not None:
+            try:
+                if not self.year(int(str(doc.get('year', ""))[:4])):
+                    return False
+            except ValueError:
+                return False
+        cutoff = self.cutoff(now)
+        if cutoff is not None and doc.get('mtime', 0) < cutoff:
+            return False
+        return True
+
+
+class SmartPlaylist:
+    """A query playlist whose membership follows index updates."""
+
+    def __init__(self, name: str, query: SmartQuery, output_dir: str, include_artwork: bool):
+        self.name = name
+        self.query = query
+        self.output_dir = output_dir
+        self.include_artwork = include_artwork
+        self._members = {}  # path -> mtime
+        self._lock = threading.Lock()
+
+    def __len__(self):
+        with self._lock:
+            return len(self._members)
+
+    def apply(self, added_docs: List[Dict], removed_docs: List[Dict]):
+        """Fold one index update into the membership and publish the difference."""
+        now = time.time()
+        added, removed = [], []
+        with self._lock:
+            for doc in removed_docs:
+                if self._members.pop(doc['path'], None) is not None:
+                    removed.append(doc['path'])
+            for doc in added_docs:
+                if self.query.matches(doc, now):
+                    if doc['path'] not in self._members:
+                        added.append(doc['path'])
+                    self._members[doc['path']] = doc.get('mtime', 0)
+            self._commit(added, removed)
+
+    def expire(self):
+        """Drop members that aged out of an added_days window."""
+        cutoff = self.query.cutoff()
+        if cutoff is None or not self.query.is_time_windowed:
+            return
+        with self._lock:
+            removed = [p for p, mtime in self._members.items() if mtime < cutoff]
+            for path in removed:
+                del self._members[path]
+            self._commit([], removed)
+
+    def _commit(self, added: List[str], removed: List[str]):
+        # A file re-added by an update (removed + added) is not a membership change
+        readded = set(added) & set(removed)
+        added = [p for p in added if p not in readded]
+        removed = [p for p in removed if p not in readded]
+        if not added and not removed and not readded:
+            return
+
+        if self.query.cutoff() is not None:
+            files = sorted(self._members, key=lambda p: self._members[p], reverse=True)
+        else:
+            files = sorted(self._members)
+        generate_playlist(self.name, files, self.output_dir, self.include_artwork)
+
+        if added or removed:
+            get_change_feed().publish(self.name, added, removed, len(files))
+            logger.info(f"Smart playlist '{self.name}': +{len(added)} -{len(removed)} ({len(files)} total)")
+
+
+_smart_playlists = {}
+
+
+def get_smart_playlist(name: str) -> Optional[SmartPlaylist]:
+    return _smart_playlists.get(name)
+
+
+def start_smart_playlists(index, generator_config: Dict, default_output_dir: str) -> List[SmartPlaylist]:
+    """Create smart playlists for every source with a "query" and attach them to the index."""
+    output_dir = generator_config.get("playlist_dir", default_output_dir)
+    include_artwork = generator_config.get("include_artwork", True)
+
+    created = []
+    for source in generator_config.get("sources", []):
+        if not source.get("name") or not isinstance(source.get("query"), dict):
+            continue
+        try:
+            playlist = SmartPlaylist(source["name"], SmartQuery(source["query"]), output_dir, include_artwork)
+        except (ValueError, KeyError, TypeError) as e:
+            logger.error(f"Invalid query for smart playlist '{source['name']}': {e}")
+            continue
+        _smart_playlists[playlist.name] = playlist
+        created.append(playlist)
+
+    if not created:
+        return created
+
+    for playlist in created:
+        index.add_listener(playlist.apply)
+        # Seed from whatever is already indexed; later updates arrive via the listener
+        existing = index.documents()
+        if existing:
+            playlist.apply(existing, [])
+        # A query that matches nothing yet is still a playlist clients can sync
+        if not (Path(output_dir) / f"{playlist.name}.m3u8").exists():
+            generate_playlist(playlist.name, [], output_dir, include_artwork)
+
+    def expire_loop():
+        while True:
+            time.sleep(SMART_EXPIRE_INTERVAL)
+            for playlist in created:
+                try:
+                    playlist.expire()
+                except Exception as e:
+                    logger.error(f"Smart playlist expiry failed for '{playlist.name}': {e}")
+
+    if any(p.query.is_time_windowed for p in created):
+        threading.Thread(target=expire_loop, name="smart-playlist-expiry", daemon=True).start()
+
+    logger.info(f"Smart playlists: {', '.join(p.name for p in created)}")
+    return created
@@ -0,0 +1,139 @@
+"""
+Tests for edge proxy revalidation of cached objects against a local origin.
+
+    cd server && python -m unittest test_edge_proxy
+"""
+
+import hashlib
+import shutil
+import tempfile
+import threading
+import unittest
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import edge_proxy
+
+PLAYLIST = "/playlist/jazz"
+
+
+class Origin:
+    """Objects served by the fake origin, and the requests it has seen."""
+    objects = {}
+    requests = []
+
+
+class OriginHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        Origin.requests.append((self.path, self.headers.get("If-None-Match")))
+        body = Origin.objects.get(self.path)
+        if body is None:
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        etag = '"' + hashlib.md5(body).hexdigest() + '"'
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "application/x-mpegurl")
+        self.send_header("ETag", etag)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class RevalidationTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.origin = ThreadingHTTPServer(("127.0.0.1", 0), OriginHandler)
+        threading.Thread(target=cls.origin.serve_forever, daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.origin.shutdown()
+        cls.origin.server_close()
+
+    def setUp(self):
+        self.cache_dir = tempfile.mkdtemp(prefix="nsync_edge_")
+        edge_proxy.init_edge_proxy(f"http://127.0.0.1:{self.origin.server_address[1]}", self.cache_dir)
+        Origin.objects = {PLAYLIST: b"#EXTM3U\n/music/a.flac\n"}
+        Origin.requests = []
+
+    def tearDown(self):
+        # The origin client keeps one connection per thread; the next test makes a new client
+        conn = getattr(edge_proxy._origin._local, "conn", None)
+        if conn is not None:
+            conn.close()
+        shutil.rmtree(self.cache_dir, ignore_errors=True)
+
+    def expire(self):
+        """Let the cached copy's freshness window pass."""
+        key = edge_proxy.EdgeCache.key_for(PLAYLIST)
+        meta = edge_proxy._cache.read_meta(key)
+        meta["validated_at"] = 0
+        edge_proxy._cache.write_meta(key, meta)
+
+    def test_fresh_copy_is_served_without_asking_the_origin(self):
+        self.assertEqual(edge_proxy.fetch_object(PLAYLIST)[0], 200)
+        status, headers, body = edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual((status, body), (200, Origin.objects[PLAYLIST]))
+        self.assertIn("etag", headers)
+        self.assertEqual(len(Origin.requests), 1)
+
+    def test_stale_copy_is_revalidated_with_its_etag(self):
+        _, headers, _ = edge_proxy.fetch_object(PLAYLIST)
+        self.expire()
+        status, _, body = edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual((status, body), (200, Origin.objects[PLAYLIST]))
+        self.assertEqual(Origin.requests[-1], (PLAYLIST, headers["etag"]))
+        # A 304 makes the copy fresh again
+        edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual(len(Origin.requests), 2)
+
+    def test_changed_origin_replaces_the_body(self):
+        edge_proxy.fetch_object(PLAYLIST)
+        Origin.objects[PLAYLIST] = b"#EXTM3U\n/music/b.flac\n"
+        self.expire()
+        _, _, body = edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual(body, Origin.objects[PLAYLIST])
+        key = edge_proxy.EdgeCache.key_for(PLAYLIST)
+        self.assertEqual((edge_proxy._cache.entry_dir(key) / "body").read_bytes(), Origin.objects[PLAYLIST])
+
+    def test_invalidated_playlist_is_revalidated(self):
+        edge_proxy.fetch_object(PLAYLIST)
+        edge_proxy.invalidate_playlist("jazz")
+        edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual(len(Origin.requests), 2)
+
+    def test_deleted_on_origin_drops_the_copy(self):
+        edge_proxy.fetch_object(PLAYLIST)
+        del Origin.objects[PLAYLIST]
+        self.expire()
+        self.assertEqual(edge_proxy.fetch_object(PLAYLIST)[0], 404)
+        self.assertIsNone(edge_proxy._cache.read_meta(edge_proxy.EdgeCache.key_for(PLAYLIST)))
+
+    def test_missing_objects_are_not_cached(self):
+        self.assertEqual(edge_proxy.fetch_object("/playlist/none")[0], 404)
+        self.assertEqual(edge_proxy.fetch_object("/playlist/none")[0], 404)
+        self.assertEqual(len(Origin.requests), 2)
+
+    def test_lost_body_is_fetched_again(self):
+        edge_proxy.fetch_object(PLAYLIST)
+        key = edge_proxy.EdgeCache.key_for(PLAYLIST)
+        (edge_proxy._cache.entry_dir(key) / "body").unlink()
+        self.expire()
+        _, _, body = edge_proxy.fetch_object(PLAYLIST)
+        self.assertEqual(body, Origin.objects[PLAYLIST])
+        self.assertIsNone(Origin.requests[-1][1])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,127 @@
+"""
+Tests for the library search index: tokenizing, prefix search, ranking and
+the added/removed documents reported to index listeners.
+
+    cd server && python -m unittest test_library_index
+"""
+
+import os
+import shutil
+import tempfile
+import time
+import unittest
+from pathlib import Path
+
+from library_index import LibraryIndex, tokenize
+
+
+def make_track(root: str, artist: str, album: str, name: str) -> str:
+    """An audio file laid out as Artist/Album/NN - Title.ext, which is where its tags come from."""
+    path = Path(root, artist, album, name)
+    path.parent.mkdir(parents=True, exist_ok=True)
+    path.write_bytes(b"not really audio")
+    return str(path)
+
+
+class TokenizeTest(unittest.TestCase):
+    def test_lower_cases_and_splits_on_punctuation(self):
+        self.assertEqual(tokenize("So What (Live, 1959)"), ["so", "what", "live", "1959"])
+
+    def test_folds_accents(self):
+        self.assertEqual(tokenize("Björk Café"), ["bjork", "cafe"])
+
+    def test_empty(self):
+        self.assertEqual(tokenize(""), [])
+        self.assertEqual(tokenize(None), [])
+
+
+class SearchTest(unittest.TestCase):
+    def setUp(self):
+        self.root = tempfile.mkdtemp(prefix="nsync_index_")
+        self.blue_in_green = make_track(self.root, "Miles Davis", "Kind of Blue (1959)", "03 - Blue in Green.flac")
+        self.so_what = make_track(self.root, "Miles Davis", "Kind of Blue (1959)", "01 - So What.flac")
+        self.blue_note = make_track(self.root, "Blue Note Quintet", "Sessions (2001)", "01 - Opener.mp3")
+        self.index = LibraryIndex()
+        self.index.refresh([{"path": self.root}])
+
+    def tearDown(self):
+        shutil.rmtree(self.root, ignore_errors=True)
+
+    def paths(self, query, **kwargs):
+        return [doc['path'] for doc in self.index.search(query, **kwargs)[1]]
+
+    def test_every_word_must_match(self):
+        self.assertEqual(self.paths("miles green"), [self.blue_in_green])
+        self.assertEqual(self.paths("miles opener"), [])
+
+    def test_last_word_matches_as_prefix(self):
+        self.assertEqual(sorted(self.paths("miles ki")), sorted([self.blue_in_green, self.so_what]))
+        # Only the last word is a prefix
+        self.assertEqual(self.paths("mil davis"), [])
+
+    def test_title_match_ranks_above_artist_match(self):
+        results = self.paths("blue")
+        self.assertEqual(results[0], self.blue_in_green)
+        self.assertIn(self.blue_note, results)
+
+    def test_total_and_paging(self):
+        total, first = self.index.search("blue", offset=0, limit=1)
+        self.assertEqual(total, 3)
+        self.assertEqual(len(first), 1)
+        _, rest = self.index.search("blue", offset=1, limit=None)
+        self.assertEqual(len(rest), 2)
+        self.assertNotIn(first[0]['path'], [doc['path'] for doc in rest])
+
+    def test_results_carry_a_score(self):
+        _, results = self.index.search("so what")
+        self.assertGreater(results[0]['score'], 0)
+
+
+class ApplyChangesTest(unittest.TestCase):
+    def setUp(self):
+        self.root = tempfile.mkdtemp(prefix="nsync_index_")
+        self.track = make_track(self.root, "Artist", "Album", "01 - Song.mp3")
+        self.index = LibraryIndex()
+        self.index.refresh([{"path": self.root}])
+        self.updates = []
+        self.index.add_listener(lambda added, removed: self.updates.append(
+            ([d['path'] for d in added], [d['path'] for d in removed])))
+
+    def tearDown(self):
+        shutil.rmtree(self.root, ignore_errors=True)
+
+    def test_new_file_is_reported_as_added(self):
+        other = make_track(self.root, "Artist", "Album", "02 - Other.mp3")
+        self.index.apply_changes([other], [])
+        self.assertEqual(self.updates, [([other], [])])
+        self.assertEqual(len(self.index), 2)
+
+    def test_deleted_file_is_reported_as_removed(self):
+        self.index.apply_changes([], [self.track])
+        self.assertEqual(self.updates, [([], [self.track])])
+        self.assertEqual(self.index.search("song"), (0, []))
+
+    def test_readded_file_is_reported_as_removed_and_added(self):
+        # Listeners must see the old version go, or they keep matching on stale tags
+        self.index.apply_changes([self.track], [])
+        self.assertEqual(self.updates, [([self.track], [self.track])])
+        self.assertEqual(len(self.index), 1)
+        self.assertEqual(self.index.search("song")[0], 1)
+
+    def test_refresh_picks_up_changed_mtime(self):
+        later = time.time() + 10
+        os.utime(self.track, (later, later))
+        self.assertEqual(self.index.refresh([{"path": self.root}]), (1, 0))
+        self.assertEqual(self.updates, [([self.track], [self.track])])
+
+    def test_unchanged_refresh_notifies_nobody(self):
+        self.assertEqual(self.index.refresh([{"path": self.root}]), (0, 0))
+        self.assertEqual(self.updates, [])
+
+    def test_unknown_removed_path_is_ignored(self):
+        self.index.apply_changes([], [str(Path(self.root, "missing.mp3"))])
+        self.assertEqual(self.updates, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,159 @@
+"""
+Tests for smart playlist queries, membership updates and the /changes feed.
+
+    cd server && python -m unittest test_smart_playlists
+"""
+
+import http.client
+import json
+import shutil
+import tempfile
+import threading
+import time
+import unittest
+from pathlib import Path
+
+from smart_playlists import ChangeFeed, SmartPlaylist, SmartQuery, get_change_feed
+
+
+def doc(path, **tags):
+    return dict({"path": path, "title": "", "artist": "", "album": "", "genre": "",
+                 "year": "", "format": path.rsplit('.', 1)[-1], "mtime": time.time()}, **tags)
+
+
+class SmartQueryTest(unittest.TestCase):
+    def test_text_fields_match_any_listed_value_case_insensitively(self):
+        query = SmartQuery({"genre": ["jazz", "blues"]})
+        self.assertTrue(query.matches(doc("/m/a.flac", genre="Modal Jazz")))
+        self.assertTrue(query.matches(doc("/m/b.flac", genre="Blues")))
+        self.assertFalse(query.matches(doc("/m/c.flac", genre="Rock")))
+
+    def test_all_fields_must_match(self):
+        query = SmartQuery({"genre": "jazz", "format": ["flac"]})
+        self.assertTrue(query.matches(doc("/m/a.flac", genre="jazz")))
+        self.assertFalse(query.matches(doc("/m/a.mp3", genre="jazz")))
+
+    def test_year_filters(self):
+        self.assertTrue(SmartQuery({"year": ">=2000"}).matches(doc("/m/a.flac", year="2004")))
+        self.assertFalse(SmartQuery({"year": ">=2000"}).matches(doc("/m/a.flac", year="1999")))
+        self.assertTrue(SmartQuery({"year": "1990-1999"}).matches(doc("/m/a.flac", year="1995-03-01")))
+        self.assertTrue(SmartQuery({"year": [1959, 1961]}).matches(doc("/m/a.flac", year="1959")))
+        self.assertFalse(SmartQuery({"year": 1997}).matches(doc("/m/a.flac", year="")))
+
+    def test_path_prefixes(self):
+        query = SmartQuery({"path": ["/music/jazz", "/music/blues"]})
+        self.assertTrue(query.matches(doc("/music/blues/a.flac")))
+        self.assertFalse(query.matches(doc("/music/rock/a.flac")))
+
+    def test_added_days_window(self):
+        query = SmartQuery({"added_days": 30})
+        now = time.time()
+        self.assertTrue(query.matches(doc("/m/new.flac", mtime=now - 24 * 60 * 60), now))
+        self.assertFalse(query.matches(doc("/m/old.flac", mtime=now - 60 * 24 * 60 * 60), now))
+
+
+class ChangeFeedTest(unittest.TestCase):
+    def test_events_after_a_sequence_number(self):
+        feed = ChangeFeed()
+        first = feed.publish("jazz", ["/a"], [], 1)
+        feed.publish("jazz", [], ["/a"], 0)
+        result = feed.since(first)
+        self.assertEqual(result["seq"], first + 1)
+        self.assertFalse(result["truncated"])
+        self.assertEqual([e["removed"] for e in result["events"]], [["/a"]])
+
+    def test_caught_up_reader_gets_nothing(self):
+        feed = ChangeFeed()
+        seq = feed.publish("jazz", ["/a"], [], 1)
+        self.assertEqual(feed.since(seq), {"seq": seq, "truncated": False, "events": []})
+
+    def test_dropped_events_mark_the_result_truncated(self):
+        feed = ChangeFeed(max_events=2)
+        for i in range(4):
+            feed.publish("jazz", [f"/{i}"], [], i + 1)
+        result = feed.since(0)
+        self.assertTrue(result["truncated"])
+        self.assertEqual([e["seq"] for e in result["events"]], [3, 4])
+        self.assertFalse(feed.since(2)["truncated"])
+
+    def test_wait_returns_as_soon_as_an_event_arrives(self):
+        feed = ChangeFeed()
+        threading.Timer(0.1, feed.publish, ("jazz", ["/a"], [], 1)).start()
+        started = time.monotonic()
+        result = feed.since(0, wait=5)
+        self.assertLess(time.monotonic() - started, 4)
+        self.assertEqual(len(result["events"]), 1)
+
+
+class SmartPlaylistTest(unittest.TestCase):
+    def setUp(self):
+        self.output_dir = tempfile.mkdtemp(prefix="nsync_smart_")
+        self.playlist = SmartPlaylist("jazz", SmartQuery({"genre": "jazz"}), self.output_dir, False)
+
+    def tearDown(self):
+        shutil.rmtree(self.output_dir, ignore_errors=True)
+
+    def events_after(self, seq):
+        return [e for e in get_change_feed().since(seq)["events"] if e["playlist"] == "jazz"]
+
+    def test_matching_documents_join_and_are_published(self):
+        seq = get_change_feed().seq
+        self.playlist.apply([doc("/m/a.flac", genre="jazz"), doc("/m/b.flac", genre="rock")], [])
+        self.assertEqual(len(self.playlist), 1)
+        events = self.events_after(seq)
+        self.assertEqual([(e["added"], e["removed"], e["total"]) for e in events], [(["/m/a.flac"], [], 1)])
+        self.assertIn("/m/a.flac", Path(self.output_dir, "jazz.m3u8").read_text(encoding="utf-8"))
+
+    def test_retag_out_of_the_query_removes_the_member(self):
+        self.playlist.apply([doc("/m/a.flac", genre="jazz")], [])
+        seq = get_change_feed().seq
+        # The index reports a retagged file as its old version removed and the new one added
+        self.playlist.apply([doc("/m/a.flac", genre="rock")], [doc("/m/a.flac", genre="jazz")])
+        self.assertEqual(len(self.playlist), 0)
+        events = self.events_after(seq)
+        self.assertEqual([(e["added"], e["removed"]) for e in events], [([], ["/m/a.flac"])])
+
+    def test_retag_within_the_query_is_not_a_membership_change(self):
+        self.playlist.apply([doc("/m/a.flac", genre="jazz")], [])
+        seq = get_change_feed().seq
+        self.playlist.apply([doc("/m/a.flac", genre="jazz", title="New")], [doc("/m/a.flac", genre="jazz")])
+        self.assertEqual(len(self.playlist), 1)
+        self.assertEqual(self.events_after(seq), [])
+
+
+class ChangesEndpointTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        import main
+        cls.httpd = main.ThreadingHTTPServer(("127.0.0.1", 0), main.SyncHandler)
+        threading.Thread(target=cls.httpd.serve_forever, daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.httpd.shutdown()
+        cls.httpd.server_close()
+
+    def get(self, path: str):
+        conn = http.client.HTTPConnection("127.0.0.1", self.httpd.server_address[1], timeout=10)
+        try:
+            conn.request("GET", path)
+            resp = conn.getresponse()
+            return resp.status, resp.read().decode("utf-8")
+        finally:
+            conn.close()
+
+    def test_changes_since(self):
+        seq = get_change_feed().publish("endpoint_test", ["/m/a.flac"], [], 1)
+        status, body = self.get(f"/changes?since={seq - 1}")
+        self.assertEqual(status, 200)
+        result = json.loads(body)
+        self.assertEqual(result["seq"], seq)
+        self.assertEqual([e["playlist"] for e in result["events"]], ["endpoint_test"])
+
+    def test_invalid_since(self):
+        status, _ = self.get("/changes?since=abc")
+        self.assertEqual(status, 400)
+
+
+if __name__ == "__main__":
+    unittest.main()
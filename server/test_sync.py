@@ -0,0 +1,97 @@
+"""
+Server tests for POST /sync and /sync-batch.
+
+    cd server && python -m unittest test_sync
+"""
+
+import http.client
+import json
+import os
+import shutil
+import tempfile
+import threading
+import unittest
+from pathlib import Path
+from unittest import mock
+
+# The server modules read their directories from the environment at import
+_WORK = tempfile.mkdtemp(prefix="nsync_test_")
+os.environ["CONFIG_DIR"] = _WORK
+os.environ["PLAYLIST_DIR"] = _WORK
+
+import generate_playlists  # noqa: E402
+import main  # noqa: E402
+from smart_playlists import start_smart_playlists  # noqa: E402
+
+SMART_NAME = "empty_smart"
+
+
+class EmptyIndex:
+    """Index with nothing in it, so the smart playlist matches no files."""
+
+    def add_listener(self, listener):
+        pass
+
+    def documents(self):
+        return []
+
+
+class SmartSyncTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        config = {"playlist_dir": _WORK, "sources": [{"name": SMART_NAME, "query": {"genre": "no such genre"}}]}
+        Path(_WORK, "config.json").write_text(json.dumps(config), encoding="utf-8")
+        # Another test module may have imported the generator before the environment was set
+        cls.config_dir = mock.patch.object(generate_playlists, "CONFIG_DIR", _WORK)
+        cls.config_dir.start()
+        start_smart_playlists(EmptyIndex(), config, _WORK)
+
+        cls.httpd = main.ThreadingHTTPServer(("127.0.0.1", 0), main.SyncHandler)
+        threading.Thread(target=cls.httpd.serve_forever, daemon=True).start()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.httpd.shutdown()
+        cls.httpd.server_close()
+        cls.config_dir.stop()
+        shutil.rmtree(_WORK, ignore_errors=True)
+
+    def post(self, path: str):
+        conn = http.client.HTTPConnection("127.0.0.1", self.httpd.server_address[1], timeout=10)
+        try:
+            conn.request("POST", path)
+            resp = conn.getresponse()
+            return resp.status, resp.read().decode("utf-8")
+        finally:
+            conn.close()
+
+    def test_sync_empty_smart_playlist(self):
+        status, body = self.post(f"/sync/{SMART_NAME}")
+        self.assertEqual(status, 200)
+        result = json.loads(body)
+        self.assertTrue(result["smart"])
+        self.assertEqual(result["total"], 0)
+
+    def test_sync_batch_empty_smart_playlist(self):
+        status, body = self.post(f"/sync-batch?name={SMART_NAME}")
+        self.assertEqual(status, 200)
+        name, file_hash, error = body.rstrip("\n").split("\t")
+        self.assertEqual(name, SMART_NAME)
+        self.assertNotEqual(file_hash, "")
+        self.assertEqual(error, "")
+
+    def test_sync_batch_streams_a_line_per_playlist(self):
+        status, body = self.post(f"/sync-batch?name={SMART_NAME}&name=not_configured")
+        self.assertEqual(status, 200)
+        lines = [line.split("\t") for line in body.splitlines()]
+        self.assertEqual([line[0] for line in lines], [SMART_NAME, "not_configured"])
+        self.assertEqual(lines[1][1], "")
+        self.assertIn("No source configured", lines[1][2])
+
+    def test_sync_unknown_smart_playlist(self):
+        status, _ = self.post("/sync/not_configured")
+        self.assertEqual(status, 404)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -1,21 +1,64 @@
 #include "stdafx.h"
 #include "artwork_extractor.h"
+#include "artwork_trace.h"
+#include "diagnostics.h"
 #include "guids.h"
+#include "memory_budget.h"
+#include "sync_trace.h"
 #include <set>
 #include <map>
 #include <mutex>
 #include <list>
+#include <algorithm>
 
 // Simple cache to avoid repeated failed requests
 static std::set<pfc::string8> g_failed_urls;
+static size_t g_failed_urls_bytes = 0;
 static std::mutex g_failed_urls_mutex;
 
 // LRU cache for successful artwork fetches (persists across track changes)
 static const size_t ARTWORK_CACHE_MAX_SIZE = 100;
 static std::map<pfc::string8, album_art_data_ptr> g_artwork_cache;
 static std::list<pfc::string8> g_artwork_lru;  // Front = most recent
+static size_t g_artwork_cache_bytes = 0;
 static std::mutex g_artwork_cache_mutex;
 
+// Memory budget registrations (see memory_budget), made when the caches are first used
+static size_t g_artwork_budget_id = 0;
+static size_t g_failed_urls_budget_id = 0;
+static std::once_flag g_budget_registered;
+
+static size_t trim_artwork_cache(size_t bytes);
+static size_t trim_failed_urls(size_t bytes);
+
+static void register_with_budget() {
+    std::call_once(g_budget_registered, []() {
+        g_artwork_budget_id = memory_budget::get().add("Artwork cache", memory_budget::trim_artwork_cache,
+            []() { std::lock_guard<std::mutex> lock(g_artwork_cache_mutex); return g_artwork_cache_bytes; },
+            trim_artwork_cache);
+        g_failed_urls_budget_id = memory_budget::get().add("Artwork known missing", memory_budget::trim_known_missing,
+            []() { std::lock_guard<std::mutex> lock(g_failed_urls_mutex); return g_failed_urls_bytes; },
+            trim_failed_urls);
+    });
+}
+
+// Approximate heap use of a cached URL: its text plus the container node
+static size_t url_entry_bytes(const pfc::string8& url) {
+    return url.length() + 1 + 4 * sizeof(void*) + sizeof(pfc::string8);
+}
+
+// Caller holds g_artwork_cache_mutex
+static size_t evict_oldest_artwork() {
+    pfc::string8 oldest = g_artwork_lru.back();
+    g_artwork_lru.pop_back();
+    auto it = g_artwork_cache.find(oldest);
+    if (it == g_artwork_cache.end()) return 0;
+    size_t freed = it->second->get_size() + 2 * url_entry_bytes(oldest);
+    g_artwork_cache.erase(it);
+    g_artwork_cache_bytes -= std::min(freed, g_artwork_cache_bytes);
+    return freed;
+}
+
 static album_art_data_ptr get_cached_artwork(const char* artwork_url) {
     std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
     auto it = g_artwork_cache.find(pfc::string8(artwork_url));
@@ -29,17 +72,38 @@ static album_art_data_ptr get_cached_artwork(const char* artwork_url) {
 }
 
 static void cache_artwork(const char* artwork_url, album_art_data_ptr art) {
-    std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
+    register_with_budget();
+    {
+        std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
+        pfc::string8 url(artwork_url);
+
+        // Replacing an entry (a concurrent fetch of the same URL) - drop the old one first
+        if (g_artwork_cache.count(url) != 0) {
+            g_artwork_lru.remove(url);
+            g_artwork_lru.push_back(url);
+            evict_oldest_artwork();
+        }
+
+        // Evict oldest if at capacity
+        while (g_artwork_cache.size() >= ARTWORK_CACHE_MAX_SIZE && !g_artwork_lru.empty()) {
+            evict_oldest_artwork();
+        }
 
-    // Evict oldest if at capacity
-    while (g_artwork_cache.size() >= ARTWORK_CACHE_MAX_SIZE && !g_artwork_lru.empty()) {
-        pfc::string8 oldest = g_artwork_lru.back();
-        g_artwork_lru.pop_back();
-        g_artwork_cache.erase(oldest);
+        g_artwork_cache[url] = art;
+        g_artwork_lru.push_front(url);
+        g_artwork_cache_bytes += art->get_size() + 2 * url_entry_bytes(url);
     }
+    memory_budget::get().enforce();
+}
 
-    g_artwork_cache[pfc::string8(artwork_url)] = art;
-    g_artwork_lru.push_front(pfc::string8(artwork_url));
+// Least recently used images go first
+static size_t trim_artwork_cache(size_t bytes) {
+    std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
+    size_t freed = 0;
+    while (freed < bytes && !g_artwork_lru.empty()) {
+        freed += evict_oldest_artwork();
+    }
+    return freed;
 }
 
 static bool is_url_failed(const char* url) {
@@ -48,12 +112,45 @@ static bool is_url_failed(const char* url) {
 }
 
 static void mark_url_failed(const char* url) {
+    register_with_budget();
+    {
+        std::lock_guard<std::mutex> lock(g_failed_urls_mutex);
+        // Limit cache size to prevent memory bloat
+        if (g_failed_urls.size() > 1000) {
+            g_failed_urls.clear();
+            g_failed_urls_bytes = 0;
+        }
+        auto inserted = g_failed_urls.insert(pfc::string8(url));
+        if (inserted.second) {
+            g_failed_urls_bytes += url_entry_bytes(*inserted.first);
+        }
+    }
+    memory_budget::get().enforce();
+}
+
+// The set has no recency order, so it is dropped as a whole
+static size_t trim_failed_urls(size_t) {
     std::lock_guard<std::mutex> lock(g_failed_urls_mutex);
-    // Limit cache size to prevent memory bloat
-    if (g_failed_urls.size() > 1000) {
-        g_failed_urls.clear();
+    size_t freed = g_failed_urls_bytes;
+    g_failed_urls.clear();
+    g_failed_urls_bytes = 0;
+    return freed;
+}
+
+artwork_cache_stats get_artwork_cache_stats() {
+    artwork_cache_stats stats;
+    {
+        std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
+        stats.entries = g_artwork_cache.size();
+        for (const auto& entry : g_artwork_cache) {
+            stats.bytes += entry.second->get_size();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_failed_urls_mutex);
+        stats.known_missing = g_failed_urls.size();
     }
-    g_failed_urls.insert(pfc::string8(url));
+    return stats;
 }
 
 // Cleanup on quit
@@ -61,14 +158,20 @@ class nsync_artwork_initquit : public initquit {
 public:
     void on_init() override {}
     void on_quit() override {
+        if (g_artwork_budget_id != 0) {
+            memory_budget::get().remove(g_artwork_budget_id);
+            memory_budget::get().remove(g_failed_urls_budget_id);
+        }
         {
             std::lock_guard<std::mutex> lock(g_failed_urls_mutex);
             g_failed_urls.clear();
+            g_failed_urls_bytes = 0;
         }
         {
             std::lock_guard<std::mutex> lock(g_artwork_cache_mutex);
             g_artwork_cache.clear();
             g_artwork_lru.clear();
+            g_artwork_cache_bytes = 0;
         }
     }
 };
@@ -132,15 +235,32 @@ album_art_data_ptr nsync_artwork_extractor_instance::query(const GUID& p_what, a
 
     m_cache_checked = true;
 
+    sync_trace::scope trace("artwork query", "artwork");
+    if (sync_trace::get().enabled()) {
+        sync_trace::add_arg(trace.args, "url", m_artwork_url.c_str());
+    }
+    trace.result = "failed";
+    const uint64_t started = artwork_trace::get().enabled() ? sync_trace::now_us() : 0;
+    auto record_access = [&](artwork_trace::result what, size_t bytes) {
+        if (started != 0) {
+            artwork_trace::get().record(m_artwork_url.c_str(), bytes, what, sync_trace::now_us() - started);
+        }
+    };
+
     // Check global cache first (fast path - no HTTP request needed)
     album_art_data_ptr cached = get_cached_artwork(m_artwork_url.c_str());
+    diagnostics::get().record_artwork_lookup(cached.is_valid());
     if (cached.is_valid()) {
+        trace.result = "memory cache";
+        record_access(artwork_trace::result::hit, cached->get_size());
         m_cached_art = cached;
         return m_cached_art;
     }
 
     // Check if this URL previously failed (avoid repeated timeouts)
     if (is_url_failed(m_artwork_url.c_str())) {
+        trace.result = "known missing";
+        record_access(artwork_trace::result::missing, 0);
         throw exception_album_art_not_found();
     }
 
@@ -148,16 +268,36 @@ album_art_data_ptr nsync_artwork_extractor_instance::query(const GUID& p_what, a
     pfc::array_t<uint8_t> image_data;
     pfc::string8 error;
 
-    if (!nsync_http_client::get().get_binary_sync(m_artwork_url.c_str(), image_data, error)) {
-        mark_url_failed(m_artwork_url.c_str());
+    if (!nsync_http_client::get().get_binary_sync(m_artwork_url.c_str(), image_data, error,
+            request_priority::interactive, p_abort)) {
+        // Cancelled (the user moved on) is not a failure of this URL
+        p_abort.check();
+        record_access(artwork_trace::result::failed, 0);
+        // Only a definite answer (404 or an empty body) is remembered. An open
+        // circuit, a timeout or a reset says nothing about this album, so it
+        // is asked again once the server is back
+        if (error.is_empty() || error == "HTTP 404") {
+            mark_url_failed(m_artwork_url.c_str());
+        }
         throw exception_album_art_not_found();
     }
 
     if (image_data.get_size() == 0) {
+        record_access(artwork_trace::result::failed, 0);
         mark_url_failed(m_artwork_url.c_str());
         throw exception_album_art_not_found();
     }
 
+    trace.result = "fetched";
+    record_access(artwork_trace::result::miss, image_data.get_size());
+
+    // Callers that shared this fetch may already have cached the same image
+    cached = get_cached_artwork(m_artwork_url.c_str());
+    if (cached.is_valid()) {
+        m_cached_art = cached;
+        return m_cached_art;
+    }
+
     // Create album art data from the fetched image
     m_cached_art = album_art_data_impl::g_create(image_data.get_ptr(), image_data.get_size());
 
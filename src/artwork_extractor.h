@@ -11,6 +11,14 @@ bool is_nsync_stream_url(const char* path);
 // Helper function to transform stream URL to artwork URL
 pfc::string8 stream_url_to_artwork_url(const char* stream_url);
 
+// Current size of the artwork memory cache and of the failed-URL list
+struct artwork_cache_stats {
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t known_missing = 0;
+};
+artwork_cache_stats get_artwork_cache_stats();
+
 // Album art extractor instance for nsync HTTP streams
 // Fetches artwork from the server's /artwork/ endpoint
 class nsync_artwork_extractor_instance : public album_art_extractor_instance_v2 {
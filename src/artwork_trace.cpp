@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "artwork_trace.h"
+#include "config.h"
+#include "sync_trace.h"
+
+namespace {
+    const char* const trace_file_name = "foo_nsync_artwork_trace.tsv";
+
+    // FNV-1a, 64 bit: stable across runs and builds
+    uint64_t hash_bytes(const char* data, size_t length) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < length; ++i) {
+            hash ^= (unsigned char)data[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+}
+
+artwork_trace& artwork_trace::get() {
+    static artwork_trace instance;
+    return instance;
+}
+
+void artwork_trace::record(const char* artwork_url, size_t bytes, result what, uint64_t latency_us) {
+    if (!enabled()) return;
+
+    // Tracks of one album share their folder's art on the server
+    size_t url_length = strlen(artwork_url);
+    const char* last_slash = strrchr(artwork_url, '/');
+    size_t dir_length = last_slash ? (size_t)(last_slash - artwork_url) : url_length;
+
+    char line[128];
+    sprintf_s(line, "%llu\t%016llx\t%016llx\t%llu\t%c\t%llu\n",
+        (unsigned long long)((sync_trace::now_us() - m_started_us) / 1000),
+        (unsigned long long)hash_bytes(artwork_url, url_length),
+        (unsigned long long)hash_bytes(artwork_url, dir_length),
+        (unsigned long long)bytes, (char)what, (unsigned long long)latency_us);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file) fputs(line, m_file);
+}
+
+void artwork_trace::tick() {
+    bool want = sync_config::get().is_artwork_trace_enabled();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (want && !m_file) {
+        open();
+    } else if (!want && m_file) {
+        close();
+    } else if (m_file) {
+        fflush(m_file);
+    }
+}
+
+void artwork_trace::shutdown() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    close();
+}
+
+void artwork_trace::open() {
+    pfc::string8 native_path;
+    if (!extract_native_path(core_api::get_profile_path(), native_path)) return;
+    native_path.add_filename(trace_file_name);
+
+    // Appends, so a trace can build up over several sessions
+    if (_wfopen_s(&m_file, pfc::stringcvt::string_wide_from_utf8(native_path.c_str()), L"ab") != 0) {
+        m_file = nullptr;
+        console::formatter() << "foo_nsync: Could not open artwork trace file " << native_path;
+        return;
+    }
+
+    fputs("# foo_nsync artwork trace 1: time_ms key dir bytes result(H/M/N/F) latency_us\n", m_file);
+    m_started_us = sync_trace::now_us();
+    m_enabled = true;
+    console::formatter() << "foo_nsync: Recording artwork cache accesses to " << native_path;
+}
+
+void artwork_trace::close() {
+    m_enabled = false;
+    if (!m_file) return;
+    fclose(m_file);
+    m_file = nullptr;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+// Opt-in log of artwork cache accesses (Advanced > Tools > Playlist Sync), for
+// replaying real listening patterns against other cache policies with
+// bench/artwork_cache_replay.py. One tab-separated line per access goes to
+// foo_nsync_artwork_trace.tsv in the profile folder. URLs are logged as
+// hashes, of the URL and of its folder, so a trace holds no track names.
+class artwork_trace {
+public:
+    static artwork_trace& get();
+
+    enum class result : char {
+        hit = 'H',      // Served from the memory cache
+        miss = 'M',     // Fetched from the server and cached
+        missing = 'N',  // Known to have no art (negative cache)
+        failed = 'F',   // Fetch failed or came back empty
+    };
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // `bytes` is the image size (0 when there is none), `latency_us` the query time
+    void record(const char* artwork_url, size_t bytes, result what, uint64_t latency_us);
+
+    // Picks up the Advanced setting and flushes the file (main thread, from the sync timer)
+    void tick();
+    void shutdown();
+
+private:
+    artwork_trace() = default;
+
+    void open();   // Caller holds m_mutex
+    void close();  // Caller holds m_mutex
+
+    std::atomic<bool> m_enabled{ false };
+    std::mutex m_mutex;
+    FILE* m_file = nullptr;
+    uint64_t m_started_us = 0;
+};
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "guids.h"
 #include <SDK/cfg_var.h>
+#include <cstdlib>
 
 // cfg_var for persistence
 static cfg_bool cfg_enabled(guid_cfg_enabled, true);
@@ -10,6 +11,25 @@ static cfg_int cfg_poll_interval(guid_cfg_poll_interval, 60);
 // Binary blob for sync jobs
 static cfg_objList<SyncJob> cfg_sync_jobs(guid_cfg_sync_jobs);
 
+// Per-job sync state; overrides the hashes in cfg_sync_jobs. A "v2" first line, then one
+// record per job: "<server>\t<endpoint>\t<playlist>\t<hash>\t<retry attempts>\t<last success>\t<syncs>\t<failures>".
+// Without the version line, records are the older "<server>\t<endpoint>\t<playlist>\t<hash>".
+static cfg_string cfg_sync_state(guid_cfg_sync_state, "");
+static const char STATE_VERSION[] = "v2";
+
+// Advanced > Tools > Playlist Sync
+static advconfig_branch_factory g_advconfig_branch("Playlist Sync", guid_advconfig_branch, advconfig_branch::guid_branch_tools, 0);
+static advconfig_integer_factory g_advconfig_sync_rate_limit("Sync download limit (KB/s, 0 = unlimited)",
+    guid_advconfig_sync_rate_limit, guid_advconfig_branch, 0, 0, 0, 1000000);
+static advconfig_integer_factory g_advconfig_background_rate_limit("Background polling download limit (KB/s, 0 = unlimited)",
+    guid_advconfig_background_rate_limit, guid_advconfig_branch, 1, 0, 0, 1000000);
+static advconfig_checkbox_factory g_advconfig_trace("Record timing trace (foo_nsync_trace.json in profile folder)",
+    guid_advconfig_trace, guid_advconfig_branch, 2, false);
+static advconfig_checkbox_factory g_advconfig_artwork_trace("Record artwork cache accesses (foo_nsync_artwork_trace.tsv in profile folder)",
+    guid_advconfig_artwork_trace, guid_advconfig_branch, 3, false);
+static advconfig_integer_factory g_advconfig_memory_budget("Memory budget for caches and sync buffers (MB, 0 = unlimited)",
+    guid_advconfig_memory_budget, guid_advconfig_branch, 4, 128, 0, 65536);
+
 // SyncJob serialization is now handled by templates in config.h
 
 // Singleton
@@ -41,6 +61,26 @@ void sync_config::update_job(size_t index, const SyncJob& job) {
     }
 }
 
+uint32_t sync_config::get_sync_rate_limit_kbps() {
+    return (uint32_t)g_advconfig_sync_rate_limit.get();
+}
+
+uint32_t sync_config::get_background_rate_limit_kbps() {
+    return (uint32_t)g_advconfig_background_rate_limit.get();
+}
+
+bool sync_config::is_trace_enabled() const {
+    return g_advconfig_trace.get();
+}
+
+bool sync_config::is_artwork_trace_enabled() const {
+    return g_advconfig_artwork_trace.get();
+}
+
+uint32_t sync_config::get_memory_budget_mb() {
+    return (uint32_t)g_advconfig_memory_budget.get();
+}
+
 void sync_config::save() {
     cfg_enabled = m_enabled;
     cfg_poll_interval = m_default_interval;
@@ -59,4 +99,99 @@ void sync_config::load() {
     for (size_t i = 0; i < cfg_sync_jobs.get_count(); ++i) {
         m_jobs.push_back(cfg_sync_jobs[i]);
     }
+    load_state();
+}
+
+pfc::string8 sync_config::state_key(const SyncJob& job) {
+    pfc::string8 key;
+    key << job.server_url << "\t" << job.playlist_endpoint << "\t" << job.target_playlist;
+    return key;
+}
+
+void sync_config::load_state() {
+    pfc::string8 state = cfg_sync_state.get();
+    const char* ptr = state.c_str();
+    bool has_stats = false;
+    bool first = true;
+    while (*ptr) {
+        const char* line_end = strchr(ptr, '\n');
+        pfc::string8 line;
+        line.set_string(ptr, line_end ? (size_t)(line_end - ptr) : strlen(ptr));
+        ptr = line_end ? line_end + 1 : ptr + strlen(ptr);
+
+        if (first) {
+            first = false;
+            if (line == STATE_VERSION) {
+                has_stats = true;
+                continue;
+            }
+        }
+        apply_state_record(line, has_stats);
+    }
+}
+
+void sync_config::apply_state_record(const char* line, bool has_stats) {
+    // The fields follow the last tabs; everything before them is the key
+    const size_t field_count = has_stats ? 5 : 1;
+    std::vector<pfc::string8> fields;
+    pfc::string8 key = line;
+    while (fields.size() < field_count) {
+        const char* tab = strrchr(key.c_str(), '\t');
+        if (!tab) return;
+        fields.insert(fields.begin(), pfc::string8(tab + 1));
+        key.truncate(tab - key.c_str());
+    }
+
+    for (auto& job : m_jobs) {
+        if (state_key(job) != key) continue;
+        job.last_hash = fields[0];
+        if (has_stats) {
+            job.retry_attempts = (unsigned)strtoul(fields[1].c_str(), nullptr, 10);
+            job.last_success = strtoull(fields[2].c_str(), nullptr, 10);
+            job.sync_count = (uint32_t)strtoul(fields[3].c_str(), nullptr, 10);
+            job.failure_count = (uint32_t)strtoul(fields[4].c_str(), nullptr, 10);
+        }
+    }
+}
+
+void sync_config::set_job_hash(size_t index, const char* hash) {
+    if (index < m_jobs.size() && m_jobs[index].last_hash != hash) {
+        m_jobs[index].last_hash = hash;
+        m_state_dirty = true;
+    }
+}
+
+void sync_config::record_job_success(size_t index) {
+    if (index >= m_jobs.size()) return;
+    auto& job = m_jobs[index];
+    job.retry_attempts = 0;
+    job.last_success = pfc::fileTimeNow();
+    job.sync_count++;
+    m_state_dirty = true;
+}
+
+void sync_config::record_job_failure(size_t index, unsigned retry_attempts) {
+    if (index >= m_jobs.size()) return;
+    auto& job = m_jobs[index];
+    job.retry_attempts = retry_attempts;
+    job.failure_count++;
+    m_state_dirty = true;
+}
+
+void sync_config::flush_state() {
+    if (!m_state_dirty) return;
+    m_state_dirty = false;
+
+    // Rebuilt from the current jobs, so entries of removed or edited jobs drop out
+    pfc::string8 state;
+    state << STATE_VERSION << "\n";
+    for (const auto& job : m_jobs) {
+        if (job.last_hash.is_empty() && job.sync_count == 0 && job.failure_count == 0) continue;
+        state << state_key(job) << "\t" << job.last_hash
+              << "\t" << job.retry_attempts
+              << "\t" << job.last_success
+              << "\t" << job.sync_count
+              << "\t" << job.failure_count << "\n";
+    }
+    cfg_sync_state = state;
 }
@@ -12,8 +12,14 @@ struct SyncJob {
     pfc::string8 target_playlist;   // foobar2000 playlist name
     bool enabled = true;
     int poll_interval_seconds = 60;
-    pfc::string8 last_hash;         // Last known MD5 from server
+    pfc::string8 last_hash;         // Last known MD5 from server (kept current in the sync state store)
     pfc::string8 last_error;        // Last error message (if any)
+
+    // Hot state, persisted only in the sync state store (not part of the job's serialization)
+    unsigned retry_attempts = 0;    // Backoff attempts since the last success
+    uint64_t last_success = 0;      // Filetime of the last successful sync, 0 = never
+    uint32_t sync_count = 0;        // Successful syncs
+    uint32_t failure_count = 0;     // Failed syncs
     
     // For serialization
     template<typename t_stream>
@@ -70,15 +76,44 @@ public:
     
     int get_default_interval() const { return m_default_interval; }
     void set_default_interval(int seconds) { m_default_interval = seconds; }
+
+    // Download rate caps from Advanced preferences (0 = unlimited).
+    // Static: request threads read them, like get_memory_budget_mb()
+    static uint32_t get_sync_rate_limit_kbps();
+    static uint32_t get_background_rate_limit_kbps();
+
+    // Timing trace from Advanced preferences (see sync_trace)
+    bool is_trace_enabled() const;
+
+    // Artwork cache access log from Advanced preferences (see artwork_trace)
+    bool is_artwork_trace_enabled() const;
+
+    // Budget for caches and sync buffers from Advanced preferences (see memory_budget).
+    // Static: artwork threads read it, and must not be the ones constructing the config
+    static uint32_t get_memory_budget_mb();
     
-    // Persistence
+    // Persistence of the job list - only needed when it is edited
     void save();
     void load();
-    
+
+    // Hot per-job state. A sync records its hash, result and backoff here instead
+    // of calling save(), and the changes are written together by flush_state()
+    // (from the sync timer).
+    void set_job_hash(size_t index, const char* hash);
+    void record_job_success(size_t index);
+    void record_job_failure(size_t index, unsigned retry_attempts);
+    void flush_state();
+
 private:
     sync_config();
-    
+
+    // Key of a job in the state store (stable across reordering)
+    static pfc::string8 state_key(const SyncJob& job);
+    void load_state();
+    void apply_state_record(const char* line, bool has_stats);
+
     std::vector<SyncJob> m_jobs;
+    bool m_state_dirty = false;
     bool m_enabled = true;
     int m_default_interval = 60;
 };
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "diagnostics.h"
+#include "artwork_extractor.h"
+#include "request_scheduler.h"
+#include "server_health.h"
+#include <algorithm>
+
+diagnostics& diagnostics::get() {
+    static diagnostics instance;
+    return instance;
+}
+
+void diagnostics::series::push(double value) {
+    m_values.push_back(value);
+    if (m_values.size() > HISTORY_SECONDS) m_values.pop_front();
+}
+
+double diagnostics::series::sum() const {
+    double total = 0;
+    for (double value : m_values) total += value;
+    return total;
+}
+
+double diagnostics::series::peak() const {
+    double highest = 0;
+    for (double value : m_values) highest = std::max(highest, value);
+    return highest;
+}
+
+diagnostics::stat diagnostics::make_stat(double now, const series& history) {
+    stat result;
+    result.now = now;
+    result.average = history.average();
+    result.peak = std::max(now, history.peak());
+    return result;
+}
+
+void diagnostics::record_connection(bool reused) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    (reused ? m_connections_reused : m_connections_new).total++;
+}
+
+void diagnostics::record_bytes(const char* url, size_t bytes) {
+    pfc::string8 origin = server_health::origin_of(url);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_server_bytes[origin].total += bytes;
+}
+
+void diagnostics::record_artwork_lookup(bool hit) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_artwork_lookups.total++;
+    if (hit) m_artwork_hits.total++;
+}
+
+void diagnostics::record_sync_start(size_t job_index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sync_phases[job_index].clear();
+}
+
+void diagnostics::record_sync_phase(size_t job_index, const char* phase, uint64_t ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& phases = m_sync_phases[job_index];
+    for (auto& timing : phases) {
+        if (strcmp(timing.phase.c_str(), phase) == 0) {
+            timing.ms = ms;
+            return;
+        }
+    }
+    phase_timing timing;
+    timing.phase = phase;
+    timing.ms = ms;
+    phases.push_back(timing);
+}
+
+void diagnostics::sample() {
+    size_t active = 0, queued = 0;
+    request_scheduler::get().get_counts(active, queued);
+    artwork_cache_stats artwork = get_artwork_cache_stats();
+    size_t memory_total = 0;
+    memory_budget::get().get_usage(memory_total);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ULONGLONG now = GetTickCount64();
+    double seconds = m_last_sample != 0 ? std::max(0.001, (now - m_last_sample) / 1000.0) : 1.0;
+    m_last_sample = now;
+
+    m_connections_new.sample();
+    m_connections_reused.sample();
+    m_artwork_hits.sample();
+    m_artwork_lookups.sample();
+    for (auto& server : m_server_bytes) server.second.sample(seconds);
+
+    m_requests_active.push((double)active);
+    m_requests_queued.push((double)queued);
+    m_artwork_entries.push((double)artwork.entries);
+    m_artwork_bytes.push((double)artwork.bytes);
+    m_known_missing.push((double)artwork.known_missing);
+    m_memory_total.push((double)memory_total);
+}
+
+diagnostics::report diagnostics::get_report() {
+    size_t active = 0, queued = 0;
+    request_scheduler::get().get_counts(active, queued);
+    artwork_cache_stats artwork = get_artwork_cache_stats();
+    std::vector<server_health::server_status> health = server_health::get().get_servers();
+    auto& budget = memory_budget::get();
+    size_t memory_total = 0;
+
+    report result;
+    result.memory = budget.get_usage(memory_total);
+    result.memory_budget_bytes = budget.get_budget_bytes();
+    result.memory_trimmed = budget.get_trimmed_bytes();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    result.requests_active = make_stat((double)active, m_requests_active);
+    result.requests_queued = make_stat((double)queued, m_requests_queued);
+    result.artwork_entries = make_stat((double)artwork.entries, m_artwork_entries);
+    result.artwork_bytes = make_stat((double)artwork.bytes, m_artwork_bytes);
+    result.known_missing = make_stat((double)artwork.known_missing, m_known_missing);
+    result.memory_total = make_stat((double)memory_total, m_memory_total);
+
+    double reused = m_connections_reused.per_second.sum();
+    double opened = m_connections_new.per_second.sum();
+    if (reused + opened > 0) result.connection_reuse = reused / (reused + opened);
+    result.connections_opened = m_connections_new.total;
+
+    double lookups = m_artwork_lookups.per_second.sum();
+    if (lookups > 0) result.artwork_hit_rate = m_artwork_hits.per_second.sum() / lookups;
+    result.artwork_lookups = (uint64_t)lookups;
+
+    // Servers that have carried data, plus any the health tracker knows about
+    for (const auto& entry : m_server_bytes) {
+        server_report server;
+        server.origin = entry.first;
+        server.bytes_per_sec = make_stat(entry.second.per_second.last(), entry.second.per_second);
+        result.servers.push_back(server);
+    }
+    for (const auto& status : health) {
+        auto it = std::find_if(result.servers.begin(), result.servers.end(),
+            [&](const server_report& server) { return server.origin == status.origin; });
+        if (it == result.servers.end()) {
+            server_report server;
+            server.origin = status.origin;
+            result.servers.push_back(server);
+            it = result.servers.end() - 1;
+        }
+        it->circuit_open = status.open;
+        it->consecutive_failures = status.consecutive_failures;
+    }
+
+    result.sync_phases = m_sync_phases;
+    return result;
+}
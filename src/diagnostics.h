@@ -0,0 +1,118 @@
+#pragma once
+
+#include "memory_budget.h"
+#include <pfc/pfc.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <windows.h>
+
+// Numbers for the Diagnostics list on the preferences page. Modules report
+// events here from any thread; gauges such as cache sizes are read from their
+// owners. sample() runs once a second on the sync timer and keeps five minutes
+// of history, so the page has recent averages and peaks as soon as it opens.
+class diagnostics {
+public:
+    static diagnostics& get();
+
+    // A request got its response headers, on a new or a reused connection
+    void record_connection(bool reused);
+    // Response body bytes received from the server of `url`
+    void record_bytes(const char* url, size_t bytes);
+    // A lookup in the artwork memory cache
+    void record_artwork_lookup(bool hit);
+    // A job's sync started, and one of its phases ("server sync", "hash check", ...) finished
+    void record_sync_start(size_t job_index);
+    void record_sync_phase(size_t job_index, const char* phase, uint64_t ms);
+
+    // Main thread, once a second (from the sync timer)
+    void sample();
+
+    // A gauge now and over the history window
+    struct stat {
+        double now = 0;
+        double average = 0;
+        double peak = 0;
+    };
+
+    struct server_report {
+        pfc::string8 origin;
+        stat bytes_per_sec;
+        bool circuit_open = false;
+        unsigned consecutive_failures = 0;
+    };
+
+    struct phase_timing {
+        pfc::string8 phase;
+        uint64_t ms = 0;
+    };
+
+    struct report {
+        stat requests_active;
+        stat requests_queued;
+        // Ratios over the history window; negative when there were no events
+        double connection_reuse = -1;
+        uint64_t connections_opened = 0;   // Since startup
+        double artwork_hit_rate = -1;
+        uint64_t artwork_lookups = 0;      // In the history window
+        stat artwork_entries;
+        stat artwork_bytes;
+        stat known_missing;
+        stat memory_total;                 // All consumers of the memory budget
+        size_t memory_budget_bytes = 0;    // 0 = unlimited
+        uint64_t memory_trimmed = 0;       // Since startup
+        std::vector<memory_budget::consumer_usage> memory;
+        std::vector<server_report> servers;
+        std::map<size_t, std::vector<phase_timing>> sync_phases;  // Latest sync by job index
+    };
+
+    report get_report();
+
+private:
+    diagnostics() = default;
+
+    static const size_t HISTORY_SECONDS = 300;
+
+    // One value per sample, oldest first
+    class series {
+    public:
+        void push(double value);
+        double sum() const;
+        double average() const { return m_values.empty() ? 0 : sum() / m_values.size(); }
+        double peak() const;
+        double last() const { return m_values.empty() ? 0 : m_values.back(); }
+    private:
+        std::deque<double> m_values;
+    };
+
+    struct counter {
+        uint64_t total = 0;
+        uint64_t sampled = 0;  // total at the last sample
+        series per_second;  // Or per sample, for ratios
+
+        // Events since the last sample, divided by `seconds` for a rate
+        void sample(double seconds = 1.0) {
+            per_second.push((double)(total - sampled) / seconds);
+            sampled = total;
+        }
+    };
+
+    static stat make_stat(double now, const series& history);
+
+    std::mutex m_mutex;
+    counter m_connections_new;
+    counter m_connections_reused;
+    counter m_artwork_hits;
+    counter m_artwork_lookups;
+    std::map<pfc::string8, counter> m_server_bytes;  // By origin
+    series m_requests_active;
+    series m_requests_queued;
+    series m_artwork_entries;
+    series m_artwork_bytes;
+    series m_known_missing;
+    series m_memory_total;
+    std::map<size_t, std::vector<phase_timing>> m_sync_phases;
+    ULONGLONG m_last_sample = 0;
+};
@@ -0,0 +1,325 @@
+#include "stdafx.h"
+#include "endpoint_router.h"
+#include "http_client.h"
+#include "server_discovery.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    const DWORD PROBE_TIMEOUT_MS = 1500;          // A /status round trip slower than this is a dead route
+    const auto PROBE_INTERVAL = std::chrono::seconds(30);
+    const double SRTT_ALPHA = 0.2;                // Weight of a new RTT sample
+    const DWORD BROWSE_TIMEOUT_MS = 1500;
+    const unsigned BROWSE_EVERY_CYCLES = 10;      // Re-browse the LAN every ~5 minutes
+    const char* const SERVER_ID_HEADER = "X-NSync-Server-Id";
+
+    // A later endpoint must be clearly faster to beat an earlier (preferred) one
+    bool clearly_faster(double candidate_ms, double current_ms) {
+        return candidate_ms * 1.25 + 5.0 < current_ms;
+    }
+}
+
+endpoint_router& endpoint_router::get() {
+    static endpoint_router instance;
+    return instance;
+}
+
+void endpoint_router::split_endpoints(const char* server_url, std::vector<pfc::string8>& out) {
+    out.clear();
+    const char* ptr = server_url;
+
+    while (*ptr) {
+        const char* end = ptr;
+        while (*end && *end != ';' && *end != ',' && *end != ' ' && *end != '\t') {
+            ++end;
+        }
+
+        if (end > ptr) {
+            pfc::string8 url;
+            url.set_string(ptr, end - ptr);
+            url.skip_trailing_char('/');
+            if (url.length() > 0) {
+                out.push_back(url);
+            }
+        }
+
+        ptr = *end ? end + 1 : end;
+    }
+}
+
+pfc::string8 endpoint_router::resolve(const char* server_url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_groups.find(pfc::string8(server_url));
+    if (it != m_groups.end()) {
+        return it->second.current;
+    }
+
+    // First use of this list - start with the preferred endpoint until probed
+    route_group group;
+    split_endpoints(server_url, group.configured);
+    if (group.configured.empty()) {
+        return pfc::string8(server_url);
+    }
+
+    for (const auto& url : group.configured) {
+        m_endpoints.emplace(url, endpoint_state());
+    }
+    group.endpoints = group.configured;
+    refresh_discovered(group);
+    group.current = pick_best(group);
+    pfc::string8 current = group.current;
+    m_groups.emplace(pfc::string8(server_url), std::move(group));
+
+    // Also covers single-URL lists: their server ID is needed to match discovered servers
+    m_probe_requested = true;
+    m_cv.notify_all();
+    return current;
+}
+
+void endpoint_router::get_candidates(const char* server_url, std::vector<pfc::string8>& out) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_groups.find(pfc::string8(server_url));
+        if (it != m_groups.end()) {
+            out = it->second.endpoints;
+            return;
+        }
+    }
+    split_endpoints(server_url, out);
+}
+
+void endpoint_router::mark_success(endpoint_state& state, double rtt_ms) {
+    if (rtt_ms >= 0) {
+        state.srtt_ms = state.srtt_ms < 0 ? rtt_ms : (1.0 - SRTT_ALPHA) * state.srtt_ms + SRTT_ALPHA * rtt_ms;
+    }
+    state.healthy = true;
+    state.failures = 0;
+}
+
+void endpoint_router::report_success(const char* base_url, double rtt_ms) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_endpoints.find(pfc::string8(base_url));
+        if (it == m_endpoints.end()) return;
+
+        mark_success(it->second, rtt_ms);
+    }
+    update_routes();
+}
+
+void endpoint_router::report_failure(const char* base_url) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_endpoints.find(pfc::string8(base_url));
+        if (it == m_endpoints.end()) return;
+
+        it->second.healthy = false;
+        it->second.failures++;
+
+        // Re-probe soon so the route recovers without waiting a full interval
+        m_probe_requested = true;
+        m_cv.notify_all();
+    }
+    update_routes();
+}
+
+void endpoint_router::set_route_changed_callback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_on_route_changed = std::move(callback);
+}
+
+void endpoint_router::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) return;
+
+    m_running = true;
+    m_thread = std::thread([this]() { probe_loop(); });
+}
+
+void endpoint_router::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+        m_cv.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void endpoint_router::probe_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_running) {
+        m_cv.wait_for(lock, PROBE_INTERVAL, [this]() { return !m_running || m_probe_requested; });
+        if (!m_running) break;
+        m_probe_requested = false;
+        bool browse = (m_cycle++ % BROWSE_EVERY_CYCLES) == 0;
+
+        lock.unlock();
+        probe_all();
+        if (browse) {
+            discover();
+        }
+        update_routes();
+        lock.lock();
+    }
+}
+
+void endpoint_router::probe_all() {
+    // Only lists with a choice to make are worth the extra requests, plus a
+    // one-off probe of every configured URL to learn which server it reaches
+    std::vector<pfc::string8> targets;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& group : m_groups) {
+            bool has_choice = group.second.endpoints.size() > 1;
+            for (const auto& url : group.second.endpoints) {
+                bool unidentified = std::find(m_identified.begin(), m_identified.end(), url) == m_identified.end();
+                if ((has_choice || unidentified) && std::find(targets.begin(), targets.end(), url) == targets.end()) {
+                    targets.push_back(url);
+                }
+            }
+        }
+    }
+
+    bool identified_new = false;
+    for (const auto& base_url : targets) {
+        pfc::string8 status_url, response, error, server_id;
+        status_url << base_url << "/status";
+
+        http_response_headers headers;
+        auto started = std::chrono::steady_clock::now();
+        bool ok = nsync_http_client::get().get_sync(status_url.c_str(), response, error, PROBE_TIMEOUT_MS, &headers,
+            request_priority::playback);
+        double rtt_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+        if (ok && headers.find(SERVER_ID_HEADER, server_id)) {
+            if (server_discovery::get().lookup_server_id(base_url) != server_id) {
+                server_discovery::get().remember_endpoint(base_url, server_id);
+                identified_new = true;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ok && std::find(m_identified.begin(), m_identified.end(), base_url) == m_identified.end()) {
+            m_identified.push_back(base_url);
+        }
+
+        auto& state = m_endpoints[base_url];
+        if (ok) {
+            mark_success(state, rtt_ms);
+        } else {
+            state.healthy = false;
+            state.failures++;
+        }
+    }
+
+    if (identified_new) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool added = false;
+        for (auto& group : m_groups) {
+            added |= refresh_discovered(group.second);
+        }
+        if (added) {
+            m_probe_requested = true;  // Measure the new LAN addresses on the next cycle
+        }
+    }
+}
+
+void endpoint_router::discover() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_groups.empty()) return;
+    }
+
+    std::vector<discovered_server> servers;
+    if (!server_discovery::get().browse(BROWSE_TIMEOUT_MS, servers)) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool added = false;
+    for (auto& group : m_groups) {
+        added |= refresh_discovered(group.second);
+    }
+    if (added) {
+        m_probe_requested = true;
+    }
+}
+
+bool endpoint_router::refresh_discovered(route_group& group) {
+    std::vector<pfc::string8> endpoints;
+
+    for (const auto& url : group.configured) {
+        pfc::string8 server_id = server_discovery::get().lookup_server_id(url);
+        pfc::string8 lan_url;
+        if (server_id.is_empty() || !server_discovery::get().lookup_lan_url(server_id, lan_url)) continue;
+
+        if (std::find(group.configured.begin(), group.configured.end(), lan_url) == group.configured.end() &&
+            std::find(endpoints.begin(), endpoints.end(), lan_url) == endpoints.end()) {
+            endpoints.push_back(lan_url);
+        }
+    }
+
+    bool added = false;
+    for (const auto& url : endpoints) {
+        if (std::find(group.endpoints.begin(), group.endpoints.end(), url) == group.endpoints.end()) {
+            added = true;
+        }
+        // Not routed to until a probe has shown it is reachable from here
+        if (m_endpoints.find(url) == m_endpoints.end()) {
+            endpoint_state state;
+            state.healthy = false;
+            m_endpoints.emplace(url, state);
+        }
+    }
+
+    endpoints.insert(endpoints.end(), group.configured.begin(), group.configured.end());
+    group.endpoints = std::move(endpoints);
+    return added;
+}
+
+void endpoint_router::update_routes() {
+    std::function<void()> callback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool changed = false;
+
+        for (auto& group : m_groups) {
+            pfc::string8 best = pick_best(group.second);
+            if (best != group.second.current) {
+                console::formatter() << "foo_nsync: Switching " << group.second.current << " -> " << best;
+                group.second.current = best;
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            callback = m_on_route_changed;
+        }
+    }
+
+    if (callback) {
+        fb2k::inMainThread(callback);
+    }
+}
+
+pfc::string8 endpoint_router::pick_best(const route_group& group) const {
+    const pfc::string8* best = nullptr;
+    double best_rtt = -1.0;
+
+    for (const auto& url : group.endpoints) {
+        auto it = m_endpoints.find(url);
+        if (it == m_endpoints.end() || !it->second.healthy) continue;
+
+        double rtt = it->second.srtt_ms;
+        if (best == nullptr || (rtt >= 0 && (best_rtt < 0 || clearly_faster(rtt, best_rtt)))) {
+            best = &url;
+            best_rtt = rtt;
+        }
+    }
+
+    // Nothing healthy: stay on the preferred endpoint, requests will fail fast and re-probe
+    return best ? *best : group.configured.front();
+}
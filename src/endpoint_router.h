@@ -0,0 +1,78 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Routes requests to the fastest healthy server of a job.
+// A job's server_url may list several base URLs in preference order,
+// e.g. "http://192.168.1.50:8090; https://music.example.com".
+// Lists with more than one entry are probed in the background via /status.
+// Servers found on the LAN (see server_discovery) are tried ahead of the list
+// once a configured URL has identified itself as the same server.
+class endpoint_router {
+public:
+    static endpoint_router& get();
+
+    // Split a server_url list into base URLs (trimmed, trailing '/' removed)
+    static void split_endpoints(const char* server_url, std::vector<pfc::string8>& out);
+
+    // Base URL that requests for this server_url list should use right now
+    pfc::string8 resolve(const char* server_url);
+
+    // Every base URL the list may route to, including discovered LAN addresses
+    void get_candidates(const char* server_url, std::vector<pfc::string8>& out);
+
+    // Feed request outcomes back so failover does not wait for the next probe.
+    // rtt_ms < 0 reports health only
+    void report_success(const char* base_url, double rtt_ms);
+    void report_failure(const char* base_url);
+
+    // Invoked on the main thread when the chosen endpoint of any list changes
+    void set_route_changed_callback(std::function<void()> callback);
+
+    // Background probing
+    void start();
+    void stop();
+
+private:
+    endpoint_router() = default;
+
+    struct endpoint_state {
+        double srtt_ms = -1.0;  // Smoothed /status round trip, -1 = not measured yet
+        bool healthy = true;    // Optimistic until a probe or request fails
+        unsigned failures = 0;
+    };
+
+    struct route_group {
+        std::vector<pfc::string8> configured;  // As typed by the user
+        std::vector<pfc::string8> endpoints;   // Preference order: discovered, then configured
+        pfc::string8 current;
+    };
+
+    // A probe or request got through; rtt_ms < 0 leaves the estimate alone
+    static void mark_success(endpoint_state& state, double rtt_ms);
+
+    void probe_loop();
+    void probe_all();
+    void discover();
+    bool refresh_discovered(route_group& group);  // Caller holds m_mutex
+    void update_routes();
+    pfc::string8 pick_best(const route_group& group) const;
+
+    std::mutex m_mutex;
+    std::map<pfc::string8, endpoint_state> m_endpoints;
+    std::map<pfc::string8, route_group> m_groups;
+    std::vector<pfc::string8> m_identified;  // Endpoints whose server ID has been asked for
+    std::function<void()> m_on_route_changed;
+
+    std::thread m_thread;
+    std::condition_variable m_cv;
+    bool m_running = false;
+    bool m_probe_requested = false;
+    unsigned m_cycle = 0;
+};
@@ -29,3 +29,38 @@ static constexpr GUID guid_advconfig_branch =
 // {F6A7B8C9-D0E1-2345-F123-456789012345}
 static constexpr GUID guid_artwork_extractor =
 { 0xf6a7b8c9, 0xd0e1, 0x2345, { 0xf1, 0x23, 0x45, 0x67, 0x89, 0x01, 0x23, 0x45 } };
+
+// Discovered server addresses, keyed by server ID
+// {0A1B2C3D-4E5F-4071-8293-A4B5C6D7E8F9}
+static constexpr GUID guid_cfg_discovery_cache =
+{ 0x0a1b2c3d, 0x4e5f, 0x4071, { 0x82, 0x93, 0xa4, 0xb5, 0xc6, 0xd7, 0xe8, 0xf9 } };
+
+// Advanced config: download rate limit for user-started syncs (KB/s)
+// {1B2C3D4E-5F60-4182-93A4-B5C6D7E8F90A}
+static constexpr GUID guid_advconfig_sync_rate_limit =
+{ 0x1b2c3d4e, 0x5f60, 0x4182, { 0x93, 0xa4, 0xb5, 0xc6, 0xd7, 0xe8, 0xf9, 0x0a } };
+
+// Advanced config: download rate limit for background polling (KB/s)
+// {2C3D4E5F-6071-4293-A4B5-C6D7E8F90A1B}
+static constexpr GUID guid_advconfig_background_rate_limit =
+{ 0x2c3d4e5f, 0x6071, 0x4293, { 0xa4, 0xb5, 0xc6, 0xd7, 0xe8, 0xf9, 0x0a, 0x1b } };
+
+// Per-job sync state (last hash), stored apart from the job list
+// {3D4E5F60-7182-43A4-B5C6-D7E8F90A1B2C}
+static constexpr GUID guid_cfg_sync_state =
+{ 0x3d4e5f60, 0x7182, 0x43a4, { 0xb5, 0xc6, 0xd7, 0xe8, 0xf9, 0x0a, 0x1b, 0x2c } };
+
+// Advanced config: record a timing trace
+// {4E5F6071-8293-44B5-C6D7-E8F90A1B2C3D}
+static constexpr GUID guid_advconfig_trace =
+{ 0x4e5f6071, 0x8293, 0x44b5, { 0xc6, 0xd7, 0xe8, 0xf9, 0x0a, 0x1b, 0x2c, 0x3d } };
+
+// Advanced config: record artwork cache accesses
+// {5F607182-93A4-45C6-D7E8-F90A1B2C3D4E}
+static constexpr GUID guid_advconfig_artwork_trace =
+{ 0x5f607182, 0x93a4, 0x45c6, { 0xd7, 0xe8, 0xf9, 0x0a, 0x1b, 0x2c, 0x3d, 0x4e } };
+
+// Advanced config: memory budget for caches and sync buffers
+// {60718293-A4B5-46D7-E8F9-0A1B2C3D4E5F}
+static constexpr GUID guid_advconfig_memory_budget =
+{ 0x60718293, 0xa4b5, 0x46d7, { 0xe8, 0xf9, 0x0a, 0x1b, 0x2c, 0x3d, 0x4e, 0x5f } };
@@ -1,7 +1,171 @@
 #include "stdafx.h"
 #include "http_client.h"
+#include "server_health.h"
+#include "link_estimator.h"
+#include "diagnostics.h"
+#include "memory_budget.h"
+#include "sync_trace.h"
+#include <algorithm>
+#include <atomic>
 #include <thread>
 
+namespace {
+    // Closes a WinHTTP request handle from a thread-pool wait as soon as the
+    // caller's abort_callback or the client's shutdown fires, which makes the
+    // blocked WinHTTP call return at once
+    class request_abort_guard {
+    public:
+        request_abort_guard(abort_callback& p_abort, abort_callback& shutdown, HINTERNET request) : m_request(request) {
+            abort_callback* sources[] = { &p_abort, &shutdown };
+            for (size_t i = 0; i < 2; ++i) {
+                HANDLE event = sources[i]->get_abort_event();
+                if (event != nullptr && event != INVALID_HANDLE_VALUE) {
+                    RegisterWaitForSingleObject(&m_waits[i], event, on_abort, this, INFINITE, WT_EXECUTEONLYONCE);
+                }
+            }
+        }
+
+        ~request_abort_guard() {
+            close();
+        }
+
+        // Closes the request handle (once, whichever side gets there first)
+        void close() {
+            for (HANDLE& wait : m_waits) {
+                if (wait) {
+                    UnregisterWaitEx(wait, INVALID_HANDLE_VALUE);  // Waits for a running on_abort
+                    wait = nullptr;
+                }
+            }
+            if (!m_closed.exchange(true)) {
+                WinHttpCloseHandle(m_request);
+            }
+        }
+
+        bool aborted() const { return m_aborted; }
+
+    private:
+        static void CALLBACK on_abort(PVOID context, BOOLEAN) {
+            auto* self = static_cast<request_abort_guard*>(context);
+            if (!self->m_closed.exchange(true)) {
+                self->m_aborted = true;
+                WinHttpCloseHandle(self->m_request);
+            }
+        }
+
+        HINTERNET m_request;
+        HANDLE m_waits[2] = {};
+        std::atomic<bool> m_closed{ false };
+        std::atomic<bool> m_aborted{ false };
+    };
+
+    // One WinHttpConnect per request. It opens no socket of its own: WinHTTP
+    // keeps the kept-alive connections in the session and reuses them by host
+    class connect_handle {
+    public:
+        connect_handle(HINTERNET session, const url_parts& parts) {
+            pfc::stringcvt::string_wide_from_utf8 wide_host(parts.host.c_str());
+            m_handle = WinHttpConnect(session, wide_host.get_ptr(), (INTERNET_PORT)parts.port, 0);
+        }
+        ~connect_handle() {
+            if (m_handle) WinHttpCloseHandle(m_handle);
+        }
+        operator HINTERNET() const { return m_handle; }
+
+    private:
+        HINTERNET m_handle = nullptr;
+    };
+
+    const size_t READ_BUFFER_SIZE = 64 * 1024;
+
+    // Instrumentation for one request. While tracing (see sync_trace) it emits
+    // spans for queue wait, name resolution, connect, time to first byte and
+    // body transfer; resolve and connect times come from WinHTTP status
+    // callbacks, and a request on a reused connection has neither. Connection
+    // reuse and body bytes are always counted for the diagnostics page.
+    class request_monitor {
+    public:
+        request_monitor(const char* method, const char* url, const pfc::string8& error)
+            : m_url(url), m_error(error), m_start(sync_trace::get().enabled() ? sync_trace::now_us() : 0) {
+            if (m_start == 0) return;
+            const char* path = strstr(url, "://");
+            path = path ? strchr(path + 3, '/') : nullptr;
+            m_name << method << " " << (path ? path : url);
+        }
+
+        ~request_monitor() {
+            // A request that got an answer either opened a connection or reused one
+            if (m_status != 0) diagnostics::get().record_connection(!m_connected);
+            if (m_bytes != 0) diagnostics::get().record_bytes(m_url, m_bytes);
+
+            if (m_start == 0) return;
+            auto& trace = sync_trace::get();
+            uint64_t end = sync_trace::now_us();
+
+            pfc::string8 args;
+            sync_trace::add_arg(args, "url", m_url);
+            if (m_status != 0) sync_trace::add_arg(args, "status", (int64_t)m_status);
+            sync_trace::add_arg(args, "bytes", (int64_t)m_bytes);
+            if (!m_error.is_empty()) sync_trace::add_arg(args, "error", m_error.c_str());
+            trace.complete(m_name.c_str(), "http", m_start, end, args.c_str());
+
+            if (m_attached) trace.complete("queue", "http", m_start, m_attached);
+            if (m_resolve_end) trace.complete("dns", "http", m_resolve_start, m_resolve_end);
+            if (m_connect_end) trace.complete("connect", "http", m_connect_start, m_connect_end);
+            if (m_headers) trace.complete("ttfb", "http", m_sent, m_headers);
+            if (m_headers) trace.complete("transfer", "http", m_headers, end);
+        }
+
+        // The request got its slot and handle; subscribe to its connection progress
+        void attach(HINTERNET request) {
+            if (m_start != 0) m_attached = sync_trace::now_us();
+            DWORD_PTR context = (DWORD_PTR)this;
+            WinHttpSetOption(request, WINHTTP_OPTION_CONTEXT_VALUE, &context, sizeof(context));
+            WinHttpSetStatusCallback(request, on_status,
+                WINHTTP_CALLBACK_FLAG_RESOLVE_NAME | WINHTTP_CALLBACK_FLAG_CONNECT_TO_SERVER, 0);
+        }
+
+        void sent() { if (m_start != 0) m_sent = sync_trace::now_us(); }
+        void headers_received(DWORD status) {
+            m_status = status;
+            if (m_start != 0) m_headers = sync_trace::now_us();
+        }
+        void received(size_t bytes) { m_bytes += bytes; }
+
+    private:
+        static void CALLBACK on_status(HINTERNET, DWORD_PTR context, DWORD status, LPVOID, DWORD) {
+            auto* self = reinterpret_cast<request_monitor*>(context);
+            if (!self) return;
+            if (status == WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER) self->m_connected = true;
+            if (self->m_start == 0) return;
+            uint64_t now = sync_trace::now_us();
+            switch (status) {
+            case WINHTTP_CALLBACK_STATUS_RESOLVING_NAME:      self->m_resolve_start = now; break;
+            case WINHTTP_CALLBACK_STATUS_NAME_RESOLVED:       self->m_resolve_end = now; break;
+            case WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER: self->m_connect_start = now; break;
+            case WINHTTP_CALLBACK_STATUS_CONNECTED_TO_SERVER:  self->m_connect_end = now; break;
+            }
+        }
+
+        const char* m_url;
+        const pfc::string8& m_error;
+        pfc::string8 m_name;
+        uint64_t m_start;
+        uint64_t m_attached = 0, m_sent = 0, m_headers = 0;
+        uint64_t m_resolve_start = 0, m_resolve_end = 0, m_connect_start = 0, m_connect_end = 0;
+        DWORD m_status = 0;
+        size_t m_bytes = 0;
+        bool m_connected = false;  // Opened a new connection rather than reusing one
+    };
+
+    // Connect and send are bounded by `connect_ms`, the wait for response headers by `response_ms`
+    void set_request_timeouts(HINTERNET request, DWORD connect_ms, DWORD response_ms) {
+        WinHttpSetOption(request, WINHTTP_OPTION_CONNECT_TIMEOUT, &connect_ms, sizeof(connect_ms));
+        WinHttpSetOption(request, WINHTTP_OPTION_SEND_TIMEOUT, &connect_ms, sizeof(connect_ms));
+        WinHttpSetOption(request, WINHTTP_OPTION_RECEIVE_TIMEOUT, &response_ms, sizeof(response_ms));
+    }
+}
+
 nsync_http_client& nsync_http_client::get() {
     static nsync_http_client instance;
     return instance;
@@ -15,11 +179,17 @@ nsync_http_client::nsync_http_client() {
         WINHTTP_NO_PROXY_BYPASS,
         0
     );
+
+    m_budget_id = memory_budget::get().add("Response buffers", memory_budget::trim_never,
+        [this]() { return m_buffered_bytes.load(std::memory_order_relaxed); });
 }
 
 nsync_http_client::~nsync_http_client() {
-    if (m_session) {
-        WinHttpCloseHandle(m_session);
+    memory_budget::get().remove(m_budget_id);
+    // After a shutdown that timed out, workers may still be using the handles;
+    // the process is exiting and reclaims them
+    if (!m_shutdown_abort.is_aborted() || m_drained) {
+        close_handles();
     }
 }
 
@@ -60,28 +230,64 @@ bool url_parts::parse(const char* url, url_parts& out) {
     return true;
 }
 
-bool nsync_http_client::get_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error) {
+bool http_response_headers::find(const char* name, pfc::string8& out) const {
+    size_t name_len = strlen(name);
+    const char* ptr = raw.c_str();
+
+    while (*ptr) {
+        const char* line_end = strstr(ptr, "\r\n");
+        size_t line_len = line_end ? (size_t)(line_end - ptr) : strlen(ptr);
+
+        if (line_len > name_len && ptr[name_len] == ':' && pfc::stricmp_ascii_ex(ptr, name_len, name, name_len) == 0) {
+            const char* value = ptr + name_len + 1;
+            while (*value == ' ') ++value;
+            out.set_string(value, line_len - (value - ptr));
+            return true;
+        }
+
+        if (!line_end) break;
+        ptr = line_end + 2;
+    }
+    return false;
+}
+
+bool nsync_http_client::fetch_get(const char* url, DWORD timeout_ms, const chunk_callback& on_chunk,
+                                  pfc::string8& out_error, http_response_headers* out_headers, request_priority priority,
+                                  abort_callback& p_abort) {
+    request_monitor monitor("GET", url, out_error);
+
     if (!m_session) {
         out_error = "HTTP session not initialized";
         return false;
     }
 
+    if (p_abort.is_aborted() || m_shutdown_abort.is_aborted()) {
+        out_error = "Aborted";
+        return false;
+    }
+
+    // Fail fast while the server is known to be down
+    if (!server_health::get().allow_request(url)) {
+        out_error = "Server unavailable";
+        return false;
+    }
+
     url_parts parts;
     if (!url_parts::parse(url, parts)) {
         out_error = "Invalid URL";
         return false;
     }
 
-    // Convert host to wide string
-    pfc::stringcvt::string_wide_from_utf8 wide_host(parts.host.c_str());
     pfc::stringcvt::string_wide_from_utf8 wide_path(parts.path.c_str());
 
-    HINTERNET hConnect = WinHttpConnect(
-        m_session,
-        wide_host.get_ptr(),
-        parts.port,
-        0
-    );
+    // Wait for a slot of this request's class
+    request_scheduler::slot slot(priority, p_abort);
+    if (!slot.acquired()) {
+        out_error = "Aborted";
+        return false;
+    }
+
+    connect_handle hConnect(m_session, parts);
 
     if (!hConnect) {
         DWORD err = GetLastError();
@@ -104,17 +310,21 @@ bool nsync_http_client::get_sync(const char* url, pfc::string8& out_response, pf
 
     if (!hRequest) {
         DWORD err = GetLastError();
-        WinHttpCloseHandle(hConnect);
         out_error.reset();
         out_error << "Request creation failed (error " << (int)err << ")";
         return false;
     }
 
-    // Set timeouts (5 seconds)
-    DWORD timeout = 5000;
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_CONNECT_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_SEND_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &timeout, sizeof(timeout));
+    // Closing the handle is the only way to interrupt a blocked WinHTTP call
+    request_abort_guard abort_guard(p_abort, m_shutdown_abort, hRequest);
+    monitor.attach(hRequest);
+
+    // Connecting and the wait for the response get what this server usually needs; timeout_ms caps both
+    auto& estimator = link_estimator::get();
+    set_request_timeouts(hRequest, estimator.connect_timeout_ms(url, timeout_ms),
+        estimator.response_timeout_ms(url, 0, timeout_ms));
+    ULONGLONG sent_at = GetTickCount64();
+    monitor.sent();
 
     BOOL bResults = WinHttpSendRequest(
         hRequest,
@@ -132,13 +342,23 @@ bool nsync_http_client::get_sync(const char* url, pfc::string8& out_response, pf
 
     if (!bResults) {
         DWORD err = GetLastError();
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
+        if (abort_guard.aborted()) {
+            abort_guard.close();
+            out_error = "Aborted";
+            return false;
+        }
+        if (err == ERROR_WINHTTP_TIMEOUT) {
+            link_estimator::get().record_timeout(url);
+        }
+        server_health::get().record_failure(url);
+        abort_guard.close();
         out_error.reset();
         out_error << "Request failed (error " << (int)err << ")";
         return false;
     }
 
+    link_estimator::get().record_response_time(url, (DWORD)(GetTickCount64() - sent_at));
+
     // Check status code
     DWORD statusCode = 0;
     DWORD statusCodeSize = sizeof(statusCode);
@@ -150,204 +370,288 @@ bool nsync_http_client::get_sync(const char* url, pfc::string8& out_response, pf
         &statusCodeSize,
         WINHTTP_NO_HEADER_INDEX
     );
+    monitor.headers_received(statusCode);
+
+    // Any answer below 500 means the server itself is up
+    if (statusCode >= 500) {
+        server_health::get().record_failure(url);
+    } else {
+        server_health::get().record_success(url);
+    }
 
     if (statusCode != 200) {
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
+        abort_guard.close();
         out_error.reset();
         out_error << "HTTP " << (int)statusCode;
         return false;
     }
+
+    if (out_headers) {
+        DWORD headersSize = 0;
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+            WINHTTP_NO_OUTPUT_BUFFER, &headersSize, WINHTTP_NO_HEADER_INDEX);
+        if (GetLastError() == ERROR_INSUFFICIENT_BUFFER && headersSize > 0) {
+            pfc::array_t<wchar_t> headers;
+            headers.set_size(headersSize / sizeof(wchar_t) + 1);
+            if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+                    headers.get_ptr(), &headersSize, WINHTTP_NO_HEADER_INDEX)) {
+                headers[headersSize / sizeof(wchar_t)] = 0;
+                out_headers->raw = pfc::stringcvt::string_utf8_from_wide(headers.get_ptr());
+            }
+        }
+    }
     
-    // Read response
-    out_response.reset();
+    // Body: no total deadline, only a limit on how long it may go without receiving anything
+    DWORD stall_timeout = link_estimator::get().stall_timeout_ms(url);
+    WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &stall_timeout, sizeof(stall_timeout));
+    ULONGLONG body_started = GetTickCount64();
+
+    // Read response, handing each piece to the caller as it arrives
+    pfc::array_t<uint8_t> buffer;
+    buffer.set_size(READ_BUFFER_SIZE);
+    size_t received = 0;
     DWORD dwSize = 0;
     DWORD dwDownloaded = 0;
-    
+    DWORD read_error = ERROR_SUCCESS;
+
     do {
         dwSize = 0;
-        if (!WinHttpQueryDataAvailable(hRequest, &dwSize)) break;
+        if (!WinHttpQueryDataAvailable(hRequest, &dwSize)) {
+            read_error = GetLastError();
+            break;
+        }
         if (dwSize == 0) break;
-        
-        pfc::array_t<char> buffer;
-        buffer.set_size(dwSize + 1);
-        
-        if (WinHttpReadData(hRequest, buffer.get_ptr(), dwSize, &dwDownloaded)) {
-            buffer[dwDownloaded] = '\0';
-            out_response += buffer.get_ptr();
+
+        if (dwSize > buffer.get_size()) {
+            buffer.set_size(dwSize);
+        }
+        if (!WinHttpReadData(hRequest, buffer.get_ptr(), dwSize, &dwDownloaded)) {
+            read_error = GetLastError();
+            break;
         }
-    } while (dwSize > 0);
-    
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
 
-    return true;
-}
+        on_chunk(buffer.get_ptr(), dwDownloaded);
+        received += dwDownloaded;
+        monitor.received(dwDownloaded);
+        slot.throttle(dwDownloaded);
+    } while (dwSize > 0);
 
-bool nsync_http_client::get_binary_sync(const char* url, pfc::array_t<uint8_t>& out_data, pfc::string8& out_error) {
-    if (!m_session) {
-        out_error = "HTTP session not initialized";
-        return false;
-    }
+    abort_guard.close();
 
-    url_parts parts;
-    if (!url_parts::parse(url, parts)) {
-        out_error = "Invalid URL";
+    // A cancelled or stalled read leaves a truncated body
+    if (abort_guard.aborted()) {
+        out_error = "Aborted";
         return false;
     }
-
-    // Convert host to wide string
-    pfc::stringcvt::string_wide_from_utf8 wide_host(parts.host.c_str());
-    pfc::stringcvt::string_wide_from_utf8 wide_path(parts.path.c_str());
-
-    HINTERNET hConnect = WinHttpConnect(
-        m_session,
-        wide_host.get_ptr(),
-        parts.port,
-        0
-    );
-
-    if (!hConnect) {
-        DWORD err = GetLastError();
+    if (read_error != ERROR_SUCCESS) {
+        if (read_error == ERROR_WINHTTP_TIMEOUT) {
+            link_estimator::get().record_timeout(url);
+        }
+        server_health::get().record_failure(url);
         out_error.reset();
-        out_error << "Connection failed (error " << (int)err << ")";
+        out_error << "Transfer interrupted (error " << (int)read_error << ")";
         return false;
     }
+    link_estimator::get().record_transfer(url, received, (DWORD)(GetTickCount64() - body_started));
+    return true;
+}
 
-    DWORD flags = (parts.scheme == "https") ? WINHTTP_FLAG_SECURE : 0;
-
-    HINTERNET hRequest = WinHttpOpenRequest(
-        hConnect,
-        L"GET",
-        wide_path.get_ptr(),
-        NULL,
-        WINHTTP_NO_REFERER,
-        WINHTTP_DEFAULT_ACCEPT_TYPES,
-        flags
-    );
-
-    if (!hRequest) {
-        DWORD err = GetLastError();
-        WinHttpCloseHandle(hConnect);
-        out_error.reset();
-        out_error << "Request creation failed (error " << (int)err << ")";
-        return false;
+bool nsync_http_client::shared_get(const char* url, DWORD timeout_ms, pfc::array_t<uint8_t>& out_data,
+                                   pfc::string8& out_error, http_response_headers* out_headers, request_priority priority,
+                                   abort_callback& p_abort) {
+    // Join an identical request that is already on the wire, or lead a new one
+    std::shared_ptr<inflight_request> flight;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(m_inflight_mutex);
+        auto& slot = m_inflight[pfc::string8(url)];
+        if (!slot) {
+            slot = std::make_shared<inflight_request>();
+            leader = true;
+        }
+        flight = slot;
     }
 
-    // Set timeouts (2 seconds for artwork - must be fast to not block UI)
-    DWORD timeout = 2000;
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_CONNECT_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_SEND_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &timeout, sizeof(timeout));
+    if (leader) {
+        http_response_headers headers;
+        auto append = [this, &flight](const uint8_t* data, size_t size) {
+            flight->data.append_fromptr(data, size);
+            m_buffered_bytes.fetch_add(size, std::memory_order_relaxed);
+        };
+        flight->success = fetch_get(url, timeout_ms, append, flight->error, &headers, priority, p_abort);
+        m_buffered_bytes.fetch_sub(flight->data.get_size(), std::memory_order_relaxed);
+        flight->headers = headers.raw;
+        flight->aborted = !flight->success && p_abort.is_aborted();
+        {
+            std::lock_guard<std::mutex> lock(m_inflight_mutex);
+            m_inflight.erase(pfc::string8(url));
+        }
+        {
+            std::lock_guard<std::mutex> lock(flight->mutex);
+            flight->done = true;
+        }
+        flight->cv.notify_all();
+    } else {
+        // Waiters leave on their own abort; the shared request carries on for the others
+        std::unique_lock<std::mutex> lock(flight->mutex);
+        while (!flight->cv.wait_for(lock, std::chrono::milliseconds(50), [&flight]() { return flight->done; })) {
+            if (p_abort.is_aborted()) {
+                out_error = "Aborted";
+                return false;
+            }
+        }
+        lock.unlock();
 
-    BOOL bResults = WinHttpSendRequest(
-        hRequest,
-        WINHTTP_NO_ADDITIONAL_HEADERS,
-        0,
-        WINHTTP_NO_REQUEST_DATA,
-        0,
-        0,
-        0
-    );
+        // The leader gave up, but this caller still wants the result
+        if (flight->aborted && !p_abort.is_aborted()) {
+            out_data.set_size(0);
+            auto append = [&out_data](const uint8_t* data, size_t size) { out_data.append_fromptr(data, size); };
+            return fetch_get(url, timeout_ms, append, out_error, out_headers, priority, p_abort);
+        }
+    }
 
-    if (bResults) {
-        bResults = WinHttpReceiveResponse(hRequest, NULL);
+    out_data = flight->data;
+    out_error = flight->error;
+    if (out_headers) {
+        out_headers->raw = flight->headers;
     }
+    return flight->success;
+}
 
-    if (!bResults) {
-        DWORD err = GetLastError();
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
-        out_error.reset();
-        out_error << "Request failed (error " << (int)err << ")";
+bool nsync_http_client::get_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error, DWORD timeout_ms,
+                                 http_response_headers* out_headers, request_priority priority, abort_callback& p_abort) {
+    pfc::array_t<uint8_t> data;
+    if (!shared_get(url, timeout_ms, data, out_error, out_headers, priority, p_abort)) {
         return false;
     }
+    out_response.set_string((const char*)data.get_ptr(), data.get_size());
+    return true;
+}
 
-    // Check status code
-    DWORD statusCode = 0;
-    DWORD statusCodeSize = sizeof(statusCode);
-    WinHttpQueryHeaders(
-        hRequest,
-        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-        WINHTTP_HEADER_NAME_BY_INDEX,
-        &statusCode,
-        &statusCodeSize,
-        WINHTTP_NO_HEADER_INDEX
-    );
-
-    if (statusCode != 200) {
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
-        out_error.reset();
-        out_error << "HTTP " << (int)statusCode;
+bool nsync_http_client::get_binary_sync(const char* url, pfc::array_t<uint8_t>& out_data, pfc::string8& out_error,
+                                        request_priority priority, abort_callback& p_abort) {
+    // 2 seconds for artwork - must be fast to not block UI
+    if (!shared_get(url, 2000, out_data, out_error, nullptr, priority, p_abort)) {
         return false;
     }
+    return out_data.get_size() > 0;
+}
 
-    // Read binary response
-    out_data.set_size(0);
-    DWORD dwSize = 0;
-    DWORD dwDownloaded = 0;
-
-    do {
-        dwSize = 0;
-        if (!WinHttpQueryDataAvailable(hRequest, &dwSize)) break;
-        if (dwSize == 0) break;
-
-        size_t current_size = out_data.get_size();
-        out_data.set_size(current_size + dwSize);
+bool nsync_http_client::get_stream_sync(const char* url, const chunk_callback& on_chunk, pfc::string8& out_error,
+                                        DWORD timeout_ms, request_priority priority, abort_callback& p_abort) {
+    // Not coalesced: each caller consumes its own copy of the body as it arrives
+    return fetch_get(url, timeout_ms, on_chunk, out_error, nullptr, priority, p_abort);
+}
 
-        if (WinHttpReadData(hRequest, out_data.get_ptr() + current_size, dwSize, &dwDownloaded)) {
-            // Adjust size if we read less than expected
-            if (dwDownloaded < dwSize) {
-                out_data.set_size(current_size + dwDownloaded);
-            }
-        } else {
-            out_data.set_size(current_size);
-            break;
-        }
-    } while (dwSize > 0);
+void nsync_http_client::get_stream_async(const char* url, chunk_callback on_chunk, completion_callback on_complete,
+                                         request_priority priority, abort_callback& p_abort) {
+    pfc::string8 url_copy(url);
+    abort_callback* abort = &p_abort;
 
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
+    start_worker([this, url_copy, on_chunk, on_complete, priority, abort]() {
+        pfc::string8 error;
+        bool success = get_stream_sync(url_copy, on_chunk, error, 5000, priority, *abort);
 
-    return out_data.get_size() > 0;
+        complete_in_main_thread([on_complete, success, error]() {
+            on_complete(success, pfc::string8(), error);
+        });
+    });
 }
 
-void nsync_http_client::get_async(const char* url, completion_callback callback) {
+void nsync_http_client::get_async(const char* url, completion_callback callback, request_priority priority,
+                                  abort_callback& p_abort) {
     pfc::string8 url_copy(url);
+    abort_callback* abort = &p_abort;
 
-    std::thread([url_copy, callback]() {
+    start_worker([this, url_copy, callback, priority, abort]() {
         pfc::string8 response, error;
-        bool success = nsync_http_client::get().get_sync(url_copy, response, error);
+        bool success = get_sync(url_copy, response, error, 5000, nullptr, priority, *abort);
 
         // Invoke callback on main thread
-        fb2k::inMainThread([callback, success, response, error]() {
+        complete_in_main_thread([callback, success, response, error]() {
             callback(success, response, error);
         });
-    }).detach();
+    });
 }
 
-bool nsync_http_client::post_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error) {
+bool nsync_http_client::post_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error,
+                                  request_priority priority, abort_callback& p_abort) {
+    out_response.reset();
+    // 10 seconds for sync operations - may need to scan directories
+    return fetch_post(url, 10000, [&out_response](const uint8_t* data, size_t size) {
+        out_response.add_string((const char*)data, size);
+    }, out_error, priority, p_abort);
+}
+
+void nsync_http_client::post_lines_async(const char* url, DWORD timeout_ms, line_callback on_line,
+                                         completion_callback on_complete, request_priority priority,
+                                         abort_callback& p_abort) {
+    pfc::string8 url_copy(url);
+    abort_callback* abort = &p_abort;
+
+    start_worker([this, url_copy, timeout_ms, on_line, on_complete, priority, abort]() {
+        // Complete lines go to the main thread as they arrive; a partial one waits for the rest
+        pfc::string8 partial, error;
+        bool success = fetch_post(url_copy, timeout_ms, [this, &partial, on_line](const uint8_t* data, size_t size) {
+            partial.add_string((const char*)data, size);
+            const char* start = partial.c_str();
+            const char* newline;
+            while ((newline = strchr(start, '\n')) != nullptr) {
+                pfc::string8 line;
+                line.set_string(start, newline - start);
+                complete_in_main_thread([on_line, line]() { on_line(line); });
+                start = newline + 1;
+            }
+            pfc::string8 rest(start);
+            partial = rest;
+        }, error, priority, *abort);
+
+        // A last line without a newline is only complete if the body is
+        if (success && !partial.is_empty()) {
+            complete_in_main_thread([on_line, partial]() { on_line(partial); });
+        }
+        complete_in_main_thread([on_complete, success, error]() {
+            on_complete(success, pfc::string8(), error);
+        });
+    });
+}
+
+bool nsync_http_client::fetch_post(const char* url, DWORD timeout_ms, const chunk_callback& on_chunk,
+                                   pfc::string8& out_error, request_priority priority, abort_callback& p_abort) {
+    request_monitor monitor("POST", url, out_error);
+
     if (!m_session) {
         out_error = "HTTP session not initialized";
         return false;
     }
 
+    if (p_abort.is_aborted() || m_shutdown_abort.is_aborted()) {
+        out_error = "Aborted";
+        return false;
+    }
+
+    // Fail fast while the server is known to be down
+    if (!server_health::get().allow_request(url)) {
+        out_error = "Server unavailable";
+        return false;
+    }
+
     url_parts parts;
     if (!url_parts::parse(url, parts)) {
         out_error = "Invalid URL";
         return false;
     }
 
-    pfc::stringcvt::string_wide_from_utf8 wide_host(parts.host.c_str());
     pfc::stringcvt::string_wide_from_utf8 wide_path(parts.path.c_str());
 
-    HINTERNET hConnect = WinHttpConnect(
-        m_session,
-        wide_host.get_ptr(),
-        parts.port,
-        0
-    );
+    // Wait for a slot of this request's class
+    request_scheduler::slot slot(priority, p_abort);
+    if (!slot.acquired()) {
+        out_error = "Aborted";
+        return false;
+    }
+
+    connect_handle hConnect(m_session, parts);
 
     if (!hConnect) {
         DWORD err = GetLastError();
@@ -370,17 +674,21 @@ bool nsync_http_client::post_sync(const char* url, pfc::string8& out_response, p
 
     if (!hRequest) {
         DWORD err = GetLastError();
-        WinHttpCloseHandle(hConnect);
         out_error.reset();
         out_error << "Request creation failed (error " << (int)err << ")";
         return false;
     }
 
-    // Set timeouts (10 seconds for sync operations - may need to scan directories)
-    DWORD timeout = 10000;
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_CONNECT_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_SEND_TIMEOUT, &timeout, sizeof(timeout));
-    WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &timeout, sizeof(timeout));
+    // Closing the handle is the only way to interrupt a blocked WinHTTP call
+    request_abort_guard abort_guard(p_abort, m_shutdown_abort, hRequest);
+    monitor.attach(hRequest);
+
+    // timeout_ms covers the server's work (POST /sync may scan directories) before it answers.
+    // The link's usual response time comes on top, so a slow link does not eat into it
+    auto& estimator = link_estimator::get();
+    set_request_timeouts(hRequest, estimator.connect_timeout_ms(url, timeout_ms),
+        estimator.response_timeout_ms(url, timeout_ms, 2 * timeout_ms));
+    monitor.sent();
 
     BOOL bResults = WinHttpSendRequest(
         hRequest,
@@ -398,13 +706,23 @@ bool nsync_http_client::post_sync(const char* url, pfc::string8& out_response, p
 
     if (!bResults) {
         DWORD err = GetLastError();
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
+        if (abort_guard.aborted()) {
+            abort_guard.close();
+            out_error = "Aborted";
+            return false;
+        }
+        if (err == ERROR_WINHTTP_TIMEOUT) {
+            link_estimator::get().record_timeout(url);
+        }
+        server_health::get().record_failure(url);
+        abort_guard.close();
         out_error.reset();
         out_error << "Request failed (error " << (int)err << ")";
         return false;
     }
 
+    // No response-time sample: the time to headers includes the server's rescan
+
     // Check status code
     DWORD statusCode = 0;
     DWORD statusCodeSize = sizeof(statusCode);
@@ -416,50 +734,127 @@ bool nsync_http_client::post_sync(const char* url, pfc::string8& out_response, p
         &statusCodeSize,
         WINHTTP_NO_HEADER_INDEX
     );
+    monitor.headers_received(statusCode);
+
+    // Any answer below 500 means the server itself is up
+    if (statusCode >= 500) {
+        server_health::get().record_failure(url);
+    } else {
+        server_health::get().record_success(url);
+    }
 
     if (statusCode != 200) {
-        WinHttpCloseHandle(hRequest);
-        WinHttpCloseHandle(hConnect);
+        abort_guard.close();
         out_error.reset();
         out_error << "HTTP " << (int)statusCode;
         return false;
     }
 
-    // Read response
-    out_response.reset();
+    // A streamed reply may pause for server work between pieces, as long as before the headers
+    DWORD stall_timeout = std::max<DWORD>(link_estimator::get().stall_timeout_ms(url), timeout_ms);
+    WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &stall_timeout, sizeof(stall_timeout));
+    ULONGLONG body_started = GetTickCount64();
+
+    // Read response, handing each piece to the caller as it arrives
+    pfc::array_t<uint8_t> buffer;
+    size_t received = 0;
     DWORD dwSize = 0;
     DWORD dwDownloaded = 0;
+    DWORD read_error = ERROR_SUCCESS;
 
     do {
         dwSize = 0;
-        if (!WinHttpQueryDataAvailable(hRequest, &dwSize)) break;
+        if (!WinHttpQueryDataAvailable(hRequest, &dwSize)) {
+            read_error = GetLastError();
+            break;
+        }
         if (dwSize == 0) break;
 
-        pfc::array_t<char> buffer;
-        buffer.set_size(dwSize + 1);
-
-        if (WinHttpReadData(hRequest, buffer.get_ptr(), dwSize, &dwDownloaded)) {
-            buffer[dwDownloaded] = '\0';
-            out_response += buffer.get_ptr();
+        if (dwSize > buffer.get_size()) {
+            buffer.set_size(dwSize);
+        }
+        if (!WinHttpReadData(hRequest, buffer.get_ptr(), dwSize, &dwDownloaded)) {
+            read_error = GetLastError();
+            break;
         }
+
+        on_chunk(buffer.get_ptr(), dwDownloaded);
+        received += dwDownloaded;
+        monitor.received(dwDownloaded);
     } while (dwSize > 0);
 
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
+    abort_guard.close();
 
+    // A cancelled, stalled or reset read leaves a truncated body
+    if (abort_guard.aborted()) {
+        out_error = "Aborted";
+        return false;
+    }
+    if (read_error != ERROR_SUCCESS) {
+        if (read_error == ERROR_WINHTTP_TIMEOUT) {
+            link_estimator::get().record_timeout(url);
+        }
+        server_health::get().record_failure(url);
+        out_error.reset();
+        out_error << "Transfer interrupted (error " << (int)read_error << ")";
+        return false;
+    }
+    link_estimator::get().record_transfer(url, received, (DWORD)(GetTickCount64() - body_started));
     return true;
 }
 
-void nsync_http_client::post_async(const char* url, completion_callback callback) {
+void nsync_http_client::post_async(const char* url, completion_callback callback, request_priority priority,
+                                   abort_callback& p_abort) {
     pfc::string8 url_copy(url);
+    abort_callback* abort = &p_abort;
 
-    std::thread([url_copy, callback]() {
+    start_worker([this, url_copy, callback, priority, abort]() {
         pfc::string8 response, error;
-        bool success = nsync_http_client::get().post_sync(url_copy, response, error);
+        bool success = post_sync(url_copy, response, error, priority, *abort);
 
         // Invoke callback on main thread
-        fb2k::inMainThread([callback, success, response, error]() {
+        complete_in_main_thread([callback, success, response, error]() {
             callback(success, response, error);
         });
+    });
+}
+
+void nsync_http_client::start_worker(std::function<void()> work) {
+    {
+        std::lock_guard<std::mutex> lock(m_workers_mutex);
+        m_workers++;
+    }
+    std::thread([this, work]() mutable {
+        work();
+        work = nullptr;  // Captured state goes before the thread counts as finished
+        {
+            std::lock_guard<std::mutex> lock(m_workers_mutex);
+            m_workers--;
+        }
+        m_workers_cv.notify_all();
     }).detach();
 }
+
+void nsync_http_client::complete_in_main_thread(std::function<void()> completion) {
+    // Once shutdown has begun, the owners of completions are being torn down
+    if (m_shutdown_abort.is_aborted()) return;
+    fb2k::inMainThread([this, completion]() {
+        if (!m_shutdown_abort.is_aborted()) completion();
+    });
+}
+
+bool nsync_http_client::shutdown(DWORD timeout_ms) {
+    m_shutdown_abort.abort();
+    request_scheduler::get().shutdown();
+
+    std::unique_lock<std::mutex> lock(m_workers_mutex);
+    m_drained = m_workers_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return m_workers == 0; });
+    return m_drained;
+}
+
+void nsync_http_client::close_handles() {
+    if (m_session) {
+        WinHttpCloseHandle(m_session);
+        m_session = nullptr;
+    }
+}
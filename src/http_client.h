@@ -1,40 +1,134 @@
 #pragma once
 
 #include <pfc/pfc.h>
+#include <SDK/foobar2000.h>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <windows.h>
 #include <winhttp.h>
+#include "request_scheduler.h"
 
 #pragma comment(lib, "winhttp.lib")
 
+// Raw response headers, for callers that need more than the body
+struct http_response_headers {
+    pfc::string8 raw;  // CRLF separated, as returned by WinHTTP
+
+    // Case-insensitive lookup of a header value
+    bool find(const char* name, pfc::string8& out) const;
+};
+
+struct url_parts;
+
 // Async HTTP client using WinHTTP
 class nsync_http_client {
 public:
     using completion_callback = std::function<void(bool success, const pfc::string8& response, const pfc::string8& error)>;
+
+    // Receives one piece of a response body, on the thread performing the request
+    using chunk_callback = std::function<void(const uint8_t* data, size_t size)>;
+    using line_callback = std::function<void(const pfc::string8& line)>;
     
     static nsync_http_client& get();
     
+    // Every request takes an abort_callback: aborting it closes the WinHTTP handle,
+    // so a blocked request returns immediately with "Aborted".
+    // For the async variants the abort_callback must outlive the request.
+
     // Async GET request - callback invoked on main thread
-    void get_async(const char* url, completion_callback callback);
+    void get_async(const char* url, completion_callback callback, request_priority priority = request_priority::sync,
+                   abort_callback& p_abort = fb2k::noAbort);
     
     // Sync GET for simple cases (blocks calling thread)
-    bool get_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error);
+    bool get_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error, DWORD timeout_ms = 5000,
+                  http_response_headers* out_headers = nullptr, request_priority priority = request_priority::sync,
+                  abort_callback& p_abort = fb2k::noAbort);
 
     // Sync GET for binary data (images, etc.)
-    bool get_binary_sync(const char* url, pfc::array_t<uint8_t>& out_data, pfc::string8& out_error);
+    bool get_binary_sync(const char* url, pfc::array_t<uint8_t>& out_data, pfc::string8& out_error,
+                         request_priority priority = request_priority::interactive,
+                         abort_callback& p_abort = fb2k::noAbort);
+
+    // Streaming GET: the body is handed to on_chunk as it arrives instead of being buffered.
+    // On failure the chunks seen so far are a truncated body and must be discarded.
+    bool get_stream_sync(const char* url, const chunk_callback& on_chunk, pfc::string8& out_error,
+                         DWORD timeout_ms = 5000, request_priority priority = request_priority::sync,
+                         abort_callback& p_abort = fb2k::noAbort);
+
+    // As above on a worker thread; on_complete runs on the main thread afterwards with an empty response
+    void get_stream_async(const char* url, chunk_callback on_chunk, completion_callback on_complete,
+                          request_priority priority = request_priority::sync, abort_callback& p_abort = fb2k::noAbort);
 
     // Async POST request - callback invoked on main thread
-    void post_async(const char* url, completion_callback callback);
+    void post_async(const char* url, completion_callback callback, request_priority priority = request_priority::sync,
+                    abort_callback& p_abort = fb2k::noAbort);
 
     // Sync POST for simple cases (blocks calling thread)
-    bool post_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error);
+    bool post_sync(const char* url, pfc::string8& out_response, pfc::string8& out_error,
+                   request_priority priority = request_priority::sync, abort_callback& p_abort = fb2k::noAbort);
+
+    // POST whose reply is one result per line, written by the server as each is ready.
+    // on_line runs on the main thread for every complete line as it arrives, then
+    // on_complete (with an empty response). timeout_ms bounds the wait for the
+    // headers and for each further piece of the body.
+    void post_lines_async(const char* url, DWORD timeout_ms, line_callback on_line, completion_callback on_complete,
+                          request_priority priority = request_priority::sync, abort_callback& p_abort = fb2k::noAbort);
+
+    // Aborts every request, queued or running, drops completions not yet
+    // delivered, and waits up to timeout_ms for the async workers to finish.
+    // Returns false if some were still blocked when the time ran out.
+    bool shutdown(DWORD timeout_ms);
 
 private:
     nsync_http_client();
     ~nsync_http_client();
-    
+
+    // Async requests run on detached threads counted here, so shutdown can wait for them
+    void start_worker(std::function<void()> work);
+    void complete_in_main_thread(std::function<void()> completion);
+    void close_handles();
+
+    // One network GET, no coalescing; the body goes to on_chunk
+    bool fetch_get(const char* url, DWORD timeout_ms, const chunk_callback& on_chunk, pfc::string8& out_error,
+                   http_response_headers* out_headers, request_priority priority, abort_callback& p_abort);
+
+    // One network POST; the body goes to on_chunk
+    bool fetch_post(const char* url, DWORD timeout_ms, const chunk_callback& on_chunk, pfc::string8& out_error,
+                    request_priority priority, abort_callback& p_abort);
+
+    // Single-flight: concurrent GETs of the same URL share one fetch_get and all receive its result
+    bool shared_get(const char* url, DWORD timeout_ms, pfc::array_t<uint8_t>& out_data, pfc::string8& out_error,
+                    http_response_headers* out_headers, request_priority priority, abort_callback& p_abort);
+
+    struct inflight_request {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        bool success = false;
+        bool aborted = false;  // Leader was cancelled - waiters fetch for themselves
+        pfc::array_t<uint8_t> data;
+        pfc::string8 error;
+        pfc::string8 headers;
+    };
+
     HINTERNET m_session = nullptr;
+
+    std::mutex m_inflight_mutex;
+    std::map<pfc::string8, std::shared_ptr<inflight_request>> m_inflight;
+
+    abort_callback_impl m_shutdown_abort;
+    std::mutex m_workers_mutex;
+    std::condition_variable m_workers_cv;
+    size_t m_workers = 0;
+    bool m_drained = false;
+
+    // Bodies of shared_get fetches still downloading (see memory_budget)
+    std::atomic<size_t> m_buffered_bytes{ 0 };
+    size_t m_budget_id = 0;
 };
 
 // Helper to parse URL components
@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "link_estimator.h"
+#include "server_health.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    const double RTT_GAIN = 0.125;        // Weight of a new response-time sample
+    const double RTTVAR_GAIN = 0.25;
+    const double THROUGHPUT_GAIN = 0.25;
+
+    const DWORD CONNECT_MIN_MS = 400;     // Still above a cold TLS handshake on a LAN
+    const DWORD RESPONSE_MIN_MS = 1000;   // Leaves a LAN server room for a slow moment
+    const DWORD STALL_MIN_MS = 3000;
+    const DWORD STALL_MAX_MS = 30000;
+    const DWORD STALL_DEFAULT_MS = 10000;  // Before the first sample
+    const unsigned MAX_BACKOFF = 3;        // Deadline grows at most 8x after timeouts
+
+    // Bodies below this say more about latency than throughput
+    const size_t MIN_THROUGHPUT_SAMPLE_BYTES = 32 * 1024;
+
+    // One WinHttpReadData worth of data; a healthy link delivers it well within the stall timeout
+    const double READ_CHUNK_BYTES = 64 * 1024;
+}
+
+link_estimator& link_estimator::get() {
+    static link_estimator instance;
+    return instance;
+}
+
+double link_estimator::timeout_base_ms(const link_state& state) const {
+    return state.srtt_ms + 4 * state.rttvar_ms;
+}
+
+double link_estimator::backoff_factor(const link_state& state) const {
+    return (double)(1u << std::min(state.backoff, MAX_BACKOFF));
+}
+
+DWORD link_estimator::connect_timeout_ms(const char* url, DWORD cap_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_links.find(server_health::origin_of(url));
+    if (it == m_links.end() || it->second.srtt_ms == 0) {
+        return cap_ms;
+    }
+
+    // The response-time samples include server work, so twice that is ample for connecting.
+    // The backoff applies on top of the floor, so a LAN link also gets past a lost SYN
+    double timeout = std::max((double)CONNECT_MIN_MS, 2 * timeout_base_ms(it->second));
+    return (DWORD)std::min((double)cap_ms, timeout * backoff_factor(it->second));
+}
+
+DWORD link_estimator::response_timeout_ms(const char* url, DWORD work_ms, DWORD cap_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_links.find(server_health::origin_of(url));
+    if (it == m_links.end() || it->second.srtt_ms == 0) {
+        return cap_ms;
+    }
+
+    // The backoff widens the link's share only; the server's work takes as long on any link
+    double timeout = std::max((double)RESPONSE_MIN_MS, 2 * timeout_base_ms(it->second)) * backoff_factor(it->second);
+    return (DWORD)std::min((double)cap_ms, timeout + work_ms);
+}
+
+double link_estimator::response_time_ms(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_links.find(server_health::origin_of(url));
+    if (it == m_links.end() || it->second.srtt_ms == 0) {
+        return -1.0;
+    }
+    return it->second.srtt_ms;
+}
+
+DWORD link_estimator::stall_timeout_ms(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_links.find(server_health::origin_of(url));
+    if (it == m_links.end() || it->second.srtt_ms == 0) {
+        return STALL_DEFAULT_MS;
+    }
+
+    double timeout = 4 * timeout_base_ms(it->second);
+    if (it->second.bytes_per_sec > 0) {
+        timeout = std::max(timeout, 4 * READ_CHUNK_BYTES * 1000.0 / it->second.bytes_per_sec);
+    }
+    timeout = std::max((double)STALL_MIN_MS, timeout) * backoff_factor(it->second);
+    return (DWORD)std::min((double)STALL_MAX_MS, timeout);
+}
+
+void link_estimator::record_response_time(const char* url, DWORD ms) {
+    pfc::string8 origin = server_health::origin_of(url);
+    if (origin.is_empty()) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& state = m_links[origin];
+    double sample = (double)std::max<DWORD>(ms, 1);
+
+    if (state.srtt_ms == 0) {
+        state.srtt_ms = sample;
+        state.rttvar_ms = sample / 2;
+    } else {
+        state.rttvar_ms += RTTVAR_GAIN * (std::fabs(state.srtt_ms - sample) - state.rttvar_ms);
+        state.srtt_ms += RTT_GAIN * (sample - state.srtt_ms);
+    }
+    state.backoff = 0;
+}
+
+void link_estimator::record_transfer(const char* url, size_t bytes, DWORD ms) {
+    if (bytes < MIN_THROUGHPUT_SAMPLE_BYTES) return;
+
+    pfc::string8 origin = server_health::origin_of(url);
+    if (origin.is_empty()) return;
+
+    // Rate-capped transfers under-report the link; that only errs towards longer stall timeouts
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& state = m_links[origin];
+    double sample = bytes * 1000.0 / std::max<DWORD>(ms, 1);
+    if (state.bytes_per_sec == 0) {
+        state.bytes_per_sec = sample;
+    } else {
+        state.bytes_per_sec += THROUGHPUT_GAIN * (sample - state.bytes_per_sec);
+    }
+}
+
+void link_estimator::record_timeout(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_links.find(server_health::origin_of(url));
+    if (it != m_links.end() && it->second.backoff < MAX_BACKOFF) {
+        it->second.backoff++;
+    }
+}
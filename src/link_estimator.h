@@ -0,0 +1,58 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <map>
+#include <mutex>
+#include <windows.h>
+
+// Per-server (scheme://host:port) latency and throughput estimates, used to
+// size request timeouts instead of fixed per-call-site values. A dead LAN
+// host is given up on after a few of its usual round trips; a slow link gets
+// as long as it needs, and a transfer that keeps making progress is never cut
+// off - only one that stops receiving data.
+class link_estimator {
+public:
+    static link_estimator& get();
+
+    // Connect/send deadline: a multiple of the server's usual response time,
+    // never above `cap_ms` (the caller's budget, also used until there are samples)
+    DWORD connect_timeout_ms(const char* url, DWORD cap_ms);
+
+    // Wait for response headers: a multiple of the server's usual response time,
+    // plus `work_ms` of server work the samples do not cover (a rescan), never
+    // above `cap_ms` (also used until there are samples)
+    DWORD response_timeout_ms(const char* url, DWORD work_ms, DWORD cap_ms);
+
+    // Smoothed time from request to response headers, -1 before the first sample
+    double response_time_ms(const char* url);
+
+    // Longest wait for the next piece of a response body before the transfer counts as stalled
+    DWORD stall_timeout_ms(const char* url);
+
+    // Time from sending a request to its response headers. Not for requests
+    // whose server work varies widely (POST /sync rescans directories)
+    void record_response_time(const char* url, DWORD ms);
+
+    // A completed body: `bytes` received in `ms`
+    void record_transfer(const char* url, size_t bytes, DWORD ms);
+
+    // A connect/send timed out: widen the deadline until the next good sample
+    void record_timeout(const char* url);
+
+private:
+    link_estimator() = default;
+
+    // Smoothed estimates in the style of TCP's retransmission timer (RFC 6298)
+    struct link_state {
+        double srtt_ms = 0;        // 0 = no sample yet
+        double rttvar_ms = 0;
+        double bytes_per_sec = 0;  // 0 = no sample yet
+        unsigned backoff = 0;      // Consecutive timeouts
+    };
+
+    double timeout_base_ms(const link_state& state) const;  // RTO, before backoff
+    double backoff_factor(const link_state& state) const;
+
+    std::mutex m_mutex;
+    std::map<pfc::string8, link_state> m_links;
+};
@@ -0,0 +1,51 @@
+#include "m3u8_parser.h"
+
+m3u8_stream_parser::m3u8_stream_parser(entry_callback on_entry) : m_on_entry(std::move(on_entry)) {
+}
+
+void m3u8_stream_parser::feed(const char* data, size_t size) {
+    const char* ptr = data;
+    const char* end = data + size;
+
+    while (ptr < end) {
+        const char* line_end = ptr;
+        while (line_end < end && *line_end != '\n' && *line_end != '\r') {
+            ++line_end;
+        }
+
+        if (line_end == end) {
+            // Unterminated - wait for the rest of the line
+            m_partial.append(ptr, line_end - ptr);
+            return;
+        }
+
+        if (m_partial.empty()) {
+            parse_line(ptr, line_end - ptr);
+        } else {
+            m_partial.append(ptr, line_end - ptr);
+            parse_line(m_partial.data(), m_partial.size());
+            m_partial.clear();
+        }
+        ptr = line_end + 1;
+    }
+}
+
+void m3u8_stream_parser::finish() {
+    if (!m_partial.empty()) {
+        parse_line(m_partial.data(), m_partial.size());
+        m_partial.clear();
+    }
+}
+
+void m3u8_stream_parser::parse_line(const char* line, size_t length) {
+    // Trim trailing whitespace (and the \r of a \r\n split across pieces)
+    while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t' || line[length - 1] == '\r')) {
+        --length;
+    }
+
+    // Skip empty lines and comments/directives
+    if (length == 0 || line[0] == '#') {
+        return;
+    }
+    m_on_entry(line, length);
+}
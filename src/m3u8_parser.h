@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Incremental m3u8 reader. The playlist text can be fed in pieces of any size
+// (a line may be split across pieces); each track entry is handed to the
+// callback as soon as its line is complete, so parsing keeps pace with the
+// download instead of starting after it.
+// Free of foobar2000 types (and built without the precompiled header) so
+// bench/ can drive it headless.
+class m3u8_stream_parser {
+public:
+    // Called once per entry, in playlist order (not null-terminated)
+    using entry_callback = std::function<void(const char* path, size_t length)>;
+
+    explicit m3u8_stream_parser(entry_callback on_entry);
+
+    void feed(const char* data, size_t size);
+
+    // End of input: emits a last line that had no line break
+    void finish();
+
+private:
+    void parse_line(const char* line, size_t length);
+
+    entry_callback m_on_entry;
+    std::string m_partial;  // Start of a line whose end has not arrived yet
+};
@@ -10,7 +10,8 @@ DECLARE_COMPONENT_VERSION(
     "  /status - Health check\n"
     "  /list - Available playlists\n"
     "  /hash/{name} - Playlist hash\n"
-    "  /playlist/{name} - Download playlist\n\n"
+    "  /playlist/{name} - Download playlist\n"
+    "  /search?q={query} - Search the library\n\n"
     "https://github.com/jame25/foo_nsync"
 );
 
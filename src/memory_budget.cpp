@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "memory_budget.h"
+#include "config.h"
+#include <algorithm>
+
+memory_budget& memory_budget::get() {
+    static memory_budget instance;
+    return instance;
+}
+
+size_t memory_budget::add(const char* name, unsigned order, usage_callback usage, trim_callback trim) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    consumer entry;
+    entry.id = m_next_id++;
+    entry.name = name;
+    entry.order = order;
+    entry.usage = std::move(usage);
+    entry.trim = std::move(trim);
+
+    // Registration order within the same trim order is kept
+    auto pos = std::upper_bound(m_consumers.begin(), m_consumers.end(), order,
+        [](unsigned value, const consumer& c) { return value < c.order; });
+    m_consumers.insert(pos, std::move(entry));
+    return m_next_id - 1;
+}
+
+void memory_budget::remove(size_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_consumers.erase(std::remove_if(m_consumers.begin(), m_consumers.end(),
+        [id](const consumer& c) { return c.id == id; }), m_consumers.end());
+}
+
+size_t memory_budget::get_budget_bytes() const {
+    return (size_t)sync_config::get_memory_budget_mb() * 1024 * 1024;
+}
+
+void memory_budget::enforce() {
+    size_t budget = get_budget_bytes();
+    if (budget == 0) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t total = 0;
+    for (const auto& c : m_consumers) total += c.usage();
+
+    for (const auto& c : m_consumers) {
+        if (total <= budget) break;
+        if (!c.trim) continue;
+        size_t freed = std::min(c.trim(total - budget), total);
+        total -= freed;
+        m_trimmed += freed;
+    }
+}
+
+std::vector<memory_budget::consumer_usage> memory_budget::get_usage(size_t& out_total) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<consumer_usage> result;
+    out_total = 0;
+    for (const auto& c : m_consumers) {
+        size_t bytes = c.usage();
+        out_total += bytes;
+
+        auto it = std::find_if(result.begin(), result.end(),
+            [&c](const consumer_usage& u) { return u.name == c.name; });
+        if (it == result.end()) {
+            consumer_usage usage;
+            usage.name = c.name;
+            usage.trimmable = (bool)c.trim;
+            result.push_back(usage);
+            it = result.end() - 1;
+        }
+        it->bytes += bytes;
+        it->instances++;
+    }
+    return result;
+}
+
+uint64_t memory_budget::get_trimmed_bytes() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_trimmed;
+}
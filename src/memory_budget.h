@@ -0,0 +1,70 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// Live memory of the component's caches and sync buffers, held against the
+// budget in Advanced > Tools > Playlist Sync. Owners register a usage callback,
+// and caches a trim callback as well. When the total goes over the budget,
+// enforce() trims the caches in ascending trim order until it fits again.
+// Buffers of a sync in progress are counted but cannot be trimmed, so a large
+// sync squeezes the caches rather than adding to them.
+class memory_budget {
+public:
+    static memory_budget& get();
+
+    // Approximate live bytes. Called with the registry locked: must not call back in
+    using usage_callback = std::function<size_t()>;
+    // Frees at least `bytes` if it can; returns what was freed
+    using trim_callback = std::function<size_t(size_t bytes)>;
+
+    // Caches go first when they are cheapest to refill
+    enum trim_order : unsigned {
+        trim_artwork_cache = 0,   // One request per album to refill
+        trim_known_missing = 1,   // One failed request per URL to relearn
+        trim_never = 0xffffffff,  // Sync and response buffers
+    };
+
+    // Returns an id for remove(); several owners may share a name (one per sync)
+    size_t add(const char* name, unsigned order, usage_callback usage, trim_callback trim = nullptr);
+    void remove(size_t id);
+
+    // Trims caches while the total is over budget. Call after growing, and
+    // never while holding a lock that a usage or trim callback takes
+    void enforce();
+
+    // From Advanced preferences; 0 = unlimited
+    size_t get_budget_bytes() const;
+
+    struct consumer_usage {
+        pfc::string8 name;
+        size_t bytes = 0;
+        size_t instances = 0;
+        bool trimmable = false;
+    };
+
+    // One entry per name, in trim order
+    std::vector<consumer_usage> get_usage(size_t& out_total);
+
+    // Freed by trimming since startup
+    uint64_t get_trimmed_bytes();
+
+private:
+    memory_budget() = default;
+
+    struct consumer {
+        size_t id = 0;
+        pfc::string8 name;
+        unsigned order = trim_never;
+        usage_callback usage;
+        trim_callback trim;
+    };
+
+    std::mutex m_mutex;
+    std::vector<consumer> m_consumers;  // Sorted by trim order
+    size_t m_next_id = 1;
+    uint64_t m_trimmed = 0;
+};
@@ -2,6 +2,40 @@
 #include "preferences.h"
 #include "guids.h"
 #include "sync_manager.h"
+#include "server_discovery.h"
+#include "diagnostics.h"
+
+namespace {
+    const UINT_PTR TIMER_STATUS_FLUSH = 1;
+    const UINT_PTR TIMER_DIAGNOSTICS = 2;
+    const UINT STATUS_FLUSH_MS = 100;
+    const UINT DIAGNOSTICS_REFRESH_MS = 1000;
+
+    pfc::string8 format_bytes(double bytes) {
+        char text[32];
+        if (bytes < 1024) sprintf_s(text, "%.0f B", bytes);
+        else if (bytes < 1024 * 1024) sprintf_s(text, "%.1f KB", bytes / 1024);
+        else sprintf_s(text, "%.1f MB", bytes / (1024 * 1024));
+        return text;
+    }
+
+    pfc::string8 format_ratio(double ratio) {
+        if (ratio < 0) return "-";
+        char text[16];
+        sprintf_s(text, "%.0f%%", ratio * 100);
+        return text;
+    }
+
+    pfc::string8 format_count(double value) {
+        char text[32];
+        sprintf_s(text, value == (double)(int64_t)value ? "%.0f" : "%.1f", value);
+        return text;
+    }
+
+    struct diagnostics_row {
+        pfc::string8 metric, now, history;
+    };
+}
 
 // Edit job dialog implementation
 BOOL CEditJobDialog::OnInitDialog(CWindow, LPARAM) {
@@ -41,6 +75,37 @@ void CEditJobDialog::OnCancel(UINT, int, CWindow) {
     EndDialog(IDCANCEL);
 }
 
+void CEditJobDialog::OnDiscover(UINT, int, CWindow) {
+    std::vector<discovered_server> servers;
+    HCURSOR previous = SetCursor(LoadCursor(nullptr, IDC_WAIT));
+    server_discovery::get().browse(1500, servers);
+    SetCursor(previous);
+
+    if (servers.empty()) {
+        MessageBox(L"No servers found on the local network.", L"foo_nsync", MB_ICONINFORMATION);
+        return;
+    }
+
+    size_t chosen = 0;
+    if (servers.size() > 1) {
+        HMENU menu = CreatePopupMenu();
+        for (size_t i = 0; i < servers.size(); ++i) {
+            pfc::string8 label;
+            label << servers[i].name << " (" << servers[i].url << ")";
+            AppendMenu(menu, MF_STRING, (UINT_PTR)(i + 1), pfc::stringcvt::string_os_from_utf8(label.c_str()));
+        }
+
+        RECT rc;
+        GetDlgItem(IDC_DISCOVER).GetWindowRect(&rc);
+        int cmd = TrackPopupMenu(menu, TPM_RETURNCMD | TPM_NONOTIFY, rc.left, rc.bottom, 0, m_hWnd, nullptr);
+        DestroyMenu(menu);
+        if (cmd <= 0) return;
+        chosen = (size_t)cmd - 1;
+    }
+
+    SetDlgItemText(IDC_SERVER_URL, pfc::stringcvt::string_os_from_utf8(servers[chosen].url.c_str()));
+}
+
 // Main preferences page implementation
 BOOL CPreferencesPage::OnInitDialog(CWindow, LPARAM) {
     m_dark.AddDialogWithControls(*this);
@@ -68,6 +133,15 @@ BOOL CPreferencesPage::OnInitDialog(CWindow, LPARAM) {
     PopulateList();
     UpdateButtons();
     
+    // Diagnostics list, refreshed on a timer while the page is open
+    m_diagnostics = GetDlgItem(IDC_DIAGNOSTICS);
+    m_diagnostics.SetExtendedListViewStyle(LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER);
+    m_diagnostics.InsertColumn(0, L"Metric", LVCFMT_LEFT, 140);
+    m_diagnostics.InsertColumn(1, L"Now", LVCFMT_LEFT, 90);
+    m_diagnostics.InsertColumn(2, L"Last 5 minutes", LVCFMT_LEFT, 200);
+    RefreshDiagnostics();
+    SetTimer(TIMER_DIAGNOSTICS, DIAGNOSTICS_REFRESH_MS);
+    
     // Register callback
     sync_manager::get().add_callback(this);
     
@@ -77,37 +151,154 @@ BOOL CPreferencesPage::OnInitDialog(CWindow, LPARAM) {
 void CPreferencesPage::OnDestroy() {
     // Unregister callback
     sync_manager::get().remove_callback(this);
+    KillTimer(TIMER_DIAGNOSTICS);
+    KillTimer(TIMER_STATUS_FLUSH);
 }
 
-void CPreferencesPage::on_sync_progress(size_t job_index, const char* status, int percent) {
-    // Update list status column
-    if (job_index < m_jobs.size()) {
-        pfc::stringcvt::string_wide_from_utf8 wide_status(status);
-        m_list.SetItemText(job_index, 4, wide_status);
+void CPreferencesPage::OnTimer(UINT_PTR id) {
+    if (id == TIMER_STATUS_FLUSH) {
+        KillTimer(TIMER_STATUS_FLUSH);
+        m_flush_scheduled = false;
+        FlushStatus();
+    } else if (id == TIMER_DIAGNOSTICS) {
+        RefreshDiagnostics();
     }
-    
-    // Update active status label if selected
+}
+
+void CPreferencesPage::on_sync_progress(size_t job_index, const char* status, int percent) {
+    auto& pending = m_pending_status[job_index];
+    pending.list_text = status;
+    pending.detail.reset();
+    pending.detail << status << " (" << percent << "%)";
+    ScheduleStatusFlush();
+}
+
+void CPreferencesPage::on_sync_complete(size_t job_index, const char* status) {
+    auto& pending = m_pending_status[job_index];
+    pending.list_text = status;
+    pending.detail = status;
+    ScheduleStatusFlush();
+}
+
+void CPreferencesPage::ScheduleStatusFlush() {
+    if (m_flush_scheduled) return;
+    m_flush_scheduled = true;
+    SetTimer(TIMER_STATUS_FLUSH, STATUS_FLUSH_MS);
+}
+
+void CPreferencesPage::FlushStatus() {
     int sel = m_list.GetSelectedIndex();
-    if (sel >= 0 && (size_t)sel == job_index) {
-        pfc::string8 msg;
-        msg << status << " (" << percent << "%)";
-        pfc::stringcvt::string_wide_from_utf8 wide_msg(msg);
-        SetDlgItemText(IDC_STATUS, wide_msg);
+    for (const auto& entry : m_pending_status) {
+        size_t job_index = entry.first;
+
+        // Update list status column
+        if (job_index < m_jobs.size()) {
+            m_list.SetItemText((int)job_index, 4, pfc::stringcvt::string_wide_from_utf8(entry.second.list_text.c_str()));
+        }
+
+        // Update active status label if selected
+        if (sel >= 0 && (size_t)sel == job_index) {
+            SetDlgItemText(IDC_STATUS, pfc::stringcvt::string_wide_from_utf8(entry.second.detail.c_str()));
+        }
     }
+    m_pending_status.clear();
 }
 
-void CPreferencesPage::on_sync_complete(size_t job_index, const char* status) {
-    // Update list status column
-    if (job_index < m_jobs.size()) {
-        pfc::stringcvt::string_wide_from_utf8 wide_status(status);
-        m_list.SetItemText(job_index, 4, wide_status);
+void CPreferencesPage::RefreshDiagnostics() {
+    diagnostics::report report = diagnostics::get().get_report();
+    std::vector<diagnostics_row> rows;
+
+    auto add_row = [&rows](const char* metric, const pfc::string8& now, const pfc::string8& history) {
+        diagnostics_row row;
+        row.metric = metric;
+        row.now = now;
+        row.history = history;
+        rows.push_back(row);
+    };
+    auto gauge_history = [](const diagnostics::stat& stat) {
+        pfc::string8 text;
+        text << "avg " << format_count(stat.average) << ", peak " << format_count(stat.peak);
+        return text;
+    };
+
+    add_row("Requests in flight", format_count(report.requests_active.now), gauge_history(report.requests_active));
+    add_row("Requests queued", format_count(report.requests_queued.now), gauge_history(report.requests_queued));
+
+    pfc::string8 opened;
+    opened << pfc::format_uint(report.connections_opened) << " connections opened since startup";
+    add_row("Connection reuse", format_ratio(report.connection_reuse), opened);
+
+    for (const auto& server : report.servers) {
+        pfc::string8 metric, rate, history;
+        metric << server.origin;
+        rate << format_bytes(server.bytes_per_sec.now) << "/s";
+        history << "avg " << format_bytes(server.bytes_per_sec.average) << "/s, peak "
+                << format_bytes(server.bytes_per_sec.peak) << "/s";
+        add_row(metric, rate, history);
+
+        pfc::string8 circuit;
+        if (server.circuit_open) circuit = "Open (failing fast)";
+        else if (server.consecutive_failures > 0) circuit << "Closed, " << server.consecutive_failures << " recent failures";
+        else circuit = "Closed";
+        add_row("  Circuit breaker", circuit, "");
     }
-    
-    // Update active status label if selected
-    int sel = m_list.GetSelectedIndex();
-    if (sel >= 0 && (size_t)sel == job_index) {
-        pfc::stringcvt::string_wide_from_utf8 wide_msg(status);
-        SetDlgItemText(IDC_STATUS, wide_msg);
+
+    pfc::string8 cache_now, cache_history;
+    cache_now << format_count(report.artwork_entries.now) << " images, " << format_bytes(report.artwork_bytes.now);
+    cache_history << "peak " << format_count(report.artwork_entries.peak) << " images, " << format_bytes(report.artwork_bytes.peak);
+    add_row("Artwork cache", cache_now, cache_history);
+
+    pfc::string8 lookups;
+    lookups << pfc::format_uint(report.artwork_lookups) << " lookups";
+    add_row("Artwork hit rate", format_ratio(report.artwork_hit_rate), lookups);
+    add_row("Artwork known missing", format_count(report.known_missing.now), gauge_history(report.known_missing));
+
+    pfc::string8 memory_now, memory_history;
+    memory_now << format_bytes(report.memory_total.now);
+    if (report.memory_budget_bytes > 0) memory_now << " of " << format_bytes((double)report.memory_budget_bytes);
+    memory_history << "avg " << format_bytes(report.memory_total.average) << ", peak "
+                   << format_bytes(report.memory_total.peak) << ", " << format_bytes((double)report.memory_trimmed)
+                   << " trimmed";
+    add_row("Memory", memory_now, memory_history);
+    for (const auto& consumer : report.memory) {
+        pfc::string8 metric, note;
+        metric << "  " << consumer.name;
+        if (consumer.instances > 1) note << pfc::format_uint(consumer.instances) << " in use, ";
+        note << (consumer.trimmable ? "trimmed over budget" : "not trimmable");
+        add_row(metric, format_bytes((double)consumer.bytes), note);
+    }
+
+    for (const auto& job : report.sync_phases) {
+        if (job.first >= m_jobs.size() || job.second.empty()) continue;
+        pfc::string8 metric, total, phases;
+        metric << "Last sync: " << m_jobs[job.first].target_playlist;
+        uint64_t total_ms = 0;
+        for (const auto& timing : job.second) {
+            total_ms += timing.ms;
+            if (!phases.is_empty()) phases << ", ";
+            phases << timing.phase << " " << pfc::format_uint(timing.ms) << " ms";
+        }
+        total << pfc::format_uint(total_ms) << " ms";
+        add_row(metric, total, phases);
+    }
+
+    // Rewrite only cells that changed, so the list does not flicker
+    if ((size_t)m_diagnostics.GetItemCount() != rows.size()) {
+        m_diagnostics.DeleteAllItems();
+        for (size_t i = 0; i < rows.size(); ++i) {
+            m_diagnostics.InsertItem((int)i, L"");
+        }
+    }
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const pfc::string8* cells[] = { &rows[i].metric, &rows[i].now, &rows[i].history };
+        for (int column = 0; column < 3; ++column) {
+            pfc::stringcvt::string_wide_from_utf8 wide(cells[column]->c_str());
+            CString current;
+            m_diagnostics.GetItemText((int)i, column, current);
+            if (current != wide.get_ptr()) {
+                m_diagnostics.SetItemText((int)i, column, wide);
+            }
+        }
     }
 }
 
@@ -8,6 +8,7 @@
 #include "resource.h"
 #include "config.h"
 #include "sync_manager.h"
+#include <map>
 
 // Edit job dialog
 class CEditJobDialog : public CDialogImpl<CEditJobDialog> {
@@ -20,12 +21,14 @@ public:
         MSG_WM_INITDIALOG(OnInitDialog)
         COMMAND_ID_HANDLER_EX(IDOK, OnOK)
         COMMAND_ID_HANDLER_EX(IDCANCEL, OnCancel)
+        COMMAND_ID_HANDLER_EX(IDC_DISCOVER, OnDiscover)
     END_MSG_MAP()
     
 private:
     BOOL OnInitDialog(CWindow, LPARAM);
     void OnOK(UINT, int, CWindow);
     void OnCancel(UINT, int, CWindow);
+    void OnDiscover(UINT, int, CWindow);
     
     SyncJob& m_job;
     fb2k::CDarkModeHooks m_dark;
@@ -49,6 +52,7 @@ public:
     BEGIN_MSG_MAP_EX(CPreferencesPage)
         MSG_WM_INITDIALOG(OnInitDialog)
         MSG_WM_DESTROY(OnDestroy)
+        MSG_WM_TIMER(OnTimer)
         COMMAND_HANDLER_EX(IDC_ENABLED, BN_CLICKED, OnEnabledChanged)
         COMMAND_HANDLER_EX(IDC_ENABLED, BN_CLICKED, OnEnabledChanged)
         COMMAND_HANDLER_EX(IDC_ADD, BN_CLICKED, OnAdd)
@@ -62,6 +66,7 @@ public:
 private:
     BOOL OnInitDialog(CWindow, LPARAM);
     void OnDestroy();
+    void OnTimer(UINT_PTR id);
     void OnEnabledChanged(UINT, int, CWindow);
     void OnAdd(UINT, int, CWindow);
     void OnEdit(UINT, int, CWindow);
@@ -74,9 +79,23 @@ private:
     void UpdateButtons();
     void OnChanged();
     bool HasChanged();
+
+    // Sync callbacks come in bursts: they only record the latest status per job,
+    // and the controls are updated from a short timer at most once per interval
+    void ScheduleStatusFlush();
+    void FlushStatus();
+    void RefreshDiagnostics();
+
+    struct pending_status {
+        pfc::string8 list_text;  // Status column
+        pfc::string8 detail;     // Status line, shown for the selected job
+    };
+    std::map<size_t, pending_status> m_pending_status;
+    bool m_flush_scheduled = false;
     
     preferences_page_callback::ptr m_callback;
     CListViewCtrl m_list;
+    CListViewCtrl m_diagnostics;
     fb2k::CDarkModeHooks m_dark;
     
     // Local copy for editing
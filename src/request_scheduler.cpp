@@ -0,0 +1,142 @@
+#include "stdafx.h"
+#include "request_scheduler.h"
+#include "config.h"
+#include <algorithm>
+
+namespace {
+    // Concurrent requests per class, and for all classes except playback together
+    const size_t CLASS_LIMITS[] = { 4, 4, 2, 1 };
+    const size_t TOTAL_LIMIT = 6;
+
+    // Bytes per second allowed for a class, 0 = unlimited. Called per chunk from
+    // artwork and worker threads, so the advconfig values are read directly
+    double rate_limit(request_priority priority) {
+        switch (priority) {
+        case request_priority::sync:       return sync_config::get_sync_rate_limit_kbps() * 1024.0;
+        case request_priority::background: return sync_config::get_background_rate_limit_kbps() * 1024.0;
+        default:                           return 0;  // Playback and interactive are never capped
+        }
+    }
+}
+
+request_scheduler& request_scheduler::get() {
+    static request_scheduler instance;
+    return instance;
+}
+
+request_scheduler::slot::slot(request_priority priority, abort_callback& p_abort)
+    : m_priority(priority), m_acquired(request_scheduler::get().acquire(priority, p_abort)) {
+}
+
+request_scheduler::slot::~slot() {
+    if (m_acquired) {
+        request_scheduler::get().release(m_priority);
+    }
+}
+
+void request_scheduler::slot::throttle(size_t bytes) {
+    request_scheduler::get().throttle(m_priority, bytes);
+}
+
+bool request_scheduler::can_start(size_t cls) const {
+    size_t limit = CLASS_LIMITS[cls];
+    if (m_playback_active && cls >= (size_t)request_priority::sync) limit = 1;
+    if (m_active[cls] >= limit) return false;
+    if (cls == 0) return true;  // Probes are tiny and decide routing - never queue them behind transfers
+    if (m_total_active >= TOTAL_LIMIT) return false;
+
+    for (size_t more_urgent = 0; more_urgent < cls; ++more_urgent) {
+        if (m_waiting[more_urgent] > 0) return false;
+    }
+    return true;
+}
+
+bool request_scheduler::acquire(request_priority priority, abort_callback& p_abort) {
+    size_t cls = (size_t)priority;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // Queued requests re-check their abort_callback so a skipped track's art leaves the queue
+    m_waiting[cls]++;
+    while (!m_cv.wait_for(lock, std::chrono::milliseconds(50), [this, cls]() { return m_shutdown || can_start(cls); })) {
+        if (p_abort.is_aborted()) {
+            m_waiting[cls]--;
+            lock.unlock();
+            m_cv.notify_all();  // Lower classes may have been held back by this waiter
+            return false;
+        }
+    }
+    m_waiting[cls]--;
+    if (m_shutdown) {
+        lock.unlock();
+        m_cv.notify_all();
+        return false;
+    }
+
+    m_active[cls]++;
+    if (cls != 0) m_total_active++;
+    return true;
+}
+
+void request_scheduler::release(request_priority priority) {
+    size_t cls = (size_t)priority;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_active[cls]--;
+        if (cls != 0) m_total_active--;
+    }
+    m_cv.notify_all();
+}
+
+void request_scheduler::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cv.notify_all();
+}
+
+void request_scheduler::set_playback_active(bool active) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_playback_active == active) return;
+        m_playback_active = active;
+    }
+    m_cv.notify_all();  // Waiters held back by the lower limit may start now
+}
+
+void request_scheduler::get_counts(size_t& active, size_t& waiting) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    active = waiting = 0;
+    for (size_t cls = 0; cls < CLASS_COUNT; ++cls) {
+        active += m_active[cls];
+        waiting += m_waiting[cls];
+    }
+}
+
+void request_scheduler::throttle(request_priority priority, size_t bytes) {
+    double limit = rate_limit(priority);
+    if (limit <= 0) return;
+
+    DWORD wait_ms = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_rate_mutex);
+        auto& rate = m_rates[(size_t)priority];
+        ULONGLONG now = GetTickCount64();
+
+        // Refill, allowing at most one second of burst
+        if (rate.last_refill == 0) rate.tokens = limit;
+        else rate.tokens = std::min(limit, rate.tokens + (now - rate.last_refill) * limit / 1000.0);
+        rate.last_refill = now;
+
+        rate.tokens -= (double)bytes;
+        if (rate.tokens < 0) {
+            wait_ms = (DWORD)(-rate.tokens * 1000.0 / limit);
+        }
+    }
+
+    if (wait_ms > 0) {
+        // Cut short by shutdown(); the request's handle is closed by then anyway
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait_for(lock, std::chrono::milliseconds(wait_ms), [this]() { return m_shutdown; });
+    }
+}
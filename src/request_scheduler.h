@@ -0,0 +1,81 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <SDK/foobar2000.h>
+#include <condition_variable>
+#include <mutex>
+#include <windows.h>
+
+// Request classes, most urgent first
+enum class request_priority {
+    playback,     // On the playback path: endpoint and health probes
+    interactive,  // Album art for what is on screen
+    sync,         // Playlist refreshes started at startup or by the user
+    background,   // Periodic polling
+};
+
+// Orders client HTTP requests by class. Each class has its own concurrency
+// limit, and a request only starts while no more urgent class is waiting,
+// so a large playlist download cannot hold up the art for the playing track.
+// The sync and background classes can also be capped in bytes per second
+// (Advanced > Tools > Playlist Sync).
+class request_scheduler {
+public:
+    static request_scheduler& get();
+
+    // Holds one concurrency slot of its class for its lifetime
+    class slot {
+    public:
+        // Waits for a slot unless p_abort fires first (see acquired())
+        slot(request_priority priority, abort_callback& p_abort);
+        ~slot();
+        slot(const slot&) = delete;
+        slot& operator=(const slot&) = delete;
+
+        // Account for `bytes` just received; sleeps if the class is over its rate cap
+        void throttle(size_t bytes);
+
+        bool acquired() const { return m_acquired; }
+
+    private:
+        request_priority m_priority;
+        bool m_acquired;
+    };
+
+    // Requests holding a slot and requests queued for one, all classes
+    void get_counts(size_t& active, size_t& waiting);
+
+    // Exit: queued requests leave the queue and rate-capped transfers stop waiting
+    void shutdown();
+
+    // While music plays, the sync and background classes run one request at a
+    // time, so they take less of the link the playing stream is using
+    void set_playback_active(bool active);
+
+private:
+    request_scheduler() = default;
+
+    static const size_t CLASS_COUNT = 4;
+
+    bool acquire(request_priority priority, abort_callback& p_abort);
+    void release(request_priority priority);
+    bool can_start(size_t cls) const;  // Caller holds m_mutex
+    void throttle(request_priority priority, size_t bytes);
+
+    // Token bucket per capped class
+    struct rate_state {
+        double tokens = 0;
+        ULONGLONG last_refill = 0;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    size_t m_active[CLASS_COUNT] = {};
+    size_t m_waiting[CLASS_COUNT] = {};
+    size_t m_total_active = 0;
+    bool m_shutdown = false;
+    bool m_playback_active = false;
+
+    std::mutex m_rate_mutex;
+    rate_state m_rates[CLASS_COUNT];
+};
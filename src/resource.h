@@ -9,6 +9,7 @@
 #define IDC_EDIT                        1005
 #define IDC_SYNC_NOW                    1006
 #define IDC_STATUS                      1007
+#define IDC_DIAGNOSTICS                 1008
 
 #define IDD_EDIT_JOB                    102
 #define IDC_SERVER_URL                  1101
@@ -18,6 +19,7 @@
 #define IDC_JOB_ENABLED                 1105
 #define IDC_MAP_FROM                    1106
 #define IDC_MAP_TO                      1107
+#define IDC_DISCOVER                    1108
 
 // Next default values for new objects
 #ifdef APSTUDIO_INVOKED
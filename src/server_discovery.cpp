@@ -0,0 +1,337 @@
+#include "stdafx.h"
+#include "server_discovery.h"
+#include "guids.h"
+#include <SDK/cfg_var.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+// Lines of "lan\t<id>\t<url>" (discovered) and "seen\t<id>\t<url>" (answered /status)
+static cfg_string cfg_discovery_cache(guid_cfg_discovery_cache, "");
+
+namespace {
+    const char* const service_type = "_nsync._tcp.local";
+    const uint16_t mdns_port = 5353;
+    const uint16_t type_a = 1, type_ptr = 12, type_txt = 16, type_srv = 33;
+
+    struct dns_record {
+        pfc::string8 name;
+        uint16_t type = 0;
+        pfc::string8 target;   // PTR/SRV target
+        uint16_t port = 0;     // SRV
+        uint32_t address = 0;  // A (network byte order)
+        pfc::string8 id;       // TXT id=...
+    };
+
+    uint16_t read_u16(const uint8_t* p) {
+        return (uint16_t)((p[0] << 8) | p[1]);
+    }
+
+    // Decode a (possibly compressed) name starting at `offset`; returns false on malformed data
+    bool read_name(const uint8_t* data, size_t size, size_t& offset, pfc::string8& out) {
+        out.reset();
+        size_t pos = offset;
+        bool jumped = false;
+        int jumps = 0;
+
+        while (pos < size) {
+            uint8_t len = data[pos];
+            if ((len & 0xC0) == 0xC0) {
+                if (pos + 1 >= size || ++jumps > 20) return false;
+                if (!jumped) offset = pos + 2;
+                pos = ((len & 0x3F) << 8) | data[pos + 1];
+                jumped = true;
+                continue;
+            }
+            pos++;
+            if (len == 0) {
+                if (!jumped) offset = pos;
+                return true;
+            }
+            if (pos + len > size) return false;
+            if (!out.is_empty()) out.add_byte('.');
+            out.add_string((const char*)data + pos, len);
+            pos += len;
+        }
+        return false;
+    }
+
+    void write_name(pfc::array_t<uint8_t>& out, const char* name) {
+        const char* ptr = name;
+        while (*ptr) {
+            const char* dot = strchr(ptr, '.');
+            size_t len = dot ? (size_t)(dot - ptr) : strlen(ptr);
+            out.append_single((uint8_t)len);
+            out.append_fromptr((const uint8_t*)ptr, len);
+            ptr += len;
+            if (*ptr == '.') ++ptr;
+        }
+        out.append_single(0);
+    }
+
+    // PTR question for the service type with the "unicast response" bit set
+    void build_query(pfc::array_t<uint8_t>& out) {
+        const uint8_t header[12] = { 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+        out.set_size(0);
+        out.append_fromptr(header, sizeof(header));
+        write_name(out, service_type);
+        const uint8_t question[4] = { 0, (uint8_t)type_ptr, 0x80, 0x01 };
+        out.append_fromptr(question, sizeof(question));
+    }
+
+    bool parse_response(const uint8_t* data, size_t size, std::vector<dns_record>& out) {
+        if (size < 12) return false;
+        if ((data[2] & 0x80) == 0) return false;  // Not a response
+
+        size_t questions = read_u16(data + 4);
+        size_t records = (size_t)read_u16(data + 6) + read_u16(data + 8) + read_u16(data + 10);
+        size_t offset = 12;
+        pfc::string8 name;
+
+        for (size_t i = 0; i < questions; ++i) {
+            if (!read_name(data, size, offset, name) || offset + 4 > size) return false;
+            offset += 4;
+        }
+
+        for (size_t i = 0; i < records; ++i) {
+            dns_record record;
+            if (!read_name(data, size, offset, record.name) || offset + 10 > size) return false;
+            record.type = read_u16(data + offset);
+            size_t rdlen = read_u16(data + offset + 8);
+            offset += 10;
+            if (offset + rdlen > size) return false;
+            size_t rdata = offset;
+            offset += rdlen;
+
+            if (record.type == type_ptr) {
+                if (!read_name(data, size, rdata, record.target)) continue;
+            } else if (record.type == type_srv && rdlen >= 7) {
+                record.port = read_u16(data + rdata + 4);
+                size_t target = rdata + 6;
+                if (!read_name(data, size, target, record.target)) continue;
+            } else if (record.type == type_a && rdlen == 4) {
+                memcpy(&record.address, data + rdata, 4);
+            } else if (record.type == type_txt) {
+                size_t pos = rdata;
+                while (pos < offset) {
+                    size_t len = data[pos];
+                    if (pos + 1 + len > offset) break;
+                    if (len > 3 && memcmp(data + pos + 1, "id=", 3) == 0) {
+                        record.id.set_string((const char*)data + pos + 4, len - 3);
+                    }
+                    pos += 1 + len;
+                }
+            } else {
+                continue;
+            }
+            out.push_back(record);
+        }
+        return true;
+    }
+
+    pfc::string8 format_url(uint32_t address, uint16_t port) {
+        const uint8_t* b = (const uint8_t*)&address;
+        pfc::string8 url;
+        url << "http://" << (int)b[0] << "." << (int)b[1] << "." << (int)b[2] << "." << (int)b[3] << ":" << (int)port;
+        return url;
+    }
+}
+
+server_discovery& server_discovery::get() {
+    static server_discovery instance;
+    return instance;
+}
+
+bool server_discovery::browse(DWORD timeout_ms, std::vector<discovered_server>& out) {
+    out.clear();
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        WSACleanup();
+        return false;
+    }
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = 0;  // Ephemeral source port: responders answer us directly
+    DWORD ttl = 255;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl, sizeof(ttl));
+
+    pfc::array_t<uint8_t> query;
+    build_query(query);
+
+    sockaddr_in group = {};
+    group.sin_family = AF_INET;
+    group.sin_port = htons(mdns_port);
+    group.sin_addr.s_addr = htonl(0xE00000FB);  // 224.0.0.251
+
+    if (bind(sock, (sockaddr*)&local, sizeof(local)) != 0 ||
+        sendto(sock, (const char*)query.get_ptr(), (int)query.get_size(), 0, (sockaddr*)&group, sizeof(group)) == SOCKET_ERROR) {
+        closesocket(sock);
+        WSACleanup();
+        return false;
+    }
+
+    // Collect answers until the deadline
+    std::vector<dns_record> records;
+    std::vector<uint32_t> senders;
+    ULONGLONG deadline = GetTickCount64() + timeout_ms;
+    uint8_t buffer[9000];
+
+    for (;;) {
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) break;
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(sock, &readable);
+        timeval wait = { (long)((deadline - now) / 1000), (long)(((deadline - now) % 1000) * 1000) };
+        if (select(0, &readable, nullptr, nullptr, &wait) <= 0) break;
+
+        sockaddr_in from = {};
+        int from_len = sizeof(from);
+        int received = recvfrom(sock, (char*)buffer, sizeof(buffer), 0, (sockaddr*)&from, &from_len);
+        if (received <= 0) continue;
+
+        size_t before = records.size();
+        if (parse_response(buffer, (size_t)received, records)) {
+            senders.resize(records.size(), from.sin_addr.s_addr);
+        } else {
+            records.resize(before);
+        }
+    }
+
+    closesocket(sock);
+    WSACleanup();
+
+    // Resolve PTR -> SRV -> A/TXT for every instance of our service
+    for (size_t i = 0; i < records.size(); ++i) {
+        const auto& ptr = records[i];
+        if (ptr.type != type_ptr || pfc::stricmp_ascii(ptr.name, service_type) != 0) continue;
+
+        const dns_record* srv = nullptr;
+        pfc::string8 id;
+        for (const auto& r : records) {
+            if (r.type == type_srv && r.name == ptr.target) srv = &r;
+            if (r.type == type_txt && r.name == ptr.target && !r.id.is_empty()) id = r.id;
+        }
+        if (!srv || id.is_empty()) continue;
+
+        uint32_t address = senders[i];
+        for (const auto& r : records) {
+            if (r.type == type_a && r.name == srv->target) address = r.address;
+        }
+
+        discovered_server server;
+        server.server_id = id;
+        server.name.set_string(ptr.target, ptr.target.length() > strlen(service_type) + 1
+            ? ptr.target.length() - strlen(service_type) - 1 : ptr.target.length());
+        server.url = format_url(address, srv->port);
+
+        bool duplicate = false;
+        for (const auto& existing : out) {
+            if (existing.server_id == server.server_id) duplicate = true;
+        }
+        if (!duplicate) out.push_back(server);
+    }
+
+    if (!out.empty()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        load_cache();
+        bool changed = false;
+        for (const auto& server : out) {
+            auto& url = m_lan_urls[server.server_id];
+            if (url != server.url) {
+                url = server.url;
+                changed = true;
+            }
+        }
+        if (changed) save_cache();
+    }
+
+    return true;
+}
+
+void server_discovery::remember_endpoint(const char* url, const char* server_id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    load_cache();
+
+    auto& id = m_endpoint_ids[pfc::string8(url)];
+    if (id != server_id) {
+        id = server_id;
+        save_cache();
+    }
+}
+
+pfc::string8 server_discovery::lookup_server_id(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    load_cache();
+
+    auto it = m_endpoint_ids.find(pfc::string8(url));
+    return it != m_endpoint_ids.end() ? it->second : pfc::string8();
+}
+
+bool server_discovery::lookup_lan_url(const char* server_id, pfc::string8& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    load_cache();
+
+    auto it = m_lan_urls.find(pfc::string8(server_id));
+    if (it == m_lan_urls.end()) return false;
+    out = it->second;
+    return true;
+}
+
+void server_discovery::load_cache() {
+    if (m_loaded) return;
+    m_loaded = true;
+
+    pfc::string8 cache = cfg_discovery_cache.get();
+    const char* ptr = cache.c_str();
+    while (*ptr) {
+        const char* line_end = strchr(ptr, '\n');
+        pfc::string8 line;
+        line.set_string(ptr, line_end ? (size_t)(line_end - ptr) : strlen(ptr));
+        ptr = line_end ? line_end + 1 : ptr + strlen(ptr);
+
+        const char* tab1 = strchr(line.c_str(), '\t');
+        const char* tab2 = tab1 ? strchr(tab1 + 1, '\t') : nullptr;
+        if (!tab2) continue;
+
+        pfc::string8 kind, id;
+        kind.set_string(line.c_str(), tab1 - line.c_str());
+        id.set_string(tab1 + 1, tab2 - tab1 - 1);
+
+        if (kind == "lan") m_lan_urls[id] = tab2 + 1;
+        else if (kind == "seen") m_endpoint_ids[pfc::string8(tab2 + 1)] = id;
+    }
+}
+
+void server_discovery::save_cache() {
+    pfc::string8 cache;
+    for (const auto& entry : m_lan_urls) {
+        cache << "lan\t" << entry.first << "\t" << entry.second << "\n";
+    }
+    for (const auto& entry : m_endpoint_ids) {
+        cache << "seen\t" << entry.second << "\t" << entry.first << "\n";
+    }
+
+    // cfg_var writes belong on the main thread; flush() also runs at exit in
+    // case this is still queued then
+    m_pending_cache = cache;
+    m_cache_dirty = true;
+    fb2k::inMainThread([]() { server_discovery::get().flush(); });
+}
+
+void server_discovery::flush() {
+    pfc::string8 cache;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_cache_dirty) return;
+        m_cache_dirty = false;
+        cache = m_pending_cache;
+    }
+    cfg_discovery_cache = cache;
+}
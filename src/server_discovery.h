@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <windows.h>
+
+struct discovered_server {
+    pfc::string8 server_id;  // From the TXT record (id=...)
+    pfc::string8 name;       // Instance name, e.g. "nas"
+    pfc::string8 url;        // e.g. "http://192.168.1.50:8090"
+};
+
+// Finds NSync servers on the local network via mDNS/DNS-SD (_nsync._tcp.local)
+// and remembers which addresses belong to which server ID.
+// The server reports its ID in the X-NSync-Server-Id header of /status, so a
+// job configured with a public URL can be matched to the server found on the LAN.
+class server_discovery {
+public:
+    static server_discovery& get();
+
+    // Query the LAN (blocks up to timeout_ms). Answers are added to the cache.
+    bool browse(DWORD timeout_ms, std::vector<discovered_server>& out);
+
+    // Record that `url` answered /status as `server_id`
+    void remember_endpoint(const char* url, const char* server_id);
+
+    // Server ID last seen at `url` (empty if unknown)
+    pfc::string8 lookup_server_id(const char* url);
+
+    // LAN address discovered for `server_id` (false if none)
+    bool lookup_lan_url(const char* server_id, pfc::string8& out);
+
+    // Writes a cache update that has not reached the config yet (main thread, at exit)
+    void flush();
+
+private:
+    server_discovery() = default;
+
+    void load_cache();
+    void save_cache();  // Caller holds m_mutex
+
+    std::mutex m_mutex;
+    bool m_loaded = false;
+    bool m_cache_dirty = false;
+    pfc::string8 m_pending_cache;  // Serialized cache not yet written to cfg_discovery_cache
+    std::map<pfc::string8, pfc::string8> m_endpoint_ids;  // url -> server ID
+    std::map<pfc::string8, pfc::string8> m_lan_urls;      // server ID -> discovered url
+};
@@ -0,0 +1,187 @@
+#include "stdafx.h"
+#include "server_health.h"
+#include "http_client.h"
+#include <algorithm>
+#include <random>
+
+namespace {
+    const unsigned CIRCUIT_FAILURE_THRESHOLD = 3;
+    const DWORD PROBE_TIMEOUT_MS = 1500;
+    const DWORD PROBE_BASE_DELAY_MS = 5000;     // First probe after the circuit opens
+    const DWORD PROBE_MAX_DELAY_MS = 60000;
+    const DWORD RETRY_BASE_DELAY_MS = 1000;
+
+    DWORD random_below(DWORD bound) {
+        thread_local std::mt19937 rng(std::random_device{}());
+        return bound > 0 ? std::uniform_int_distribution<DWORD>(0, bound - 1)(rng) : 0;
+    }
+
+    // Probe cool-down: doubles per failed probe, with +-25% jitter so many
+    // clients of one server do not probe in lockstep
+    DWORD probe_delay_ms(unsigned attempt) {
+        DWORD delay = PROBE_BASE_DELAY_MS << std::min(attempt, 4u);
+        delay = std::min(delay, PROBE_MAX_DELAY_MS);
+        return delay - delay / 4 + random_below(delay / 2);
+    }
+}
+
+server_health& server_health::get() {
+    static server_health instance;
+    return instance;
+}
+
+pfc::string8 server_health::origin_of(const char* url) {
+    url_parts parts;
+    pfc::string8 origin;
+    if (!url_parts::parse(url, parts)) {
+        return origin;
+    }
+    origin << parts.scheme << "://" << parts.host << ":" << parts.port;
+    return origin;
+}
+
+bool server_health::allow_request(const char* url) {
+    // /status requests always go through: they are how a circuit closes
+    const char* path = strstr(url, "://");
+    path = path ? strchr(path + 3, '/') : nullptr;
+    if (path && strcmp(path, "/status") == 0) {
+        return true;
+    }
+    return !is_open(url);
+}
+
+bool server_health::is_open(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_servers.find(origin_of(url));
+    return it != m_servers.end() && it->second.open;
+}
+
+void server_health::record_success(const char* url) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_servers.find(origin_of(url));
+    if (it == m_servers.end()) return;
+
+    it->second.consecutive_failures = 0;
+    if (it->second.open) {
+        close_circuit(it->first);
+    }
+}
+
+void server_health::record_failure(const char* url) {
+    pfc::string8 origin = origin_of(url);
+    if (origin.is_empty()) return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& state = m_servers[origin];
+    state.consecutive_failures++;
+
+    if (!state.open && state.consecutive_failures >= CIRCUIT_FAILURE_THRESHOLD) {
+        state.open = true;
+        state.probe_attempts = 0;
+        state.next_probe = GetTickCount64() + probe_delay_ms(0);
+        console::formatter() << "foo_nsync: " << origin << " is not responding - pausing requests until it is back";
+        m_cv.notify_all();
+    }
+}
+
+DWORD server_health::retry_delay_ms(unsigned attempt, DWORD cap_ms) {
+    DWORD window = RETRY_BASE_DELAY_MS << std::min(attempt, 10u);
+    return random_below(std::min(window, cap_ms)) + 1;
+}
+
+void server_health::set_recovered_callback(std::function<void(const char* origin)> callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_on_recovered = std::move(callback);
+}
+
+std::vector<server_health::server_status> server_health::get_servers() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<server_status> servers;
+    for (const auto& entry : m_servers) {
+        server_status status;
+        status.origin = entry.first;
+        status.open = entry.second.open;
+        status.consecutive_failures = entry.second.consecutive_failures;
+        servers.push_back(status);
+    }
+    return servers;
+}
+
+void server_health::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running) return;
+
+    m_running = true;
+    m_thread = std::thread([this]() { probe_loop(); });
+}
+
+void server_health::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_running = false;
+        m_cv.notify_all();
+    }
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void server_health::probe_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_running) {
+        // Sleep until the earliest due probe (or indefinitely while every circuit is closed)
+        ULONGLONG now = GetTickCount64();
+        ULONGLONG next_due = 0;
+        pfc::string8 due;
+        for (const auto& server : m_servers) {
+            if (!server.second.open) continue;
+            if (server.second.next_probe <= now) {
+                due = server.first;
+                break;
+            }
+            if (next_due == 0 || server.second.next_probe < next_due) {
+                next_due = server.second.next_probe;
+            }
+        }
+
+        if (due.is_empty()) {
+            if (next_due == 0) {
+                m_cv.wait(lock);
+            } else {
+                m_cv.wait_for(lock, std::chrono::milliseconds(next_due - now));
+            }
+            continue;
+        }
+
+        lock.unlock();
+        pfc::string8 status_url, response, error;
+        status_url << due << "/status";
+        bool ok = nsync_http_client::get().get_sync(status_url.c_str(), response, error, PROBE_TIMEOUT_MS, nullptr,
+            request_priority::playback);
+        lock.lock();
+
+        auto it = m_servers.find(due);
+        if (it == m_servers.end() || !it->second.open) continue;
+        if (ok) {
+            close_circuit(due);
+        } else {
+            it->second.probe_attempts++;
+            it->second.next_probe = GetTickCount64() + probe_delay_ms(it->second.probe_attempts);
+        }
+    }
+}
+
+void server_health::close_circuit(const pfc::string8& origin) {
+    auto& state = m_servers[origin];
+    state.open = false;
+    state.consecutive_failures = 0;
+    state.probe_attempts = 0;
+    console::formatter() << "foo_nsync: " << origin << " is reachable again";
+
+    if (m_on_recovered) {
+        auto callback = m_on_recovered;
+        fb2k::inMainThread([callback, origin]() { callback(origin.c_str()); });
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <windows.h>
+
+// Tracks the health of each server (scheme://host:port) across all requests.
+// After CIRCUIT_FAILURE_THRESHOLD consecutive transport failures the circuit
+// opens: requests fail immediately instead of waiting out their timeouts.
+// A background /status probe, with growing cool-down, closes it again.
+class server_health {
+public:
+    static server_health& get();
+
+    // "scheme://host:port" part of a URL
+    static pfc::string8 origin_of(const char* url);
+
+    // False while the server's circuit is open (the request should fail fast)
+    bool allow_request(const char* url);
+    bool is_open(const char* url);
+
+    // Request outcomes: failure = no usable answer (connect/timeout/5xx)
+    void record_success(const char* url);
+    void record_failure(const char* url);
+
+    // Delay before retry `attempt` (0-based): full jitter over an exponential window
+    static DWORD retry_delay_ms(unsigned attempt, DWORD cap_ms);
+
+    // Invoked on the main thread when a server recovers
+    void set_recovered_callback(std::function<void(const char* origin)> callback);
+
+    // Background probing of open circuits
+    void start();
+    void stop();
+
+    // Every server seen so far, for diagnostics
+    struct server_status {
+        pfc::string8 origin;
+        bool open = false;
+        unsigned consecutive_failures = 0;
+    };
+    std::vector<server_status> get_servers();
+
+private:
+    server_health() = default;
+
+    struct server_state {
+        unsigned consecutive_failures = 0;
+        bool open = false;
+        unsigned probe_attempts = 0;
+        ULONGLONG next_probe = 0;  // GetTickCount64() time of the next /status probe
+    };
+
+    void probe_loop();
+    void close_circuit(const pfc::string8& origin);  // Caller holds m_mutex
+
+    std::mutex m_mutex;
+    std::map<pfc::string8, server_state> m_servers;
+    std::function<void(const char*)> m_on_recovered;
+
+    std::thread m_thread;
+    std::condition_variable m_cv;
+    bool m_running = false;
+};
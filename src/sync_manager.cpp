@@ -1,33 +1,201 @@
 #include "stdafx.h"
 #include "sync_manager.h"
 #include "http_client.h"
+#include "endpoint_router.h"
+#include "server_health.h"
+#include "server_discovery.h"
+#include "link_estimator.h"
+#include "m3u8_parser.h"
+#include "sync_plan.h"
+#include "sync_trace.h"
+#include "artwork_trace.h"
+#include "diagnostics.h"
+#include "memory_budget.h"
 #include <SDK/playlist.h>
-#include <set>
+#include <algorithm>
+
+// A playlist being diffed while it downloads: entries arrive on the request's
+// thread and go straight from the parser into the plan (see sync_plan). Its
+// sets count against the memory budget for as long as the sync holds it.
+struct sync_manager::playlist_stream {
+    explicit playlist_stream(const char* base_url) : plan(base_url) {
+        budget_id = memory_budget::get().add("Playlist sync", memory_budget::trim_never,
+            [this]() { return plan.memory_bytes(); });
+    }
+    ~playlist_stream() { memory_budget::get().remove(budget_id); }
+
+    size_t budget_id = 0;
+
+    sync_plan plan;
+    m3u8_stream_parser parser{ [this](const char* path, size_t length) { plan.add_entry(path, length); } };
+};
 
 namespace {
-    // Comparator for pfc::string8 in std::set (case-insensitive)
-    struct pfc_string8_compare {
-        bool operator()(const pfc::string8& a, const pfc::string8& b) const {
-            return pfc::stricmp_ascii(a.c_str(), b.c_str()) < 0;
+    // Jobs whose endpoint is "search:<query>" mirror server-side search results
+    const char* const search_endpoint_prefix = "search:";
+
+    bool is_search_job(const SyncJob& job) {
+        return job.playlist_endpoint.has_prefix(search_endpoint_prefix);
+    }
+
+    // Percent-encode a query string value (RFC 3986 unreserved chars pass through)
+    void append_url_encoded(pfc::string8& out, const char* in) {
+        static const char hex[] = "0123456789ABCDEF";
+        for (const unsigned char* p = (const unsigned char*)in; *p; ++p) {
+            unsigned char c = *p;
+            if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                c == '-' || c == '_' || c == '.' || c == '~') {
+                out.add_byte((char)c);
+            } else {
+                out.add_byte('%');
+                out.add_byte(hex[c >> 4]);
+                out.add_byte(hex[c & 0xF]);
+            }
         }
-    };
+    }
+
+    // URL builders take the base URL chosen by endpoint_router for the job
+    pfc::string8 make_search_url(const SyncJob& job, const char* base_url, const char* format) {
+        pfc::string8 url;
+        url << base_url << "/search?format=" << format << "&q=";
+        append_url_encoded(url, job.playlist_endpoint.c_str() + strlen(search_endpoint_prefix));
+        return url;
+    }
+
+    pfc::string8 make_hash_url(const SyncJob& job, const char* base_url) {
+        if (is_search_job(job)) return make_search_url(job, base_url, "hash");
+        pfc::string8 url;
+        url << base_url << "/hash/" << job.playlist_endpoint;
+        return url;
+    }
+
+    pfc::string8 make_playlist_url(const SyncJob& job, const char* base_url) {
+        if (is_search_job(job)) return make_search_url(job, base_url, "m3u8");
+        pfc::string8 url;
+        url << base_url << "/playlist/" << job.playlist_endpoint;
+        return url;
+    }
+
+    // Time for the server to rescan one playlist of a batch, as for POST /sync
+    const DWORD BATCH_TIMEOUT_PER_JOB_MS = 10000;
+
+    // A server that does not know /sync-batch, as opposed to one that failed it
+    bool is_unsupported_reply(const pfc::string8& error) {
+        return error == "HTTP 400" || error == "HTTP 404" || error == "HTTP 405" || error == "HTTP 501";
+    }
+
+    // A job's sync hops between threads, so its phases are traced on a row of its own
+    const uint32_t trace_track_base = 0x10000;
+
+    // Sync phases are timed for the diagnostics page, and traced while tracing is on
+    uint64_t phase_start() {
+        return sync_trace::now_us();
+    }
+
+    void end_phase(size_t job_index, const char* phase, uint64_t start_us, bool success) {
+        uint64_t end_us = sync_trace::now_us();
+        diagnostics::get().record_sync_phase(job_index, phase, (end_us - start_us) / 1000);
+        if (!sync_trace::get().enabled()) return;
+        pfc::string8 args;
+        sync_trace::add_arg(args, "result", success ? "ok" : "failed");
+        sync_trace::get().complete(phase, "sync", start_us, end_us, args.c_str(),
+            trace_track_base + (uint32_t)job_index);
+    }
 }
 
 namespace {
+    // Transient failures are retried this many times before waiting for the next poll
+    const unsigned MAX_RETRIES = 4;
+    const DWORD MAX_RETRY_DELAY_MS = 60000;
+}
+
+namespace {
+    // Deferred startup: the first check comes this long after the message
+    // loop starts, then one per interval until the main thread has no input or paint
+    // pending, or the waits run out
+    const UINT STARTUP_CHECK_MS = 1000;
+    const unsigned MAX_STARTUP_WAITS = 10;
+
+    // How long exit waits for aborted requests to return from WinHTTP
+    const DWORD SHUTDOWN_DRAIN_MS = 2000;
+
+    // Playlist additions made per timer tick while music plays
+    const size_t APPLY_SLICE_WHILE_PLAYING = 100;
+
     // Timer callback - Windows message-based timer
     void CALLBACK timer_proc(HWND, UINT, UINT_PTR, DWORD) {
         sync_manager::get().on_timer();
     }
+
+    void CALLBACK startup_timer_proc(HWND, UINT, UINT_PTR, DWORD) {
+        sync_manager::get().on_startup_timer();
+    }
 }
 
+// Track changes release removals held back for the playing item
+class sync_manager::playback_watcher : public play_callback_impl_base {
+public:
+    playback_watcher() : play_callback_impl_base(flag_on_playback_new_track | flag_on_playback_stop) {}
+    void on_playback_new_track(metadb_handle_ptr) override { sync_manager::get().remove_deferred(); }
+    void on_playback_stop(play_control::t_stop_reason) override { sync_manager::get().remove_deferred(); }
+};
+
 sync_manager& sync_manager::get() {
     static sync_manager instance;
     return instance;
 }
 
+bool sync_manager::is_playback_active() const {
+    auto playback = playback_control::get();
+    return playback->is_playing() && !playback->is_paused();
+}
+
+void sync_manager::schedule_start() {
+    if (m_started || m_startup_timer_id != 0) return;
+    m_startup_waits = 0;
+    m_startup_timer_id = SetTimer(NULL, 0, STARTUP_CHECK_MS, startup_timer_proc);
+    if (m_startup_timer_id == 0) {
+        start();
+    }
+}
+
+void sync_manager::on_startup_timer() {
+    // Input or painting still queued means the user or the UI is busy - wait a little longer
+    bool busy = HIWORD(GetQueueStatus(QS_INPUT | QS_PAINT)) != 0;
+    if (busy && ++m_startup_waits < MAX_STARTUP_WAITS) return;
+    start();
+}
+
+void sync_manager::ensure_started() {
+    if (!m_started) {
+        start();
+    }
+}
+
 void sync_manager::start() {
+    if (m_startup_timer_id != 0) {
+        KillTimer(NULL, m_startup_timer_id);
+        m_startup_timer_id = 0;
+    }
+    if (m_started) return;
+    m_started = true;
+
     auto& config = sync_config::get();
+    m_playback_watcher = std::make_unique<playback_watcher>();
+    m_pending_budget_id = memory_budget::get().add("Pending playlist additions", memory_budget::trim_never,
+        [this]() { return m_pending_bytes.load(std::memory_order_relaxed); });
     m_syncing.resize(config.get_job_count(), false);
+    m_retry.resize(config.get_job_count());
+    restore_retries();
+    m_priority.resize(config.get_job_count(), request_priority::sync);
+
+    // Jobs that failed against a server that is back are synced right away
+    server_health::get().set_recovered_callback([this](const char*) { retry_failed_jobs(); });
+    server_health::get().start();
+
+    // Keep synced playlists pointed at whichever server URL is currently fastest
+    endpoint_router::get().set_route_changed_callback([this]() { rebase_all(); });
+    endpoint_router::get().start();
 
     if (config.is_enabled() && config.get_job_count() > 0) {
         start_timer();
@@ -37,15 +205,51 @@ void sync_manager::start() {
 }
 
 void sync_manager::stop() {
+    if (m_startup_timer_id != 0) {
+        KillTimer(NULL, m_startup_timer_id);
+        m_startup_timer_id = 0;
+    }
+    // Nothing was started (or created) if foobar2000 quit before the deferred start
+    if (!m_started) return;
+
     stop_timer();
+
+    // Abort every request, even mid-sync; pending completions are dropped, so
+    // nothing posts back into the teardown. The probe threads then see their
+    // requests fail at once and join quickly.
+    if (!nsync_http_client::get().shutdown(SHUTDOWN_DRAIN_MS)) {
+        console::formatter() << "foo_nsync: Requests still running at exit were abandoned";
+    }
+    endpoint_router::get().stop();
+    server_health::get().stop();
+
+    m_playback_watcher.reset();
+    memory_budget::get().remove(m_pending_budget_id);
+
+    sync_config::get().flush_state();
+    server_discovery::get().flush();
+    sync_trace::get().shutdown();
+    artwork_trace::get().shutdown();
 }
 
 void sync_manager::reload_config() {
+    ensure_started();
     auto& config = sync_config::get();
     // Ensure m_syncing matches job count (preserve existing states if possible, though unlikely needed)
     if (m_syncing.size() != config.get_job_count()) {
         m_syncing.resize(config.get_job_count(), false);
     }
+    if (m_retry.size() != config.get_job_count()) {
+        m_retry.resize(config.get_job_count());
+    }
+    if (m_priority.size() != config.get_job_count()) {
+        m_priority.resize(config.get_job_count(), request_priority::sync);
+    }
+
+    // The first job added (or sync turned back on) starts polling without a restart
+    if (config.is_enabled() && config.get_job_count() > 0) {
+        start_timer();
+    }
 }
 
 void sync_manager::start_timer() {
@@ -66,20 +270,42 @@ void sync_manager::on_timer() {
     m_tick_count++;
 
     auto& config = sync_config::get();
+    config.flush_state();
+    sync_trace::get().tick();
+    artwork_trace::get().tick();
+    memory_budget::get().enforce();  // Syncs in progress grow between ticks
+    diagnostics::get().sample();
+
+    // Syncs and polls share the link with the playing stream - fewer at a time while it plays
+    bool playing = is_playback_active();
+    request_scheduler::get().set_playback_active(playing);
+    apply_pending(playing);
     if (!config.is_enabled()) return;
 
+    ULONGLONG now = GetTickCount64();
+    std::vector<size_t> due;
     for (size_t i = 0; i < config.get_job_count(); ++i) {
         const auto& job = config.get_job(i);
         if (job.enabled && !m_syncing[i]) {
-            // Check if it's time to poll this job
-            if (m_tick_count % job.poll_interval_seconds == 0) {
-                check_and_sync_job(i);
+            // A scheduled retry after a transient failure takes precedence
+            if (i < m_retry.size() && m_retry[i].retry_at != 0 && now >= m_retry[i].retry_at) {
+                m_retry[i].retry_at = 0;
+                check_and_sync_job(i, request_priority::background);
+                continue;
+            }
+
+            // Check if it's time to poll this job (pointless while its server is down)
+            if (m_tick_count % job.poll_interval_seconds == 0 &&
+                !server_health::get().is_open(endpoint_router::get().resolve(job.server_url))) {
+                due.push_back(i);
             }
         }
     }
+    sync_jobs(due, request_priority::background);
 }
 
 void sync_manager::sync_now(size_t job_index) {
+    ensure_started();
     auto& config = sync_config::get();
     
     // Safety check: ensure vector is sized
@@ -93,15 +319,77 @@ void sync_manager::sync_now(size_t job_index) {
 }
 
 void sync_manager::sync_all() {
+    ensure_started();
     auto& config = sync_config::get();
-    for (size_t i = 0; i < config.get_job_count(); ++i) {
+    std::vector<size_t> due;
+    for (size_t i = 0; i < config.get_job_count() && i < m_syncing.size(); ++i) {
         const auto& job = config.get_job(i);
         if (job.enabled && !m_syncing[i]) {
+            due.push_back(i);
+        }
+    }
+    sync_jobs(due, request_priority::sync);
+}
+
+void sync_manager::retry_failed_jobs() {
+    auto& config = sync_config::get();
+    if (!config.is_enabled()) return;
+
+    for (size_t i = 0; i < config.get_job_count() && i < m_syncing.size(); ++i) {
+        const auto& job = config.get_job(i);
+        if (job.enabled && !m_syncing[i] && !job.last_error.is_empty()) {
             check_and_sync_job(i);
         }
     }
 }
 
+void sync_manager::schedule_retry(size_t job_index, const char* url, const char* error) {
+    if (job_index >= m_retry.size()) return;
+    auto& retry = m_retry[job_index];
+
+    // Client errors (404 etc.) will not go away by retrying. An open circuit has
+    // its own /status probe; the job is retried when it closes.
+    bool client_error = pfc::strcmp_partial(error, "HTTP 4") == 0;
+    if (client_error || server_health::get().is_open(url) || retry.attempts >= MAX_RETRIES) {
+        retry.attempts = 0;
+        retry.retry_at = 0;
+    } else {
+        retry.retry_at = GetTickCount64() + retry_delay_ms(job_index, retry.attempts);
+        retry.attempts++;
+    }
+    sync_config::get().record_job_failure(job_index, retry.attempts);
+}
+
+DWORD sync_manager::retry_delay_ms(size_t job_index, unsigned attempt) const {
+    const auto& job = sync_config::get().get_job(job_index);
+    DWORD cap = std::min<DWORD>(MAX_RETRY_DELAY_MS, (DWORD)job.poll_interval_seconds * 1000);
+    return server_health::retry_delay_ms(attempt, cap);
+}
+
+void sync_manager::restore_retries() {
+    // Backoff survives a restart: a job that was failing resumes at the delay it
+    // had reached instead of starting over, armed from now
+    auto& config = sync_config::get();
+    ULONGLONG now = GetTickCount64();
+    for (size_t i = 0; i < config.get_job_count() && i < m_retry.size(); ++i) {
+        unsigned attempts = std::min(config.get_job(i).retry_attempts, MAX_RETRIES);
+        if (attempts == 0) continue;
+        m_retry[i].attempts = attempts;
+        m_retry[i].retry_at = now + retry_delay_ms(i, attempts - 1);
+    }
+}
+
+request_priority sync_manager::job_priority(size_t job_index) const {
+    return job_index < m_priority.size() ? m_priority[job_index] : request_priority::sync;
+}
+
+void sync_manager::clear_retry(size_t job_index) {
+    if (job_index >= m_retry.size()) return;
+    m_retry[job_index].attempts = 0;
+    m_retry[job_index].retry_at = 0;
+    sync_config::get().record_job_success(job_index);
+}
+
 bool sync_manager::is_syncing(size_t job_index) const {
     return job_index < m_syncing.size() && m_syncing[job_index];
 }
@@ -114,50 +402,214 @@ void sync_manager::remove_callback(isync_callback* cb) {
     m_callbacks.remove_item(cb);
 }
 
-void sync_manager::check_and_sync_job(size_t job_index) {
-    auto& config = sync_config::get();
-    if (job_index >= config.get_job_count()) return;
-
-    const auto& job = config.get_job(job_index);
+void sync_manager::begin_job(size_t job_index, request_priority priority) {
+    const auto& job = sync_config::get().get_job(job_index);
     m_syncing[job_index] = true;
+    if (job_index < m_priority.size()) {
+        m_priority[job_index] = priority;
+    }
 
     // Notify start
     for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
         m_callbacks[i]->on_sync_progress(job_index, "Syncing server...", 10);
     }
+    diagnostics::get().record_sync_start(job_index);
+    if (sync_trace::get().enabled()) {
+        sync_trace::get().name_track(trace_track_base + (uint32_t)job_index, job.target_playlist);
+    }
+}
+
+void sync_manager::check_and_sync_job(size_t job_index, request_priority priority) {
+    auto& config = sync_config::get();
+    if (job_index >= config.get_job_count()) return;
+
+    const auto& job = config.get_job(job_index);
+    begin_job(job_index, priority);
+
+    // Search results have no server-side playlist to refresh - go straight to the hash
+    if (is_search_job(job)) {
+        request_hash(job_index);
+        return;
+    }
 
     // First, trigger incremental sync on server via POST /sync/{name}
     pfc::string8 sync_url;
-    sync_url << job.server_url << "/sync/" << job.playlist_endpoint;
+    sync_url << endpoint_router::get().resolve(job.server_url) << "/sync/" << job.playlist_endpoint;
 
     nsync_http_client::get().post_async(sync_url.c_str(),
-        [this, job_index](bool success, const pfc::string8& response, const pfc::string8& error) {
+        [this, job_index, started = phase_start()](bool success, const pfc::string8& response, const pfc::string8& error) {
+            end_phase(job_index, "server sync", started, success);
             auto& config = sync_config::get();
             if (job_index >= config.get_job_count()) {
                 m_syncing[job_index] = false;
                 return;
             }
 
-            auto& job = config.get_job_mutable(job_index);
-
             if (!success) {
                 // Server sync failed - continue to check hash anyway
                 // (server might not support incremental sync yet)
             }
 
-            // Now check the hash
-            for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
-                m_callbacks[i]->on_sync_progress(job_index, "Checking...", 30);
+            request_hash(job_index);
+        }, job_priority(job_index));
+}
+
+bool sync_manager::parse_batch_line(const pfc::string8& line, pfc::string8& out_name, batch_result& out) {
+    // name <TAB> hash <TAB> error
+    const char* tab1 = strchr(line.c_str(), '\t');
+    const char* tab2 = tab1 ? strchr(tab1 + 1, '\t') : nullptr;
+    if (!tab2) return false;
+
+    out_name.set_string(line.c_str(), tab1 - line.c_str());
+    out.hash.set_string(tab1 + 1, tab2 - tab1 - 1);
+    out.error = tab2 + 1;
+    return true;
+}
+
+void sync_manager::sync_jobs(const std::vector<size_t>& job_indices, request_priority priority) {
+    auto& config = sync_config::get();
+    std::map<pfc::string8, std::vector<size_t>> by_server;
+    for (size_t job_index : job_indices) {
+        if (job_index >= config.get_job_count()) continue;
+        const auto& job = config.get_job(job_index);
+        pfc::string8 base_url = endpoint_router::get().resolve(job.server_url);
+        if (is_search_job(job) || m_batch_unsupported.count(base_url) != 0) {
+            check_and_sync_job(job_index, priority);
+        } else {
+            by_server[base_url].push_back(job_index);
+        }
+    }
+
+    for (const auto& server : by_server) {
+        if (server.second.size() == 1) {
+            check_and_sync_job(server.second[0], priority);
+        } else {
+            request_batch(server.first, server.second, priority);
+        }
+    }
+}
+
+void sync_manager::request_batch(const pfc::string8& base_url, const std::vector<size_t>& job_indices,
+                                 request_priority priority) {
+    auto& config = sync_config::get();
+    auto batch = std::make_shared<batch_state>();
+    batch->started = phase_start();
+    pfc::string8 url;
+    url << base_url << "/sync-batch";
+    for (size_t job_index : job_indices) {
+        const auto& job = config.get_job(job_index);
+        begin_job(job_index, priority);
+        url << (batch->jobs.empty() ? "?name=" : "&name=");
+        append_url_encoded(url, job.playlist_endpoint.c_str());
+        batch->jobs.push_back(job_index);
+        batch->endpoints.push_back(job.playlist_endpoint);
+    }
+    batch->answered.resize(batch->jobs.size(), false);
+
+    // The server rescans the playlists one after another and writes each line
+    // as it finishes, so every one gets the time a single POST /sync would
+    DWORD timeout_ms = BATCH_TIMEOUT_PER_JOB_MS * (DWORD)batch->jobs.size();
+
+    nsync_http_client::get().post_lines_async(url.c_str(), timeout_ms,
+        [this, batch](const pfc::string8& line) {
+            pfc::string8 name;
+            batch_result result;
+            if (!parse_batch_line(line, name, result)) return;
+            for (size_t i = 0; i < batch->jobs.size(); ++i) {
+                if (batch->answered[i] || batch->endpoints[i] != name) continue;
+                batch->answered[i] = true;
+                size_t job_index = batch->jobs[i];
+                end_phase(job_index, "batch check", batch->started, true);
+                if (!is_batch_job(*batch, i)) continue;
+
+                if (result.hash.is_empty()) {
+                    // No playlist file: fail as a /hash 404 would, without retries
+                    pfc::string8 missing("HTTP 404");
+                    if (!result.error.is_empty()) missing << " (" << result.error << ")";
+                    check_hash_and_download(job_index, false, pfc::string8(), missing);
+                } else {
+                    check_hash_and_download(job_index, true, result.hash, pfc::string8());
+                }
+            }
+        },
+        [this, batch, base_url, priority](bool success, const pfc::string8&, const pfc::string8& error) {
+            if (success) {
+                // No RTT sample: the reply's time is mostly the server's rescans
+                endpoint_router::get().report_success(base_url, -1.0);
+            }
+
+            // An older server (or a sharded one) has no /sync-batch; stop asking it
+            bool unsupported = !success && is_unsupported_reply(error);
+            if (unsupported) {
+                m_batch_unsupported.insert(base_url);
             }
 
-            pfc::string8 hash_url;
-            hash_url << job.server_url << "/hash/" << job.playlist_endpoint;
+            for (size_t i = 0; i < batch->jobs.size(); ++i) {
+                if (batch->answered[i]) continue;
+                batch->answered[i] = true;
+                size_t job_index = batch->jobs[i];
+                end_phase(job_index, "batch check", batch->started, success);
+                if (!is_batch_job(*batch, i)) continue;
+
+                // Nothing was rescanned by a server without /sync-batch. Otherwise
+                // the rescan may have run before the reply broke off, so only the
+                // hash is asked for; that request has its own failover and retries
+                if (unsupported) {
+                    check_and_sync_job(job_index, priority);
+                } else {
+                    request_hash(job_index);
+                }
+            }
+        }, priority);
+}
 
-            nsync_http_client::get().get_async(hash_url.c_str(),
-                [this, job_index](bool success, const pfc::string8& response, const pfc::string8& error) {
-                    check_hash_and_download(job_index, success, response, error);
-                });
-        });
+bool sync_manager::is_batch_job(const batch_state& batch, size_t i) {
+    size_t job_index = batch.jobs[i];
+    auto& config = sync_config::get();
+    // The job list may have been edited while the batch ran
+    if (job_index < config.get_job_count() && config.get_job(job_index).playlist_endpoint == batch.endpoints[i]) {
+        return true;
+    }
+    if (job_index < m_syncing.size()) {
+        m_syncing[job_index] = false;
+    }
+    return false;
+}
+
+void sync_manager::request_hash(size_t job_index, bool is_retry) {
+    auto& config = sync_config::get();
+    if (job_index >= config.get_job_count()) {
+        m_syncing[job_index] = false;
+        return;
+    }
+
+    const auto& job = config.get_job(job_index);
+    pfc::string8 base_url = endpoint_router::get().resolve(job.server_url);
+
+    // Now check the hash
+    for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
+        m_callbacks[i]->on_sync_progress(job_index, "Checking...", 30);
+    }
+
+    nsync_http_client::get().get_async(make_hash_url(job, base_url).c_str(),
+        [this, job_index, base_url, is_retry, started = phase_start()](bool success, const pfc::string8& response, const pfc::string8& error) {
+            end_phase(job_index, "hash check", started, success);
+            if (success) {
+                // The request's own time includes queueing; the client's estimate of this server does not
+                endpoint_router::get().report_success(base_url, link_estimator::get().response_time_ms(base_url));
+            } else {
+                // Fail over once if another of the job's endpoints is usable
+                auto& router = endpoint_router::get();
+                router.report_failure(base_url);
+                auto& config = sync_config::get();
+                if (!is_retry && job_index < config.get_job_count() &&
+                    router.resolve(config.get_job(job_index).server_url) != base_url) {
+                    request_hash(job_index, true);
+                    return;
+                }
+            }
+            check_hash_and_download(job_index, success, response, error);
+        }, job_priority(job_index));
 }
 
 void sync_manager::check_hash_and_download(size_t job_index, bool success, const pfc::string8& response, const pfc::string8& error) {
@@ -172,6 +624,7 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
     if (!success) {
         job.last_error = error;
         m_syncing[job_index] = false;
+        schedule_retry(job_index, make_hash_url(job, endpoint_router::get().resolve(job.server_url)), error);
         console::formatter() << "foo_nsync: Error checking " << job.playlist_endpoint << ": " << error;
         for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
             m_callbacks[i]->on_sync_complete(job_index, "Error");
@@ -188,8 +641,14 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
         force_update = true;
     }
 
-    if (response == job.last_hash && !force_update) {
-        // No change
+    // A download still being applied in slices counts as the current one
+    auto pending = m_pending_apply.find(job.target_playlist);
+    bool pending_hash = pending != m_pending_apply.end() && pending->second.hash == response;
+
+    if ((response == job.last_hash || pending_hash) && !force_update) {
+        // No change - but the route may have moved since the playlist was applied
+        rebase_playlist(job, idx);
+        clear_retry(job_index);
         job.last_error.reset();
         m_syncing[job_index] = false;
         for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
@@ -203,11 +662,12 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
         m_callbacks[i]->on_sync_progress(job_index, "Downloading...", 50);
     }
 
-    pfc::string8 playlist_url;
-    playlist_url << job.server_url << "/playlist/" << job.playlist_endpoint;
-
-    nsync_http_client::get().get_async(playlist_url.c_str(),
-        [this, job_index, new_hash = response](bool success, const pfc::string8& response, const pfc::string8& error) {
+    pfc::string8 playlist_url = make_playlist_url(job, endpoint_router::get().resolve(job.server_url));
+    auto stream = begin_playlist_stream(job);
+    nsync_http_client::get().get_stream_async(playlist_url.c_str(),
+        [stream](const uint8_t* data, size_t size) { stream->parser.feed((const char*)data, size); },
+        [this, job_index, playlist_url, stream, new_hash = response, started = phase_start()](bool success, const pfc::string8&, const pfc::string8& error) {
+            end_phase(job_index, "download and parse", started, success);
             auto& config = sync_config::get();
             if (job_index >= config.get_job_count()) {
                 m_syncing[job_index] = false;
@@ -219,6 +679,7 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
             if (!success) {
                 job.last_error = error;
                 m_syncing[job_index] = false;
+                schedule_retry(job_index, playlist_url, error);
                 console::formatter() << "foo_nsync: Error downloading " << job.playlist_endpoint << ": " << error;
                 for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
                    m_callbacks[i]->on_sync_complete(job_index, "Error");
@@ -231,13 +692,23 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
                 m_callbacks[i]->on_sync_progress(job_index, "Updating Playlist...", 80);
             }
 
-            // Update playlist
-            update_playlist(job, response);
+            // Entries were parsed and diffed during the download - apply the result
+            uint64_t apply_started = phase_start();
+            stream->parser.finish();
+            apply_playlist_stream(job, *stream);
+            end_phase(job_index, "apply", apply_started, true);
 
-            // Update stored hash
-            job.last_hash = new_hash;
+            // Update stored hash (written out by the next timer tick, not a full config save).
+            // Work left pending during playback holds it back until it is done
+            auto pending = m_pending_apply.find(job.target_playlist);
+            if (pending != m_pending_apply.end()) {
+                pending->second.job_index = job_index;
+                pending->second.hash = new_hash;
+            } else {
+                config.set_job_hash(job_index, new_hash);
+            }
             job.last_error.reset();
-            config.save();
+            clear_retry(job_index);
 
             m_syncing[job_index] = false;
 
@@ -245,48 +716,7 @@ void sync_manager::check_hash_and_download(size_t job_index, bool success, const
             for (size_t i = 0; i < m_callbacks.get_count(); ++i) {
                 m_callbacks[i]->on_sync_complete(job_index, "OK");
             }
-        });
-}
-
-void sync_manager::parse_m3u8(const pfc::string8& content, pfc::list_t<pfc::string8>& out_paths) {
-    // Split by lines and extract file paths
-    const char* ptr = content.c_str();
-    const char* end = ptr + content.length();
-    
-    while (ptr < end) {
-        const char* line_end = ptr;
-        while (line_end < end && *line_end != '\n' && *line_end != '\r') {
-            ++line_end;
-        }
-        
-        // Skip empty lines and comments
-        if (line_end > ptr && *ptr != '#') {
-            pfc::string8 line;
-            line.set_string(ptr, line_end - ptr);
-            
-            // Trim whitespace
-            line.skip_trailing_char(' ');
-            line.skip_trailing_char('\t');
-            
-            if (line.length() > 0) {
-                // Check if it's a relative path/URL from our generator
-                if (line.has_prefix("/stream/") || line.has_prefix("/")) {
-                    // Prepend server URL
-                    // Need to access current job config here. 
-                    // But parse_m3u8 is a helper that doesn't know the job.
-                    // We should move this logic to update_playlist or pass the prefix.
-                    // For now, let's just add it as is, and handle it in update_playlist.
-                }
-                out_paths.add_item(line);
-            }
-        }
-        
-        // Move past line ending
-        ptr = line_end;
-        while (ptr < end && (*ptr == '\n' || *ptr == '\r')) {
-            ++ptr;
-        }
-    }
+        }, job_priority(job_index));
 }
 
 size_t sync_manager::find_or_create_playlist(const char* name) {
@@ -302,87 +732,293 @@ size_t sync_manager::find_or_create_playlist(const char* name) {
     return api->create_playlist(name, pfc_infinite, pfc_infinite);
 }
 
-void sync_manager::update_playlist(const SyncJob& job, const pfc::string8& playlist_content) {
-    // Parse m3u8 content
-    pfc::list_t<pfc::string8> file_paths;
-    parse_m3u8(playlist_content, file_paths);
+void sync_manager::rebase_all() {
+    auto& config = sync_config::get();
+    auto api = playlist_manager::get();
+    for (size_t i = 0; i < config.get_job_count(); ++i) {
+        const auto& job = config.get_job(i);
+        size_t idx = api->find_playlist(job.target_playlist, pfc_infinite);
+        if (idx != pfc_infinite) {
+            rebase_playlist(job, idx);
+        }
+    }
+}
+
+void sync_manager::rebase_playlist(const SyncJob& job, size_t playlist_index) {
+    if (playlist_index == pfc_infinite) return;
+    sync_trace::scope trace("rebase playlist", "apply");
+
+    std::vector<pfc::string8> endpoints;
+    endpoint_router::get().get_candidates(job.server_url, endpoints);
+    if (endpoints.size() < 2) return;
+
+    pfc::string8 base_url = endpoint_router::get().resolve(job.server_url);
+    auto api = playlist_manager::get();
+    size_t count = api->playlist_get_item_count(playlist_index);
+    metadb_hint_list::ptr hints;
+    size_t rebased = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        metadb_handle_ptr item;
+        if (!api->playlist_get_item_handle(item, playlist_index, i)) continue;
+        const char* path = item->get_path();
+
+        for (const auto& endpoint : endpoints) {
+            if (endpoint == base_url) continue;
+            if (pfc::strcmp_partial(path, endpoint.c_str()) != 0 || path[endpoint.length()] != '/') continue;
 
-    // Apply path mappings - convert to full URLs
-    for (size_t i = 0; i < file_paths.get_count(); ++i) {
-        pfc::string8& path = file_paths[i];
+            // Same track on the current endpoint - swap the handle in place and
+            // carry the known tags over so nothing has to be re-read from the network
+            pfc::string8 new_path = base_url;
+            new_path << (path + endpoint.length());
 
-        // Check for streaming URL (new mode)
-        if (path.has_prefix("/stream/")) {
-            pfc::string8 full_url = job.server_url;
-            full_url << path;
-            path = full_url;
+            metadb_handle_ptr new_item;
+            metadb::get()->handle_create(new_item, make_playable_location(new_path.c_str(), item->get_subsong_index()));
+
+            metadb_info_container::ptr info;
+            if (item->get_info_ref(info)) {
+                if (!hints.is_valid()) hints = metadb_io_v2::get()->create_hint_list();
+                hints->add_hint(new_item, info->info(), info->stats(), true);
+            }
+
+            api->playlist_replace_item(playlist_index, i, new_item);
+            rebased++;
+            break;
         }
     }
 
-    if (file_paths.get_count() == 0) {
-        console::formatter() << "foo_nsync: Warning - playlist '" << job.target_playlist << "' is empty";
-        return;
+    if (hints.is_valid()) {
+        hints->on_done();
+    }
+    if (rebased > 0) {
+        console::formatter() << "foo_nsync: Moved " << (int)rebased << " tracks in '" << job.target_playlist << "' to " << base_url;
+    }
+}
+
+std::shared_ptr<sync_manager::playlist_stream> sync_manager::begin_playlist_stream(const SyncJob& job) {
+    sync_trace::scope trace("snapshot playlist", "apply");
+    auto stream = std::make_shared<playlist_stream>(endpoint_router::get().resolve(job.server_url).c_str());
+
+    auto api = playlist_manager::get();
+    size_t playlist_index = api->find_playlist(job.target_playlist, pfc_infinite);
+    if (playlist_index == pfc_infinite) {
+        return stream;
+    }
+
+    // Move tracks still addressed via another of the job's endpoints first,
+    // so a route change is not mistaken for a full remove + re-add
+    rebase_playlist(job, playlist_index);
+
+    size_t count = api->playlist_get_item_count(playlist_index);
+    for (size_t i = 0; i < count; ++i) {
+        metadb_handle_ptr item;
+        if (api->playlist_get_item_handle(item, playlist_index, i)) {
+            stream->plan.add_existing(item->get_path());
+        }
     }
+    memory_budget::get().enforce();
+    return stream;
+}
 
-    // Build set of downloaded paths for quick lookup
-    std::set<pfc::string8, pfc_string8_compare> downloaded_paths;
-    for (size_t i = 0; i < file_paths.get_count(); ++i) {
-        downloaded_paths.insert(file_paths[i]);
+void sync_manager::apply_playlist_stream(const SyncJob& job, const playlist_stream& stream) {
+    sync_trace::scope trace("apply playlist", "apply");
+    if (stream.plan.empty()) {
+        console::formatter() << "foo_nsync: Warning - playlist '" << job.target_playlist << "' is empty";
+        m_pending_apply.erase(job.target_playlist);
+        update_pending_bytes();
+        return;
     }
 
     // Find or create target playlist
     size_t playlist_index = find_or_create_playlist(job.target_playlist.c_str());
     auto api = playlist_manager::get();
+    rebase_playlist(job, playlist_index);
+
+    // A new apply supersedes what the last one left pending for this playlist
+    pending_apply& pending = m_pending_apply[job.target_playlist];
+    pending = pending_apply();
+
+    // The playing item is never removed mid-song: it goes when the track changes
+    size_t playing_playlist = pfc_infinite, playing_item = pfc_infinite;
+    if (!api->get_playing_item_location(&playing_playlist, &playing_item) || playing_playlist != playlist_index) {
+        playing_item = pfc_infinite;
+    }
 
-    // Build set of existing paths in local playlist and track indices for removal
-    std::set<pfc::string8, pfc_string8_compare> existing_paths;
-    pfc::bit_array_bittable remove_mask(api->playlist_get_item_count(playlist_index));
+    // The playlist may have been edited during the download, so removals and
+    // additions are checked against it as it is now (one pass, set lookups only)
+    location_set current_paths;
     size_t existing_count = api->playlist_get_item_count(playlist_index);
+    pfc::bit_array_bittable remove_mask(existing_count);
     size_t remove_count = 0;
 
     for (size_t i = 0; i < existing_count; ++i) {
         metadb_handle_ptr item;
         if (api->playlist_get_item_handle(item, playlist_index, i)) {
-            pfc::string8 item_path(item->get_path());
-            existing_paths.insert(item_path);
+            std::string item_path(item->get_path());
 
-            // Check if this item should be removed (not in downloaded playlist)
-            if (downloaded_paths.find(item_path) == downloaded_paths.end()) {
-                remove_mask.set(i, true);
-                remove_count++;
+            // Remove items that are no longer in the downloaded playlist
+            if (!stream.plan.keeps(item_path)) {
+                if (i == playing_item) {
+                    pending.deferred_removal = item_path.c_str();
+                } else {
+                    remove_mask.set(i, true);
+                    remove_count++;
+                }
             }
+            current_paths.insert(std::move(item_path));
         }
     }
 
-    // Find new paths (in downloaded playlist but not in local)
     pfc::list_t<const char*> new_locations;
-    pfc::list_t<pfc::string8> new_paths_storage;  // Keep strings alive
+    for (const auto& location : stream.plan.added()) {
+        if (current_paths.find(location) == current_paths.end()) {
+            new_locations.add_item(location.c_str());
+        }
+    }
+    size_t added_count = new_locations.get_count();
 
-    for (size_t i = 0; i < file_paths.get_count(); ++i) {
-        if (existing_paths.find(file_paths[i]) == existing_paths.end()) {
-            new_paths_storage.add_item(file_paths[i]);
+    // While music plays, additions go in slices, one per timer tick, so
+    // reading their info does not compete with the decoder (see apply_pending)
+    if (is_playback_active() && new_locations.get_count() > APPLY_SLICE_WHILE_PLAYING) {
+        for (size_t i = APPLY_SLICE_WHILE_PLAYING; i < new_locations.get_count(); ++i) {
+            pending.additions.push_back(new_locations[i]);
         }
+        new_locations.truncate(APPLY_SLICE_WHILE_PLAYING);
+        update_pending_bytes();
     }
 
-    // Remove items that are no longer in the playlist
     if (remove_count > 0) {
         api->playlist_remove_items(playlist_index, remove_mask);
     }
+    if (new_locations.get_count() > 0) {
+        api->playlist_add_locations(playlist_index, new_locations, false, nullptr);
+    }
+
+    if (sync_trace::get().enabled()) {
+        sync_trace::add_arg(trace.args, "playlist", job.target_playlist.c_str());
+        sync_trace::add_arg(trace.args, "entries", (int64_t)stream.plan.entry_count());
+        sync_trace::add_arg(trace.args, "removed", (int64_t)remove_count);
+        sync_trace::add_arg(trace.args, "added", (int64_t)added_count);
+        sync_trace::add_arg(trace.args, "deferred", (int64_t)pending.additions.size());
+    }
+
+    if (pending.additions.empty() && pending.deferred_removal.is_empty()) {
+        m_pending_apply.erase(job.target_playlist);
+    }
+}
+
+void sync_manager::apply_pending(bool playback_active) {
+    if (m_pending_apply.empty()) return;
+    auto api = playlist_manager::get();
+
+    for (auto it = m_pending_apply.begin(); it != m_pending_apply.end();) {
+        auto& pending = it->second;
+        if (pending.next_addition < pending.additions.size()) {
+            size_t playlist_index = api->find_playlist(it->first, pfc_infinite);
+            size_t end = pending.additions.size();
+            if (playback_active) end = std::min(end, pending.next_addition + APPLY_SLICE_WHILE_PLAYING);
 
-    // Add new items
-    if (new_paths_storage.get_count() > 0) {
-        for (size_t i = 0; i < new_paths_storage.get_count(); ++i) {
-            new_locations.add_item(new_paths_storage[i].c_str());
+            if (playlist_index != pfc_infinite) {
+                sync_trace::scope trace("apply pending additions", "apply");
+                pfc::list_t<const char*> locations;
+                for (size_t i = pending.next_addition; i < end; ++i) {
+                    locations.add_item(pending.additions[i].c_str());
+                }
+                api->playlist_add_locations(playlist_index, locations, false, nullptr);
+                pending.next_addition = end;
+            } else {
+                pending.next_addition = pending.additions.size();  // The playlist is gone
+                pending.dropped = true;
+            }
+
+            if (pending.next_addition >= pending.additions.size()) {
+                pending.additions.clear();
+                pending.additions.shrink_to_fit();
+                pending.next_addition = 0;
+            }
+        }
+
+        if (pending.additions.empty() && pending.deferred_removal.is_empty()) {
+            commit_pending(it->first, pending);
+            it = m_pending_apply.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    update_pending_bytes();
+}
+
+void sync_manager::remove_deferred() {
+    auto api = playlist_manager::get();
+    size_t playing_playlist = pfc_infinite, playing_item = pfc_infinite;
+    if (!api->get_playing_item_location(&playing_playlist, &playing_item)) {
+        playing_playlist = playing_item = pfc_infinite;
+    }
+
+    for (auto& entry : m_pending_apply) {
+        auto& pending = entry.second;
+        if (pending.deferred_removal.is_empty()) continue;
+        size_t playlist_index = api->find_playlist(entry.first, pfc_infinite);
+        if (playlist_index == pfc_infinite) {
+            pending.deferred_removal.reset();
+            pending.dropped = true;
+            continue;
+        }
+
+        // Still playing (repeat, or the same item again) - keep waiting
+        bool still_playing = false;
+        size_t count = api->playlist_get_item_count(playlist_index);
+        pfc::bit_array_bittable remove_mask(count);
+        size_t remove_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            metadb_handle_ptr item;
+            if (!api->playlist_get_item_handle(item, playlist_index, i)) continue;
+            if (pfc::stricmp_ascii(item->get_path(), pending.deferred_removal.c_str()) != 0) continue;
+            if (playlist_index == playing_playlist && i == playing_item) {
+                still_playing = true;
+            } else {
+                remove_mask.set(i, true);
+                remove_count++;
+            }
+        }
+
+        if (remove_count > 0) {
+            api->playlist_remove_items(playlist_index, remove_mask);
+        }
+        if (!still_playing) {
+            pending.deferred_removal.reset();
+        }
+    }
+}
+
+void sync_manager::commit_pending(const pfc::string8& target_playlist, const pending_apply& pending) {
+    if (pending.dropped || pending.hash.is_empty()) return;
+    auto& config = sync_config::get();
+    // The job list may have been edited since the download
+    if (pending.job_index < config.get_job_count() &&
+        config.get_job(pending.job_index).target_playlist == target_playlist) {
+        config.set_job_hash(pending.job_index, pending.hash);
+    }
+}
+
+void sync_manager::update_pending_bytes() {
+    size_t bytes = 0;
+    for (const auto& entry : m_pending_apply) {
+        bytes += entry.second.additions.capacity() * sizeof(pfc::string8);
+        for (const auto& location : entry.second.additions) {
+            bytes += location.get_length() + 1;
         }
-        api->playlist_add_locations(playlist_index, new_locations, false, nullptr);
     }
+    m_pending_bytes.store(bytes, std::memory_order_relaxed);
 }
 
 // Initquit service to manage sync_manager lifecycle
 class sync_initquit : public initquit {
 public:
     void on_init() override {
-        sync_manager::get().start();
+        // Only arms a timer: WM_TIMER is dispatched once the main message loop
+        // runs, which is after the UI is up (see schedule_start)
+        sync_manager::get().schedule_start();
     }
     void on_quit() override {
         sync_manager::get().stop();
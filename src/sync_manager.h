@@ -2,13 +2,23 @@
 
 #include <SDK/foobar2000.h>
 #include "config.h"
+#include "request_scheduler.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
 
 // Manages playlist sync polling and updates
 class sync_manager {
 public:
     static sync_manager& get();
     
-    // Lifecycle
+    // Lifecycle. Startup is deferred until the UI is up and the main thread
+    // is idle, so the component adds next to nothing to foobar2000's launch;
+    // preferences actions start it earlier if they come first.
+    void schedule_start();
+    void on_startup_timer();
+    void ensure_started();
     void start();
     void stop();
     
@@ -40,19 +50,95 @@ private:
     void start_timer();
     void stop_timer();
     
-    void check_and_sync_job(size_t job_index);
+    // Due jobs on the same server share one POST /sync-batch, which rescans
+    // their playlists and streams back each hash as its rescan finishes,
+    // instead of a /sync and a /hash round trip each. A changed playlist is
+    // downloaded as soon as its line arrives, in parallel with the rest.
+    // Search jobs, lone jobs and servers without /sync-batch use
+    // check_and_sync_job.
+    void sync_jobs(const std::vector<size_t>& job_indices, request_priority priority);
+    void request_batch(const pfc::string8& base_url, const std::vector<size_t>& job_indices, request_priority priority);
+    struct batch_result {
+        pfc::string8 hash;   // Empty if the playlist is missing
+        pfc::string8 error;
+    };
+    struct batch_state {
+        std::vector<size_t> jobs;
+        std::vector<pfc::string8> endpoints;  // To recognise the jobs if the list is edited meanwhile
+        std::vector<bool> answered;
+        uint64_t started = 0;
+    };
+    static bool parse_batch_line(const pfc::string8& line, pfc::string8& out_name, batch_result& out);
+    bool is_batch_job(const batch_state& batch, size_t i);
+
+    void begin_job(size_t job_index, request_priority priority);
+    void check_and_sync_job(size_t job_index, request_priority priority = request_priority::sync);
+    void request_hash(size_t job_index, bool is_retry = false);
     void check_hash_and_download(size_t job_index, bool success, const pfc::string8& response, const pfc::string8& error);
-    void update_playlist(const SyncJob& job, const pfc::string8& playlist_content);
-    
-    // Parse m3u8 content into file paths
-    void parse_m3u8(const pfc::string8& content, pfc::list_t<pfc::string8>& out_paths);
+
+    // Streaming playlist update: snapshot the local playlist (main thread),
+    // diff entries as they download, then apply the result (main thread)
+    struct playlist_stream;
+    std::shared_ptr<playlist_stream> begin_playlist_stream(const SyncJob& job);
+    void apply_playlist_stream(const SyncJob& job, const playlist_stream& stream);
+
+    // Playback awareness. While music plays, large additions are applied in
+    // slices from the timer, and the playing item is not removed until the
+    // track changes. Both are kept per target playlist until done, and only
+    // then is the job's hash stored: work dropped on the way (quitting, the
+    // playlist deleted) leaves the old hash, so the next poll applies it again.
+    class playback_watcher;
+    struct pending_apply {
+        std::vector<pfc::string8> additions;  // In playlist order
+        size_t next_addition = 0;
+        pfc::string8 deferred_removal;        // Location of the playing item the server dropped
+        size_t job_index = pfc_infinite;      // Job and hash to store once done
+        pfc::string8 hash;
+        bool dropped = false;
+    };
+    bool is_playback_active() const;
+    void apply_pending(bool playback_active);
+    void remove_deferred();
+    void commit_pending(const pfc::string8& target_playlist, const pending_apply& pending);
+    void update_pending_bytes();
+
+    // Jittered exponential backoff after transient failures
+    void schedule_retry(size_t job_index, const char* url, const char* error);
+    void clear_retry(size_t job_index);
+    void retry_failed_jobs();
+    DWORD retry_delay_ms(size_t job_index, unsigned attempt) const;
+    void restore_retries();  // From the attempts kept in the sync state store
+
+    // Request class of the job's current sync: background for timer polls
+    request_priority job_priority(size_t job_index) const;
+
+    // Point tracks addressed via another of the job's server URLs at the current one
+    void rebase_playlist(const SyncJob& job, size_t playlist_index);
+    void rebase_all();
     
     // Find or create playlist by name, returns index
     size_t find_or_create_playlist(const char* name);
     
     UINT_PTR m_timer_id = 0;
+    UINT_PTR m_startup_timer_id = 0;
+    unsigned m_startup_waits = 0;
+    bool m_started = false;
     std::vector<bool> m_syncing;
+
+    struct retry_state {
+        unsigned attempts = 0;
+        ULONGLONG retry_at = 0;  // GetTickCount64() time, 0 = none scheduled
+    };
+    std::vector<retry_state> m_retry;
+    std::vector<request_priority> m_priority;
     int m_tick_count = 0;
     
     pfc::list_t<isync_callback*> m_callbacks;
+
+    std::set<pfc::string8> m_batch_unsupported;  // Base URLs without /sync-batch
+
+    std::unique_ptr<playback_watcher> m_playback_watcher;
+    std::map<pfc::string8, pending_apply> m_pending_apply;  // By target playlist
+    std::atomic<size_t> m_pending_bytes{ 0 };  // For the memory budget
+    size_t m_pending_budget_id = 0;
 };
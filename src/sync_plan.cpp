@@ -0,0 +1,54 @@
+#include "sync_plan.h"
+#include <cstring>
+
+namespace {
+    char ascii_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+    }
+
+    // A set node holds the string and three links plus a colour
+    const size_t set_node_bytes = sizeof(std::string) + 4 * sizeof(void*);
+
+    size_t string_heap_bytes(const std::string& s) {
+        return s.capacity() + 1;
+    }
+}
+
+bool location_less::operator()(const std::string& a, const std::string& b) const {
+    size_t n = a.size() < b.size() ? a.size() : b.size();
+    for (size_t i = 0; i < n; ++i) {
+        char ca = ascii_lower(a[i]), cb = ascii_lower(b[i]);
+        if (ca != cb) return (unsigned char)ca < (unsigned char)cb;
+    }
+    return a.size() < b.size();
+}
+
+sync_plan::sync_plan(const char* base_url) : m_base_url(base_url) {
+}
+
+void sync_plan::add_existing(const char* location) {
+    auto inserted = m_existing.insert(location);
+    if (inserted.second) {
+        count_bytes(set_node_bytes + string_heap_bytes(*inserted.first));
+    }
+}
+
+void sync_plan::add_entry(const char* path, size_t length) {
+    std::string location;
+    if (length >= 8 && memcmp(path, "/stream/", 8) == 0) {
+        location.reserve(m_base_url.size() + length);
+        location = m_base_url;  // Server-relative stream URL
+    }
+    location.append(path, length);
+
+    auto inserted = m_downloaded.insert(location);
+    if (!inserted.second) return;
+    count_bytes(set_node_bytes + string_heap_bytes(*inserted.first));
+
+    if (m_existing.count(location) == 0) {
+        size_t capacity = m_added.capacity();
+        count_bytes(string_heap_bytes(location));
+        m_added.push_back(std::move(location));
+        count_bytes((m_added.capacity() - capacity) * sizeof(std::string));
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <vector>
+
+// Track locations compare case-insensitively (ASCII), as foobar2000 paths do
+struct location_less {
+    bool operator()(const std::string& a, const std::string& b) const;
+};
+using location_set = std::set<std::string, location_less>;
+
+// The diff at the heart of a playlist sync. Entries of the downloaded playlist
+// are turned into track locations as they arrive and compared against the
+// local playlist as it was when the download started, so applying the result
+// takes a single pass. Free of foobar2000 types (and built without the
+// precompiled header) so bench/ can drive it headless.
+class sync_plan {
+public:
+    // `base_url` is prefixed to server-relative /stream/ entries
+    explicit sync_plan(const char* base_url);
+
+    // Snapshot of the local playlist; complete before the first entry
+    void add_existing(const char* location);
+
+    // One playlist entry, in playlist order
+    void add_entry(const char* path, size_t length);
+
+    bool empty() const { return m_downloaded.empty(); }
+    size_t entry_count() const { return m_downloaded.size(); }
+
+    // Whether a local track is still in the downloaded playlist
+    bool keeps(const std::string& location) const { return m_downloaded.count(location) != 0; }
+
+    // Entries that were not in the snapshot, in playlist order
+    const std::vector<std::string>& added() const { return m_added; }
+
+    // Approximate heap use of the sets and the added list; safe to read from
+    // another thread while entries are being added
+    size_t memory_bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+private:
+    void count_bytes(size_t bytes) { m_bytes.store(m_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed); }
+
+    std::string m_base_url;
+    location_set m_existing;
+    location_set m_downloaded;
+    std::vector<std::string> m_added;
+    std::atomic<size_t> m_bytes{ 0 };  // Written by the adding thread only
+};
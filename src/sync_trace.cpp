@@ -0,0 +1,157 @@
+#include "stdafx.h"
+#include "sync_trace.h"
+#include "config.h"
+
+namespace {
+    const char* const trace_file_name = "foo_nsync_trace.json";
+
+    void append_json_string(pfc::string8& out, const char* value) {
+        out << "\"";
+        for (const char* p = value; *p; ++p) {
+            switch (*p) {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if ((unsigned char)*p < 0x20) {
+                    char escaped[8];
+                    sprintf_s(escaped, "\\u%04x", (unsigned char)*p);
+                    out << escaped;
+                } else {
+                    out.add_byte(*p);
+                }
+            }
+        }
+        out << "\"";
+    }
+}
+
+sync_trace& sync_trace::get() {
+    static sync_trace instance;
+    return instance;
+}
+
+uint64_t sync_trace::now_us() {
+    static const LARGE_INTEGER frequency = []() {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f;
+    }();
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000 +
+        counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+void sync_trace::add_arg(pfc::string8& args, const char* key, const char* value) {
+    if (!args.is_empty()) args << ",";
+    append_json_string(args, key);
+    args << ":";
+    append_json_string(args, value);
+}
+
+void sync_trace::add_arg(pfc::string8& args, const char* key, int64_t value) {
+    if (!args.is_empty()) args << ",";
+    append_json_string(args, key);
+    args << ":" << pfc::format_int(value);
+}
+
+void sync_trace::complete(const char* name, const char* category, uint64_t start_us, uint64_t end_us, const char* args,
+                          uint32_t track) {
+    if (!enabled()) return;
+
+    pfc::string8 event;
+    event << "{\"name\":";
+    append_json_string(event, name);
+    event << ",\"cat\":\"" << category << "\",\"ph\":\"X\",\"ts\":" << pfc::format_uint(start_us)
+          << ",\"dur\":" << pfc::format_uint(end_us > start_us ? end_us - start_us : 0)
+          << ",\"pid\":1,\"tid\":" << (track != 0 ? track : (uint32_t)GetCurrentThreadId())
+          << ",\"args\":{" << args << "}}";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_event(event);
+}
+
+void sync_trace::name_track(uint32_t track, const char* name) {
+    if (!enabled()) return;
+
+    pfc::string8 args;
+    add_arg(args, "name", name);
+    pfc::string8 event;
+    event << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track << ",\"args\":{" << args << "}}";
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_event(event);
+}
+
+void sync_trace::write_event(const pfc::string8& event) {
+    if (!m_file) return;
+    fputs(m_first_event ? "\n" : ",\n", m_file);
+    fputs(event.c_str(), m_file);
+    m_first_event = false;
+}
+
+void sync_trace::tick() {
+    bool want = sync_config::get().is_trace_enabled();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (want && !m_file) {
+        open();
+    } else if (!want && m_file) {
+        close();
+    } else if (m_file) {
+        fflush(m_file);
+    }
+}
+
+void sync_trace::shutdown() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    close();
+}
+
+void sync_trace::open() {
+    pfc::string8 native_path;
+    if (!extract_native_path(core_api::get_profile_path(), native_path)) return;
+    native_path.add_filename(trace_file_name);
+
+    if (_wfopen_s(&m_file, pfc::stringcvt::string_wide_from_utf8(native_path.c_str()), L"wb") != 0) {
+        m_file = nullptr;
+        console::formatter() << "foo_nsync: Could not create trace file " << native_path;
+        return;
+    }
+
+    // Array form: the closing bracket is optional, so an unfinished trace still loads
+    fputs("[", m_file);
+    m_first_event = true;
+    m_enabled = true;
+    console::formatter() << "foo_nsync: Recording trace to " << native_path;
+
+    // Label the thread tick() runs on, which is foobar2000's main thread
+    pfc::string8 args;
+    add_arg(args, "name", "main");
+    pfc::string8 event;
+    event << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << (uint32_t)GetCurrentThreadId()
+          << ",\"args\":{" << args << "}}";
+    write_event(event);
+}
+
+void sync_trace::close() {
+    m_enabled = false;
+    if (!m_file) return;
+    fputs("\n]\n", m_file);
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+sync_trace::scope::scope(const char* name, const char* category)
+    : m_name(name), m_category(category), m_start(sync_trace::get().enabled() ? now_us() : 0) {
+}
+
+sync_trace::scope::~scope() {
+    if (m_start != 0) {
+        if (result) add_arg(args, "result", result);
+        sync_trace::get().complete(m_name, m_category, m_start, now_us(), args.c_str());
+    }
+}
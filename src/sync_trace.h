@@ -0,0 +1,68 @@
+#pragma once
+
+#include <pfc/pfc.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <windows.h>
+
+// Opt-in timing recorder (Advanced > Tools > Playlist Sync). Spans are appended
+// to foo_nsync_trace.json in the profile folder, in Chrome trace format: load
+// it in chrome://tracing or ui.perfetto.dev. Switching tracing on starts a new
+// file; a file cut short by a crash still loads.
+class sync_trace {
+public:
+    static sync_trace& get();
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // Microseconds on the trace clock
+    static uint64_t now_us();
+
+    // A finished span. `args` is the inside of a JSON object built with add_arg
+    // (may be empty). It is shown on the calling thread's row, or on `track`
+    // for work that spans several threads, such as one job's sync.
+    void complete(const char* name, const char* category, uint64_t start_us, uint64_t end_us, const char* args = "",
+                  uint32_t track = 0);
+
+    // Row label for a track passed to complete()
+    void name_track(uint32_t track, const char* name);
+
+    // Picks up the Advanced setting and flushes the file (main thread, from the sync timer)
+    void tick();
+    void shutdown();
+
+    // Append "key":value to an args string
+    static void add_arg(pfc::string8& args, const char* key, const char* value);
+    static void add_arg(pfc::string8& args, const char* key, int64_t value);
+
+    // Records a span covering its lifetime; does nothing while tracing is off
+    class scope {
+    public:
+        scope(const char* name, const char* category);
+        ~scope();
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        pfc::string8 args;             // Filled in by the owner before the scope ends
+        const char* result = nullptr;  // Added to args as "result" if set
+
+    private:
+        const char* m_name;
+        const char* m_category;
+        uint64_t m_start;  // 0 = not recording
+    };
+
+private:
+    sync_trace() = default;
+
+    void open();   // Caller holds m_mutex
+    void close();  // Caller holds m_mutex
+    void write_event(const pfc::string8& event);  // Caller holds m_mutex
+
+    std::atomic<bool> m_enabled{ false };
+    std::mutex m_mutex;
+    FILE* m_file = nullptr;
+    bool m_first_event = true;
+};